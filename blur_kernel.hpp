@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace util::draw
+{
+	// Taps of one direction of the separable blur, in the layout of the blur constants of both backends.
+	// Entry 0 is the center texel, every other entry is sampled at +offset and -offset with bilinear filtering
+	struct blur_kernel
+	{
+		static constexpr uint32_t max_entries = 96; // size of the shader constant arrays
+		static constexpr uint32_t max_taps = 32;    // per side, wider kernels sample a sparser grid
+
+		uint32_t taps = 0; // entries used, including the center
+		std::array<float, max_entries> weights = {};
+		std::array<float, max_entries> offsets = {};
+	};
+
+	// Gaussian with sigma = strength / 3 reaching strength texels to each side. Neighbouring texels are merged into one
+	// tap at their weighted center so the bilinear filter does the rest, two per tap while that fits into max_taps.
+	// Beyond that each tap stands for stride texels, like blurring a downsampled copy, so the cost per pixel stays
+	// bounded for large radii at the price of some aliasing. Extra blur passes smooth that out
+	inline blur_kernel make_blur_kernel(const uint8_t strength)
+	{
+		auto kernel = blur_kernel{};
+		kernel.weights[0] = 1.f;
+		kernel.taps = 1;
+		if (!strength)
+			return kernel;
+
+		const auto radius = static_cast<uint32_t>(strength);
+		const auto sigma = static_cast<float>(strength) / 3.f;
+		const auto gauss = [sigma](const uint32_t x)
+		{
+			// the normalization below makes the usual 1 / (sqrt(2 pi) sigma) factor pointless
+			return std::exp(-0.5f * static_cast<float>(x * x) / (sigma * sigma));
+		};
+
+		const auto stride = std::max(2u, (radius + blur_kernel::max_taps - 1) / blur_kernel::max_taps);
+		auto sum = gauss(0);
+		for (auto first = 1u; first <= radius; first += stride)
+		{
+			const auto last = std::min(first + stride - 1, radius);
+			auto weight = 0.f, center = 0.f;
+			for (auto x = first; x <= last; ++x)
+			{
+				weight += gauss(x);
+				center += gauss(x) * static_cast<float>(x);
+			}
+
+			kernel.weights[kernel.taps] = weight;
+			kernel.offsets[kernel.taps] = center / weight;
+			kernel.taps++;
+			sum += weight * 2.f;
+		}
+
+		kernel.weights[0] = gauss(0);
+		for (auto i = 0u; i < kernel.taps; ++i)
+			kernel.weights[i] /= sum;
+		return kernel;
+	}
+
+	// Kernels for every strength, built on first use and shared by all backends
+	inline const blur_kernel& blur_kernel_for(const uint8_t strength)
+	{
+		static const auto kernels = []
+		{
+			auto table = std::make_unique<std::array<blur_kernel, 256>>();
+			for (auto i = 0u; i < table->size(); ++i)
+				(*table)[i] = make_blur_kernel(static_cast<uint8_t>(i));
+			return table;
+		}();
+		return (*kernels)[strength];
+	}
+
+	// Reference of one pass of the blur shaders over a tightly packed image with channels floats per pixel, for checking
+	// kernels against a plain convolution. Bilinear taps and mirrored edges like the sampler the backends blur with
+	inline void apply_blur_kernel(const blur_kernel& kernel, const std::vector<float>& src, std::vector<float>& dst,
+		const uint32_t width, const uint32_t height, const uint32_t channels, const bool x_dir)
+	{
+		dst.assign(src.size(), 0.f);
+		if (!width || !height)
+			return;
+
+		const auto length = static_cast<int>(x_dir ? width : height);
+		const auto mirror = [length](int i)
+		{
+			const auto period = length * 2;
+			i %= period;
+			if (i < 0)
+				i += period;
+			return i < length ? i : period - 1 - i;
+		};
+
+		for (auto y = 0u; y < height; ++y)
+		{
+			for (auto x = 0u; x < width; ++x)
+			{
+				const auto pos = static_cast<int>(x_dir ? x : y);
+				const auto texel = [&](const int i, const uint32_t c)
+				{
+					const auto p = static_cast<uint32_t>(mirror(i));
+					return x_dir ? src[(y * width + p) * channels + c] : src[(p * width + x) * channels + c];
+				};
+				const auto sample = [&](const float at, const uint32_t c)
+				{
+					const auto base = static_cast<int>(std::floor(at));
+					const auto frac = at - static_cast<float>(base);
+					return texel(base, c) * (1.f - frac) + texel(base + 1, c) * frac;
+				};
+
+				for (auto c = 0u; c < channels; ++c)
+				{
+					auto col = texel(pos, c) * kernel.weights[0];
+					for (auto i = 1u; i < kernel.taps; ++i)
+					{
+						col += sample(static_cast<float>(pos) + kernel.offsets[i], c) * kernel.weights[i];
+						col += sample(static_cast<float>(pos) - kernel.offsets[i], c) * kernel.weights[i];
+					}
+					dst[(y * width + x) * channels + c] = col;
+				}
+			}
+		}
+	}
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <cstddef>
+
+namespace util::draw
+{
+	// math::PI<double>, spelled out so this header doesn't need math.h
+	constexpr auto circle_points_pi = static_cast<double>(3.14159265358979323846L);
+
+	// taylor series, only ever evaluated on [0, pi/4] so a few terms are plenty for float precision.
+	// Rounded to float they match std::sin/std::cos on every table point, tests/circle_points_test.cpp checks that
+	constexpr double const_sin(const double x)
+	{
+		auto term = x;
+		auto sum = x;
+		for (auto i = 1; i < 10; ++i)
+		{
+			term *= -x * x / ((2 * i) * (2 * i + 1));
+			sum += term;
+		}
+		return sum;
+	}
+
+	constexpr double const_cos(const double x)
+	{
+		auto term = 1.0;
+		auto sum = 1.0;
+		for (auto i = 1; i < 10; ++i)
+		{
+			term *= -x * x / ((2 * i - 1) * (2 * i));
+			sum += term;
+		}
+		return sum;
+	}
+
+	// Unit circle starting at 90 degrees. One octant is computed and mirrored into the other seven, every octant
+	// includes both of its end points. Point needs a constexpr Point{ x, y }
+	template<typename Point, size_t POINT_COUNT>
+	constexpr std::array<Point, POINT_COUNT * 8 + 8> make_circle_points()
+	{
+		std::array<Point, POINT_COUNT + 1> octant_buf{};
+		const auto step = (circle_points_pi * 0.25) / POINT_COUNT;
+		for (auto i = 0u; i <= POINT_COUNT; ++i)
+			octant_buf[i] = Point{ static_cast<float>(const_cos(step * i)), static_cast<float>(const_sin(step * i)) };
+
+		std::array<Point, POINT_COUNT * 8 + 8> points{};
+		// shift everything by two octants so the table starts at 90 degrees
+		constexpr auto shift = POINT_COUNT * 2 + 2;
+		for (auto i = 0u; i < 8; ++i)
+		{
+			const auto swap_xy = (i == 1 || i == 2 || i == 5 || i == 6);
+			const auto x_mult = (i >= 2 && i <= 5) ? -1.f : 1.f;
+			const auto y_mult = (i >= 4) ? -1.f : 1.f;
+			const auto reverse = i % 2 == 1;
+
+			for (auto j = 0u; j <= POINT_COUNT; ++j)
+			{
+				const auto& src_pos = octant_buf[reverse ? POINT_COUNT - j : j];
+				const auto dst_idx = (j + i * (POINT_COUNT + 1) + shift) % points.size();
+				points[dst_idx] = Point{
+					(swap_xy ? src_pos.y : src_pos.x) * x_mult,
+					(swap_xy ? src_pos.x : src_pos.y) * y_mult
+				};
+			}
+		}
+		return points;
+	}
+}
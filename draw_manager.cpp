@@ -2,19 +2,53 @@
 #include <freetype/freetype.h>
 #include <freetype/ftglyph.h>
 
+#include "circle_points.hpp"
 #include "draw_manager.hpp"
 
 using namespace util::draw;
 
+#pragma region circle_points
+
 namespace
 {
 	constexpr auto CIRCLE_POINT_COUNT = 64;
 
-	bool circle_points_initialized = false;
-	std::array<position, CIRCLE_POINT_COUNT * 8 + 8> circle_points;
-	void init_circle_points();
+	static_assert(circle_points_pi == math::PI<double>);
+
+	constexpr auto circle_points = make_circle_points<position, CIRCLE_POINT_COUNT>();
+	constexpr auto circle_points_32 = make_circle_points<position, 32>();
+	constexpr auto circle_points_16 = make_circle_points<position, 16>();
+	constexpr auto circle_points_8 = make_circle_points<position, 8>();
+
+	struct circle_lod
+	{
+		const position* points;
+		size_t size;
+	};
+
+	// sorted from coarse to fine
+	constexpr circle_lod circle_lods[] = {
+		{ circle_points_8.data(), circle_points_8.size() },
+		{ circle_points_16.data(), circle_points_16.size() },
+		{ circle_points_32.data(), circle_points_32.size() },
+		{ circle_points.data(), circle_points.size() }
+	};
+
+	// smallest table that keeps the segments at roughly 2px or less
+	const circle_lod& circle_lod_for_radius(const pos_type radius)
+	{
+		const auto wanted_per_octant = radius * math::PI<float> / 8.f;
+		for (const auto& lod : circle_lods)
+		{
+			if (static_cast<float>(lod.size / 8 - 1) >= wanted_per_octant)
+				return lod;
+		}
+		return circle_lods[std::size(circle_lods) - 1];
+	}
 }
 
+#pragma endregion
+
 #pragma region util
 
 static inline float inv_length(const position& lhs, const float fail_value)
@@ -25,6 +59,134 @@ static inline float inv_length(const position& lhs, const float fail_value)
 	return fail_value;
 }
 
+static inline float smooth_step(const float edge0, const float edge1, const float x)
+{
+	const auto t = std::clamp((x - edge0) / (edge1 - edge0), 0.f, 1.f);
+	return t * t * (3.f - 2.f * t);
+}
+
+// IM_FIXNORMAL2F
+static inline position fix_normal(position n)
+{
+	auto len_sqr = n.length_sqr();
+	if (len_sqr < 0.5f)
+		len_sqr = 0.5f;
+	n *= (1.f / len_sqr);
+	return n;
+}
+
+#pragma endregion
+
+#pragma region sdf
+
+namespace
+{
+	struct sdf_color
+	{
+		float r, g, b, a;
+	};
+
+	sdf_color sdf_over(const sdf_color& src, const sdf_color& dst)
+	{
+		const auto a = src.a + dst.a * (1.f - src.a);
+		if (a <= 0.f)
+			return { 0.f, 0.f, 0.f, 0.f };
+		const auto dst_w = dst.a * (1.f - src.a);
+		return { (src.r * src.a + dst.r * dst_w) / a, (src.g * src.a + dst.g * dst_w) / a, (src.b * src.a + dst.b * dst_w) / a, a };
+	}
+
+	sdf_color sdf_layer(const color col, const float coverage)
+	{
+		return { col.r() / 255.f, col.g() / 255.f, col.b() / 255.f, col.a() / 255.f * coverage };
+	}
+}
+
+// Mirrors pixel/sdf.hlsl, glow below outline below the fill
+color util::draw::sdf_shade(const float dist, const float smoothing, const color fill, const sdf_style& style)
+{
+	const auto w           = std::max(smoothing, 1.f / 255.f);
+	const auto outline_col = style.outline_width > 0.f ? style.outline_color : color{ 0, 0, 0, 0 };
+	const auto glow_col    = style.glow_width > 0.f ? style.glow_color : color{ 0, 0, 0, 0 };
+	const auto outline_e   = style.outline_edge();
+
+	auto out = sdf_layer(glow_col, smooth_step(style.glow_edge(), 0.5f, dist));
+	out      = sdf_over(sdf_layer(outline_col, smooth_step(outline_e - w, outline_e + w, dist)), out);
+	out      = sdf_over(sdf_layer(fill, smooth_step(0.5f - w, 0.5f + w, dist)), out);
+
+	const auto to_u8 = [](const float v)
+	{
+		return static_cast<int>(std::clamp(v, 0.f, 1.f) * 255.f + 0.5f);
+	};
+	return color{ to_u8(out.r), to_u8(out.g), to_u8(out.b), to_u8(out.a) };
+}
+
+#pragma endregion
+
+#pragma region cpu_clip
+
+namespace
+{
+	// Inside if the distance to the plane is >= 0
+	struct clip_plane
+	{
+		position point;
+		position normal;
+
+		float distance(const position& p) const
+		{
+			return (p.x - point.x) * normal.x + (p.y - point.y) * normal.y;
+		}
+	};
+
+	using clip_vertex = draw_buffer::draw_vertex;
+
+	inline uint8_t lerp_channel(const uint8_t a, const uint8_t b, const float t)
+	{
+		return static_cast<uint8_t>(static_cast<float>(a) + (static_cast<float>(b) - static_cast<float>(a)) * t + 0.5f);
+	}
+
+	inline clip_vertex lerp_vertex(const clip_vertex& a, const clip_vertex& b, const float t)
+	{
+		return {
+			a.pos + (b.pos - a.pos) * t,
+			a.uv + (b.uv - a.uv) * t,
+			pack_color{
+				lerp_channel(a.col._r, b.col._r, t),
+				lerp_channel(a.col._g, b.col._g, t),
+				lerp_channel(a.col._b, b.col._b, t),
+				lerp_channel(a.col._a, b.col._a, t)
+			}
+		};
+	}
+
+	// One Sutherland-Hodgman step, pos/uv/color get interpolated so textured geometry stays correct
+	void clip_polygon(const std::vector<clip_vertex>& in, std::vector<clip_vertex>& out, const clip_plane& plane)
+	{
+		out.clear();
+		if (in.empty())
+			return;
+
+		auto prev = &in.back();
+		auto prev_dist = plane.distance(prev->pos);
+		for (const auto& cur : in)
+		{
+			const auto cur_dist = plane.distance(cur.pos);
+			if ((cur_dist >= 0.f) != (prev_dist >= 0.f))
+				out.emplace_back(lerp_vertex(*prev, cur, prev_dist / (prev_dist - cur_dist)));
+			if (cur_dist >= 0.f)
+				out.emplace_back(cur);
+
+			prev = &cur;
+			prev_dist = cur_dist;
+		}
+	}
+
+	uint8_t rect_outcode(const rect& r, const position& p)
+	{
+		return static_cast<uint8_t>((p.x < r.x) | ((p.x > r.z) << 1) | ((p.y < r.y) << 2) | ((p.y > r.w) << 3));
+	}
+}
+
 #pragma endregion
 
 #pragma region draw_buffer
@@ -62,42 +224,60 @@ rect draw_buffer::clip_rect_to_cur_rect(const rect& clip)
 	return new_clip;
 }
 
+void draw_buffer::apply_cmd_state(draw_cmd& cmd, const bool force_font, const bool native_texture)
+{
+	// with cpu clipping the scissor just covers the screen, the geometry is already clipped
+	const auto circle = !cpu_clipping && !clip_rect_stack.empty() && clip_rect_stack.back().second;
+	cmd.clip_rect = cpu_clipping ? rect{ position{0.f, 0.f}, manager->get_screen_size() } : cur_clip_rect();
+	cmd.set_flag(CMD_CIRCLE_SCISSOR, circle);
+	if (circle)
+		cmd_ext_mut(cmd).circle_outer_clip = cur_non_circle_clip_rect();
+	cmd.tex_id = cur_tex_id();
+	cmd.set_flag(CMD_FONT_TEXTURE,
+		(cmd.tex_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr) || force_font);
+	cmd.set_flag(CMD_NATIVE_TEXTURE, native_texture);
+	cmd.set_flag(CMD_SDF_TEXT, cmd.font_texture() && cur_font != nullptr && cur_font->sdf());
+	if (cmd.sdf_text() && cur_sdf_style.active())
+		cmd_ext_mut(cmd).sdf = cur_sdf_style;
+}
+
+draw_buffer::draw_cmd& draw_buffer::new_cmd(const bool force_font, const bool native_texture, const bool inherit_key)
+{
+	// pending geometry has to be clipped while it still belongs to the last command
+	flush_clip();
+	cmd_translate = {};
+
+	draw_cmd cmd = {};
+	apply_cmd_state(cmd, force_font, native_texture);
+	if (inherit_key && !cmds.empty())
+	{
+		const auto key_color = cmd_ext(cmds.back()).key_color;
+		if (key_color.a() != 0)
+			cmd_ext_mut(cmd).key_color = key_color;
+	}
+
+	return cmds.emplace_back(cmd);
+}
+
 void draw_buffer::update_clip_rect()
 {
+	if (cpu_clipping && !cmds.empty())
+		return;
+
 	if (!cmds.empty() && !clip_rect_stack.empty()
 		&& cur_clip_rect() == cmds.back().clip_rect.float_rect()
-		&& clip_rect_stack.back().second == cmds.back().circle_scissor)
+		&& clip_rect_stack.back().second == cmds.back().circle_scissor())
 		return;
 
-	if (!cmds.empty())
+	const auto native_texture = !cmds.empty() && cmds.back().native_texture();
+	if (!cmds.empty() && !cmds.back().elem_count)
 	{
-		auto& cur_cmd = cmds.back();
-		if (!cur_cmd.elem_count)
-		{
-			cur_cmd.clip_rect = cur_clip_rect();
-			cur_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-			if (cur_cmd.circle_scissor)
-				cur_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-			cur_cmd.tex_id = cur_tex_id();
-			cur_cmd.font_texture = (cur_cmd.tex_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr);
-			cur_cmd.native_texture = !cmds.empty() && cmds.back().native_texture;
-			return;
-		}
+		apply_cmd_state(cmds.back(), false, native_texture);
+		merge_empty_cmd();
+		return;
 	}
-	//Allocate new command
-	draw_cmd new_cmd = {};
-	new_cmd.clip_rect = cur_clip_rect();
-	new_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-	if (new_cmd.circle_scissor)
-		new_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-	new_cmd.elem_count = 0;
-	new_cmd.tex_id = cur_tex_id();
-	new_cmd.font_texture = (new_cmd.tex_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr);
-	new_cmd.native_texture = !cmds.empty() && cmds.back().native_texture;
-	if (!cmds.empty())
-		new_cmd.key_color = cmds.back().key_color;
 
-	cmds.emplace_back(new_cmd);
+	new_cmd(false, native_texture);
 }
 
 void draw_buffer::push_font(font* font)
@@ -110,146 +290,308 @@ void draw_buffer::push_font(font* font)
 void draw_buffer::pop_font()
 {
 	assert(!font_stack.empty());
-	pop_tex_id();
+	// cur_font has to be up to date before the tex id changes, it decides whether the cmd is sdf text
 	font_stack.pop_back();
-	if (!font_stack.empty())
-	{
-		cur_font = font_stack.back();
+	cur_font = font_stack.empty() ? nullptr : font_stack.back();
+	pop_tex_id();
+	if (cur_font != nullptr)
 		push_tex_id(cur_font->container_atlas->tex_id);
-		return;
-	}
-	cur_font = nullptr;
 }
 
 void draw_buffer::update_tex_id(const bool force_font, const bool native_texture)
 {
-	const auto cur_id = cur_tex_id();
-	if (!cmds.empty() && !tex_id_stack.empty() && cur_id == cmds.back().tex_id
-		&& !force_font && !native_texture)
+	const auto sdf = cur_font != nullptr && cur_font->sdf() && cur_tex_id() == manager->fonts->tex_id;
+	if (!cmds.empty() && !tex_id_stack.empty() && cur_tex_id() == cmds.back().tex_id
+		&& cmds.back().sdf_text() == sdf && !force_font && !native_texture)
 		return;
 
-	if (!cmds.empty())
+	if (!cmds.empty() && !cmds.back().elem_count)
 	{
-		auto& cur_cmd = cmds.back();
-		if (!cur_cmd.elem_count)
-		{
-			cur_cmd.clip_rect = cur_clip_rect();
-			cur_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-			if (cur_cmd.circle_scissor)
-				cur_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-			cur_cmd.tex_id = cur_tex_id();
-			cur_cmd.font_texture = (cur_cmd.tex_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr) || force_font;
-			cur_cmd.native_texture = native_texture;
-			return;
-		}
+		apply_cmd_state(cmds.back(), force_font, native_texture);
+		merge_empty_cmd();
+		return;
 	}
 
-	//Allocate new cmd
-	draw_cmd new_cmd = {};
-	new_cmd.clip_rect = cur_clip_rect();
-	new_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-	if (new_cmd.circle_scissor)
-		new_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-	new_cmd.elem_count = 0;
-	new_cmd.tex_id = cur_id;
-	new_cmd.font_texture =
-		(cur_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr)
-		|| force_font;
-	new_cmd.native_texture = native_texture;
-
-	if (!cmds.empty())
-		new_cmd.key_color = cmds.back().key_color;
-
-	cmds.emplace_back(new_cmd);
+	new_cmd(force_font, native_texture);
 }
 
-size_t draw_buffer::force_new_cmd()
+void draw_buffer::merge_empty_cmd()
 {
-	if (!cmds.empty() && cmds.back().elem_count == 0u)
-		return (cmds.size() - 1);
+	// e.g. push_tex_id(a), draw, pop_tex_id(), push_tex_id(a) would otherwise leave two commands with the same state
+	if (cmds.size() < 2 || cmds.size() <= pinned_cmd_count)
+		return;
 
-	// Allocate a new command
-	draw_cmd new_cmd = {};
-	new_cmd.clip_rect = cur_clip_rect();
-	new_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-	if (new_cmd.circle_scissor)
-		new_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-	new_cmd.elem_count = 0;
-	new_cmd.tex_id = cur_tex_id();
-	new_cmd.font_texture = (new_cmd.tex_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr);
-	new_cmd.native_texture = !cmds.empty() && cmds.back().native_texture;
+	const auto& last = cmds.back();
+	const auto& prev = cmds[cmds.size() - 2];
+	if (last.elem_count || last.ext_idx != draw_cmd::no_ext || prev.ext_idx != draw_cmd::no_ext
+		|| last.tex_id != prev.tex_id || last.flags != prev.flags || last.clip_rect != prev.clip_rect)
+		return;
 
-	if (!cmds.empty())
-		new_cmd.key_color = cmds.back().key_color;
+	cmds.pop_back();
+}
 
-	const auto new_idx = cmds.size();
-	cmds.emplace_back(new_cmd);
+size_t draw_buffer::force_new_cmd()
+{
+	if (cmds.empty() || cmds.back().elem_count != 0u)
+		new_cmd(false, !cmds.empty() && cmds.back().native_texture());
 
-	return new_idx;
+	// the caller may pass the index to update_matrix_translate later
+	pinned_cmd_count = cmds.size();
+	return cmds.size() - 1;
 }
 
 void draw_buffer::update_matrix_translate(const position& xy_translate, const size_t cmd_idx)
 {
+	if (cmd_idx != -1 && cmds.size() <= cmd_idx)
+		return;
+
+	// everything written so far has to be in its final place before it gets moved
+	flush_clip();
+
+	const auto translate = affine_transform::translate(xy_translate);
 	if (cmd_idx != -1)
 	{
-		if (cmds.size() <= cmd_idx)
-			return;
+		size_t vtx_start = 0;
+		for (size_t i = 0; i < cmd_idx; ++i)
+			vtx_start += cmds[i].vtx_count;
 
-		auto& cmd = cmds[cmd_idx];
-		cmd.matrix[0][3] += xy_translate.x;
-		cmd.matrix[1][3] += xy_translate.y;
-		return;
+		transform_vertices(vertices.data() + vtx_start, cmds[cmd_idx].vtx_count, translate);
+	}
+	else
+		transform_vertices(vertices.data(), vertices.size(), translate);
+
+	// like the old per cmd matrix the last cmd keeps the translation for what gets drawn into it later
+	if (cmd_idx == -1 || cmd_idx == cmds.size() - 1)
+	{
+		cmd_translate.x += xy_translate.x;
+		cmd_translate.y += xy_translate.y;
 	}
+}
+
+void draw_buffer::flush_cmd_translate()
+{
+	const auto vtx_end = vertices.size();
+	if ((cmd_translate.x != 0.f || cmd_translate.y != 0.f) && vtx_end > cmd_translate_vtx_start)
+		transform_vertices(vertices.data() + cmd_translate_vtx_start, vtx_end - cmd_translate_vtx_start,
+			affine_transform::translate(cmd_translate));
+
+	cmd_translate_vtx_start = vtx_end;
+}
 
-	if (cmds.empty())
+void draw_buffer::push_transform(const affine_transform& transform)
+{
+	flush_transform();
+	transform_stack.emplace_back(transform_stack.empty() ? transform : transform_stack.back() * transform);
+}
+
+void draw_buffer::pop_transform()
+{
+	assert(!transform_stack.empty());
+	flush_transform();
+	transform_stack.pop_back();
+}
+
+void draw_buffer::flush_transform()
+{
+	const auto vtx_end = vertices.size();
+	if (!transform_stack.empty() && vtx_end > transform_vtx_start)
+		transform_vertices(vertices.data() + transform_vtx_start, vtx_end - transform_vtx_start, transform_stack.back());
+
+	transform_vtx_start = vtx_end;
+}
+
+void draw_buffer::set_cpu_clipping(const bool enabled)
+{
+	if (cpu_clipping == enabled)
 		return;
 
-	for (auto& cmd : cmds)
+	flush_clip();
+	cpu_clipping = enabled;
+
+	const auto font_texture = !cmds.empty() && cmds.back().font_texture();
+	const auto native_texture = !cmds.empty() && cmds.back().native_texture();
+	if (!cmds.empty() && !cmds.back().elem_count)
 	{
-		cmd.matrix[0][3] += xy_translate.x;
-		cmd.matrix[1][3] += xy_translate.y;
+		apply_cmd_state(cmds.back(), font_texture, native_texture);
+		return;
 	}
+
+	new_cmd(font_texture, native_texture);
 }
 
-void draw_buffer::set_blur(const uint8_t strength, const uint8_t passes)
+void draw_buffer::flush_clip()
+{
+	flush_transform();
+	flush_cmd_translate();
+	if (cpu_clipping && !clip_rect_stack.empty() && indices.size() > clip_idx_start)
+		clip_triangles(clip_idx_start);
+
+	// vertexes added by the clipper are already transformed
+	clip_idx_start = indices.size();
+	transform_vtx_start = vertices.size();
+	cmd_translate_vtx_start = vertices.size();
+}
+
+void draw_buffer::clip_triangles(const size_t idx_start)
 {
-	if (!cmds.empty() && cmds.back().blur_strength == strength && cmds.back().blur_pass_count == passes)
+	assert(!cmds.empty() && !clip_rect_stack.empty());
+
+	// circles are clipped against their polygon approximation inside the outer rect, like the scissor path does
+	const auto clip = clip_rect_stack.back().first;
+	const auto circle = clip_rect_stack.back().second;
+	const auto bounds = circle ? cur_non_circle_clip_rect() : clip;
+	const auto center = position{ (clip.x + clip.z) * 0.5f, (clip.y + clip.w) * 0.5f };
+	const auto radius = (clip.z - clip.x) * 0.5f;
+
+	std::vector<clip_plane> planes = {
+		{ bounds.xy, { 1.f, 0.f } },
+		{ bounds.xy, { 0.f, 1.f } },
+		{ bounds.zw, { -1.f, 0.f } },
+		{ bounds.zw, { 0.f, -1.f } }
+	};
+	if (circle)
+	{
+		const auto& lod = circle_lod_for_radius(radius);
+		planes.reserve(planes.size() + lod.size);
+		for (size_t i = 0; i < lod.size; ++i)
+		{
+			const auto p1 = lod.points[i] * radius + center;
+			const auto p2 = lod.points[(i + 1) % lod.size] * radius + center;
+			const auto mid = (p1 + p2) * 0.5f;
+			planes.push_back({ p1, (center - mid).normalized() });
+		}
+	}
+
+	const auto inside = [&](const position& p)
+	{
+		if (rect_outcode(bounds, p))
+			return false;
+		return !circle || (p - center).length_sqr() <= radius * radius;
+	};
+
+	const auto idx_end = indices.size();
+	const auto vtx_old_size = vertices.size();
+	std::vector<draw_index> clipped_indices = {};
+	std::vector<clip_vertex> poly = {}, poly_tmp = {};
+	auto idx_write = idx_start;
+	for (auto i = idx_start; i + 2 < idx_end; i += 3)
+	{
+		const draw_index tri[3] = { indices[i], indices[i + 1], indices[i + 2] };
+		const auto& v0 = vertices[tri[0]];
+		const auto& v1 = vertices[tri[1]];
+		const auto& v2 = vertices[tri[2]];
+
+		if (inside(v0.pos) && inside(v1.pos) && inside(v2.pos))
+		{
+			indices[idx_write++] = tri[0];
+			indices[idx_write++] = tri[1];
+			indices[idx_write++] = tri[2];
+			continue;
+		}
+
+		if (rect_outcode(bounds, v0.pos) & rect_outcode(bounds, v1.pos) & rect_outcode(bounds, v2.pos))
+			continue;
+
+		poly.assign({ v0, v1, v2 });
+		for (const auto& plane : planes)
+		{
+			clip_polygon(poly, poly_tmp, plane);
+			poly.swap(poly_tmp);
+			if (poly.size() < 3)
+				break;
+		}
+		if (poly.size() < 3)
+			continue;
+
+		const auto base = static_cast<draw_index>(vertices.size());
+		vertices.insert(vertices.end(), poly.begin(), poly.end());
+		for (draw_index j = 1; j + 1 < poly.size(); ++j)
+		{
+			clipped_indices.push_back(base);
+			clipped_indices.push_back(base + j);
+			clipped_indices.push_back(base + j + 1);
+		}
+	}
+
+	indices.resize(idx_write);
+	indices.insert(indices.end(), clipped_indices.begin(), clipped_indices.end());
+
+	auto& cmd = cmds.back();
+	cmd.elem_count = cmd.elem_count + static_cast<std::uint32_t>(indices.size()) - static_cast<std::uint32_t>(idx_end);
+	cmd.vtx_count += static_cast<std::uint32_t>(vertices.size() - vtx_old_size);
+	cur_idx = static_cast<draw_index>(vertices.size());
+	vtx_write_ptr = vertices.data() + vertices.size();
+	idx_write_ptr = indices.data() + indices.size();
+}
+
+void draw_buffer::transform_vertices(draw_vertex* vtx, const size_t count, const affine_transform& transform)
+{
+	// plain loops over the positions only, the translation case is by far the most common one
+	if (transform.translation_only())
+	{
+		const auto t = transform.translation;
+		for (size_t i = 0; i < count; ++i)
+		{
+			vtx[i].pos.x += t.x;
+			vtx[i].pos.y += t.y;
+		}
 		return;
+	}
+
+	const auto m00 = transform.m00, m01 = transform.m01, m10 = transform.m10, m11 = transform.m11;
+	const auto t = transform.translation;
+	for (size_t i = 0; i < count; ++i)
+	{
+		const auto p = vtx[i].pos;
+		vtx[i].pos.x = m00 * p.x + m01 * p.y + t.x;
+		vtx[i].pos.y = m10 * p.x + m11 * p.y + t.y;
+	}
+}
 
-	//Allocate new command
-	draw_cmd new_cmd = {};
-	new_cmd.clip_rect = cur_clip_rect();
-	new_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-	if (new_cmd.circle_scissor)
-		new_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-	new_cmd.elem_count = 0;
-	new_cmd.tex_id = cur_tex_id();
-	new_cmd.font_texture = (new_cmd.tex_id == manager->fonts->tex_id && manager->fonts->tex_id != nullptr);
-	new_cmd.blur_strength = strength;
-	new_cmd.blur_pass_count = passes;
-	new_cmd.native_texture = !cmds.empty() && cmds.back().native_texture;
+void draw_buffer::set_blur(const uint8_t strength, const uint8_t passes)
+{
 	if (!cmds.empty())
-		new_cmd.key_color = cmds.back().key_color;
+	{
+		const auto& ext = cmd_ext(cmds.back());
+		if (ext.blur_strength == strength && ext.blur_pass_count == passes)
+			return;
+	}
+
+	auto& cmd = new_cmd(false, !cmds.empty() && cmds.back().native_texture());
+	if (!strength)
+		return;
 
-	cmds.emplace_back(new_cmd);
+	auto& ext = cmd_ext_mut(cmd);
+	ext.blur_strength = strength;
+	ext.blur_pass_count = passes;
 }
 
 void draw_buffer::set_key_color(const color col)
 {
-	//Allocate new command
-	draw_cmd new_cmd = {};
-	new_cmd.clip_rect = cur_clip_rect();
-	new_cmd.circle_scissor = clip_rect_stack.empty() ? false : clip_rect_stack.back().second;
-	if (new_cmd.circle_scissor)
-		new_cmd.circle_outer_clip = cur_non_circle_clip_rect();
-	new_cmd.elem_count = 0;
-	new_cmd.tex_id = cur_tex_id();
-	new_cmd.font_texture = (new_cmd.tex_id == manager->fonts->tex_id
-		&& manager->fonts->tex_id != nullptr);
-	new_cmd.key_color = col;
-	new_cmd.native_texture = !cmds.empty() && cmds.back().native_texture;
+	auto& cmd = new_cmd(false, !cmds.empty() && cmds.back().native_texture(), false);
+	if (col.a() != 0)
+		cmd_ext_mut(cmd).key_color = col;
+}
 
-	cmds.emplace_back(new_cmd);
+void draw_buffer::set_sdf_style(const sdf_style& style)
+{
+	cur_sdf_style = style;
+	if (cmds.empty() || !cmds.back().sdf_text())
+		return;
+
+	auto& cmd = cmds.back().elem_count ? new_cmd(false, cmds.back().native_texture()) : cmds.back();
+	if (cur_sdf_style.active())
+		cmd_ext_mut(cmd).sdf = cur_sdf_style;
+	else if (cmd.ext_idx != draw_cmd::no_ext)
+		cmd_exts[cmd.ext_idx].sdf = {};
+}
+
+void draw_buffer::set_callback(draw_callback cb, std::shared_ptr<callback_data> data)
+{
+	auto& cmd = new_cmd(false, !cmds.empty() && cmds.back().native_texture());
+	auto& ext = cmd_ext_mut(cmd);
+	ext.callback = std::move(cb);
+	ext.callback_data = std::move(data);
 }
 
 void draw_buffer::triangle_filled(const position& p1,
@@ -315,7 +657,7 @@ void draw_buffer::rectangle(const position& top_left_pre,
 	clear_path();
 }
 
-static inline void generate_circle_metadata(size_t& start_idx, size_t& point_count, size_t& skip_count, const pos_type radius, pos_type degrees, pos_type start_degree)
+static inline void generate_circle_metadata(size_t& start_idx, size_t& point_count, const circle_lod& lod, pos_type degrees, pos_type start_degree)
 {
 	degrees = std::fabs(degrees);
 	start_degree = std::fabs(start_degree);
@@ -324,29 +666,21 @@ static inline void generate_circle_metadata(size_t& start_idx, size_t& point_cou
 	while (start_degree > 360.f)
 		start_degree -= 360.f;
 
-	point_count = std::clamp(static_cast<size_t>(degrees * (1 / 360.f) * circle_points.size()) + 1, static_cast<size_t>(0u), circle_points.size());
+	point_count = std::clamp(static_cast<size_t>(degrees * (1 / 360.f) * lod.size) + 1, static_cast<size_t>(0u), lod.size);
 	// TODO: how do we properly calculate the index here?
-	start_idx = std::clamp(static_cast<size_t>((start_degree * (1 / 360.f)) * circle_points.size()), static_cast<size_t>(0u), circle_points.size() - 1);
-#if 0
-	// r = 1 -> 4 points so skip_count = CIRCLE_POINTS_COUNT, r = 100 -> all points so skip_count = 0
-	skip_count = std::clamp(CIRCLE_POINT_COUNT - static_cast<int>((radius - 1.f) * (CIRCLE_POINT_COUNT / 100.f) * 2.5f), 0, CIRCLE_POINT_COUNT);
-	if (skip_count > 0)
-		point_count /= skip_count;
-#else
-	skip_count = 0;
-#endif
+	start_idx = std::clamp(static_cast<size_t>((start_degree * (1 / 360.f)) * lod.size), static_cast<size_t>(0u), lod.size - 1);
 }
 
-static inline void generate_circle_points(position* point_buf, const size_t start_idx, const size_t point_count, const size_t skip_count, const pos_type radius, const position& center)
+static inline void generate_circle_points(position* point_buf, const size_t start_idx, const size_t point_count, const circle_lod& lod, const pos_type radius, const position& center)
 {
-	auto cur_idx = std::clamp(start_idx, static_cast<size_t>(0u), circle_points.size());
+	auto cur_idx = std::clamp(start_idx, static_cast<size_t>(0u), lod.size);
 	for (auto i = 0u; i < point_count; ++i)
 	{
-		if (cur_idx >= circle_points.size())
-			cur_idx -= circle_points.size();
+		if (cur_idx >= lod.size)
+			cur_idx -= lod.size;
 
-		point_buf[i] = circle_points[cur_idx] * radius + center;
-		cur_idx += 1 + skip_count;
+		point_buf[i] = lod.points[cur_idx] * radius + center;
+		cur_idx++;
 	}
 }
 
@@ -359,10 +693,11 @@ void draw_buffer::circle_filled(const position& center,
 	pos_type start_degree,
 	bool anti_aliasing)
 {
-	size_t start_idx, point_count, skip_count;
-	generate_circle_metadata(start_idx, point_count, skip_count, radius, degrees, start_degree);
+	const auto& lod = circle_lod_for_radius(radius);
+	size_t start_idx, point_count;
+	generate_circle_metadata(start_idx, point_count, lod, degrees, start_degree);
 	const auto points = reinterpret_cast<position*>(_alloca(sizeof(position) * point_count));
-	generate_circle_points(points, start_idx, point_count, skip_count, radius, center);
+	generate_circle_points(points, start_idx, point_count, lod, radius, center);
 	//poly_fill(points, point_count, outer_col);
 	fill_circle_impl(center, points, point_count, inner_col, outer_col);
 
@@ -380,10 +715,11 @@ void draw_buffer::circle(const position& center,
 	pos_type degrees,
 	pos_type start_degree, const bool anti_aliasing)
 {
-	size_t start_idx, point_count, skip_count;
-	generate_circle_metadata(start_idx, point_count, skip_count, radius, degrees, start_degree);
+	const auto& lod = circle_lod_for_radius(radius);
+	size_t start_idx, point_count;
+	generate_circle_metadata(start_idx, point_count, lod, degrees, start_degree);
 	const auto points = reinterpret_cast<position*>(_alloca(sizeof(position) * point_count));
-	generate_circle_points(points, start_idx, point_count, skip_count, radius, center);
+	generate_circle_points(points, start_idx, point_count, lod, radius, center);
 
 	// when doing poly_line here we have gaps in the circle so we just do this
 	for (auto i = 0u; i < point_count - 1; ++i)
@@ -420,165 +756,88 @@ void draw_buffer::fill_circle_impl(const position& center,
 }
 
 
-//TODO: Instead of dupe code, stack alloc points_count colors and fill with col in a inlined func?
 void draw_buffer::poly_line(position* points,
 	const uint32_t points_count,
 	const pack_color col,
 	const pos_type thickness,
-	const bool anti_aliased)
+	const bool anti_aliased,
+	const bool closed)
+{
+	poly_line_dispatch(points, points_count, &col, false, thickness, anti_aliased, closed);
+}
+
+void draw_buffer::poly_line(position* points,
+	const uint32_t points_count,
+	const pack_color* cols,
+	const pos_type thickness,
+	const bool anti_aliased,
+	const bool closed)
+{
+	poly_line_dispatch(points, points_count, cols, true, thickness, anti_aliased, closed);
+}
+
+void draw_buffer::poly_line_dispatch(const position* points,
+	const uint32_t points_count,
+	const pack_color* cols,
+	const bool per_vtx_col,
+	const pos_type thickness,
+	const bool anti_aliased,
+	const bool closed)
 {
-	// from dear imgui
 	if (points_count < 2)
 		return;
 
+	using kernel_fn = void (draw_buffer::*)(const position*, uint32_t, const pack_color*, pos_type);
+	// indexed by (anti_aliased << 3) | (thick_line << 2) | (per_vtx_col << 1) | closed
+	// thickness only matters for the aa kernels, the non-aa ones always emit one quad per segment
+	static constexpr kernel_fn kernels[] = {
+		&draw_buffer::poly_line_impl<false, false, false, false>,
+		&draw_buffer::poly_line_impl<false, false, false, true>,
+		&draw_buffer::poly_line_impl<false, false, true, false>,
+		&draw_buffer::poly_line_impl<false, false, true, true>,
+		&draw_buffer::poly_line_impl<false, false, false, false>,
+		&draw_buffer::poly_line_impl<false, false, false, true>,
+		&draw_buffer::poly_line_impl<false, false, true, false>,
+		&draw_buffer::poly_line_impl<false, false, true, true>,
+		&draw_buffer::poly_line_impl<true, false, false, false>,
+		&draw_buffer::poly_line_impl<true, false, false, true>,
+		&draw_buffer::poly_line_impl<true, false, true, false>,
+		&draw_buffer::poly_line_impl<true, false, true, true>,
+		&draw_buffer::poly_line_impl<true, true, false, false>,
+		&draw_buffer::poly_line_impl<true, true, false, true>,
+		&draw_buffer::poly_line_impl<true, true, true, false>,
+		&draw_buffer::poly_line_impl<true, true, true, true>,
+	};
+
+	const auto kernel_idx = (anti_aliased ? 8u : 0u)
+		| (thickness > 1.f ? 4u : 0u)
+		| (per_vtx_col ? 2u : 0u)
+		| (closed ? 1u : 0u);
+	(this->*kernels[kernel_idx])(points, points_count, cols, thickness);
+}
+
+template<bool anti_aliased, bool thick_line, bool per_vtx_col, bool closed>
+void draw_buffer::poly_line_impl(const position* points,
+	const uint32_t points_count,
+	const pack_color* cols,
+	const pos_type thickness)
+{
+	// from dear imgui
 	constexpr auto aa_size = 1.f;
 	const auto uv = position{ 1.f, 1.f };
-	const auto thick_line = thickness > 1.f;
-	const auto col_trans = pack_color{ col.r(), col.g(), col.b(), 0 };
-	const auto count = points_count - 1;
+	const auto count = closed ? points_count : points_count - 1;
 
-	if (anti_aliased)
+	const auto col_at = [cols](const uint32_t i) -> pack_color
 	{
-		const auto idx_count = thick_line ? count * 18 : count * 12;
-		const auto vtx_count = thick_line ? points_count * 4 : points_count * 3;
-		reserve_primitives(idx_count, vtx_count);
-
-		const auto tmp_normals = reinterpret_cast<position*>(alloca(
-			points_count * (thick_line ? 5 : 3) * sizeof(position)));
-		const auto tmp_points = tmp_normals + points_count;
-
-		for (auto i = 0u; i < count; ++i)
-		{
-			const auto j = (i + 1 == points_count) ? 0 : i + 1;
-			const auto delta = (points[j] - points[i]).normalize();
-			tmp_normals[i] = { delta.y, -delta.x };
-		}
-		tmp_normals[points_count - 1] = tmp_normals[points_count - 2];
-
-		if (!thick_line)
-		{
-			tmp_points[0] = points[0] + tmp_normals[0] * aa_size;
-			tmp_points[1] = points[0] - tmp_normals[0] * aa_size;
-			tmp_points[(points_count - 1) * 2 + 0] = points[points_count - 1] + tmp_normals[points_count - 1] * aa_size;
-			tmp_points[(points_count - 1) * 2 + 1] = points[points_count - 1] - tmp_normals[points_count - 1] * aa_size;
-
-			auto idx = cur_idx;
-			for (auto i = 0u; i < count; ++i)
-			{
-				const auto j = (i + 1 == points_count) ? 0 : i + 1;
-				const auto idx2 = (i + 1 == points_count) ? cur_idx : idx + 3;
-
-				auto dm = ((tmp_normals[i] + tmp_normals[j]) * 0.5);
-				// IM_FIXNORMAL2F
-				auto len_sqr = dm.length_sqr();
-				if (len_sqr < 0.5f)
-					len_sqr = 0.5f;
-				dm *= (1.f / len_sqr);
-
-				dm *= aa_size;
-
-				const auto vtx_out = &tmp_points[j * 2];
-				vtx_out[0] = points[j] + dm;
-				vtx_out[1] = points[j] - dm;
-
-				write_idx(idx2);
-				write_idx(idx);
-				write_idx(idx + 2);
-				write_idx(idx + 2);
-				write_idx(idx2 + 2);
-				write_idx(idx2);
-				write_idx(idx2 + 1);
-				write_idx(idx + 1);
-				write_idx(idx);
-				write_idx(idx);
-				write_idx(idx2);
-				write_idx(idx2 + 1);
-
-				idx = idx2;
-			}
-
-			for (auto i = 0u; i < points_count; ++i)
-			{
-				write_vtx(points[i], uv, col);
-				write_vtx(tmp_points[i * 2], uv, col_trans);
-				write_vtx(tmp_points[i * 2 + 1], uv, col_trans);
-			}
-		}
+		if constexpr (per_vtx_col)
+			return cols[i];
 		else
-		{
-			const auto half_inner_thickness = (thickness - aa_size) * 0.5f;
-			tmp_points[0] = points[0] + tmp_normals[0] * (half_inner_thickness + aa_size);
-			tmp_points[1] = points[0] + tmp_normals[0] * (half_inner_thickness);
-			tmp_points[2] = points[0] - tmp_normals[0] * (half_inner_thickness);
-			tmp_points[3] = points[0] - tmp_normals[0] * (half_inner_thickness + aa_size);
-			tmp_points[(points_count - 1) * 4] = points[points_count - 1] + tmp_normals[points_count - 1] * (
-				half_inner_thickness + aa_size);
-			tmp_points[(points_count - 1) * 4 + 1] = points[points_count - 1] + tmp_normals[points_count - 1] * (
-				half_inner_thickness);
-			tmp_points[(points_count - 1) * 4 + 2] = points[points_count - 1] - tmp_normals[points_count - 1] * (
-				half_inner_thickness);
-			tmp_points[(points_count - 1) * 4 + 3] = points[points_count - 1] - tmp_normals[points_count - 1] * (
-				half_inner_thickness + aa_size);
-
-			auto idx = cur_idx;
-			for (auto i = 0u; i < count; ++i)
-			{
-				const auto j = (i + 1 == points_count) ? 0 : i + 1;
-				const auto idx2 = (i + 1 == points_count) ? cur_idx : idx + 4;
-
-				auto dm = (tmp_normals[i] + tmp_normals[j]) * 0.5f;
-				// IM_FIXNORMAL2F
-				auto len_sqr = dm.length_sqr();
-				if (len_sqr < 0.5f)
-					len_sqr = 0.5f;
-				dm *= (1.f / len_sqr);
-
-				const auto dm_out = dm * (half_inner_thickness + aa_size);
-				const auto dm_in = dm * half_inner_thickness;
-
-				const auto vtx_out = &tmp_points[j * 4];
-				vtx_out[0] = points[j] + dm_out;
-				vtx_out[1] = points[j] + dm_in;
-				vtx_out[2] = points[j] - dm_in;
-				vtx_out[3] = points[j] - dm_out;
-
-				write_idx(idx2 + 1);
-				write_idx(idx + 1);
-				write_idx(idx + 2);
-				write_idx(idx + 2);
-				write_idx(idx2 + 2);
-				write_idx(idx2 + 1);
-				write_idx(idx2 + 1);
-				write_idx(idx + 1);
-				write_idx(idx);
-				write_idx(idx);
-				write_idx(idx2);
-				write_idx(idx2 + 1);
-				write_idx(idx2 + 2);
-				write_idx(idx + 2);
-				write_idx(idx + 3);
-				write_idx(idx + 3);
-				write_idx(idx2 + 3);
-				write_idx(idx2 + 2);
-
-				idx = idx2;
-			}
+			return cols[0];
+	};
 
-			for (auto i = 0u; i < points_count; ++i)
-			{
-				write_vtx(tmp_points[i * 4], uv, col_trans);
-				write_vtx(tmp_points[i * 4 + 1], uv, col);
-				write_vtx(tmp_points[i * 4 + 2], uv, col);
-				write_vtx(tmp_points[i * 4 + 3], uv, col_trans);
-			}
-		}
-		cur_idx += vtx_count;
-	}
-	else
+	if constexpr (!anti_aliased)
 	{
-		const auto idx_count = count * 6;
-		const auto vtx_count = count * 4;
-		reserve_primitives(idx_count, vtx_count);
+		reserve_primitives(count * 6, count * 4);
 
 		for (auto i = 0u; i < count; ++i)
 		{
@@ -591,6 +850,7 @@ void draw_buffer::poly_line(position* points,
 			std::swap(d.x, d.y);
 			d.x = -d.x;
 
+			const auto col = col_at(i);
 			write_vtx(p1 + d, uv, col);
 			write_vtx(p2 + d, uv, col);
 			write_vtx(p2 - d, uv, col);
@@ -606,28 +866,11 @@ void draw_buffer::poly_line(position* points,
 			cur_idx += 4;
 		}
 	}
-}
-
-void draw_buffer::poly_line(position* points,
-	const uint32_t points_count,
-	const pack_color* cols,
-	const pos_type thickness,
-	const bool anti_aliased)
-{
-	// from dear imgui
-	if (points_count < 2)
-		return;
-
-	constexpr auto aa_size = 1.f;
-	const auto uv = position{ 1.f, 1.f };
-	const auto thick_line = thickness > 1.f;
-	//const auto col_trans = pack_color{ col.r(), col.g(), col.b(), 0 };
-	const auto count = points_count - 1;
-
-	if (anti_aliased)
+	else
 	{
-		const auto idx_count = thick_line ? count * 18 : count * 12;
-		const auto vtx_count = thick_line ? points_count * 4 : points_count * 3;
+		constexpr auto vtx_per_point = thick_line ? 4u : 3u;
+		const auto idx_count = count * (thick_line ? 18 : 12);
+		const auto vtx_count = points_count * vtx_per_point;
 		reserve_primitives(idx_count, vtx_count);
 
 		const auto tmp_normals = reinterpret_cast<position*>(alloca(
@@ -640,14 +883,18 @@ void draw_buffer::poly_line(position* points,
 			const auto delta = (points[j] - points[i]).normalize();
 			tmp_normals[i] = { delta.y, -delta.x };
 		}
-		tmp_normals[points_count - 1] = tmp_normals[points_count - 2];
+		if constexpr (!closed)
+			tmp_normals[points_count - 1] = tmp_normals[points_count - 2];
 
-		if (!thick_line)
+		if constexpr (!thick_line)
 		{
-			tmp_points[0] = points[0] + tmp_normals[0] * aa_size;
-			tmp_points[1] = points[0] - tmp_normals[0] * aa_size;
-			tmp_points[(points_count - 1) * 2 + 0] = points[points_count - 1] + tmp_normals[points_count - 1] * aa_size;
-			tmp_points[(points_count - 1) * 2 + 1] = points[points_count - 1] - tmp_normals[points_count - 1] * aa_size;
+			if constexpr (!closed)
+			{
+				tmp_points[0] = points[0] + tmp_normals[0] * aa_size;
+				tmp_points[1] = points[0] - tmp_normals[0] * aa_size;
+				tmp_points[(points_count - 1) * 2 + 0] = points[points_count - 1] + tmp_normals[points_count - 1] * aa_size;
+				tmp_points[(points_count - 1) * 2 + 1] = points[points_count - 1] - tmp_normals[points_count - 1] * aa_size;
+			}
 
 			auto idx = cur_idx;
 			for (auto i = 0u; i < count; ++i)
@@ -655,14 +902,7 @@ void draw_buffer::poly_line(position* points,
 				const auto j = (i + 1 == points_count) ? 0 : i + 1;
 				const auto idx2 = (i + 1 == points_count) ? cur_idx : idx + 3;
 
-				auto dm = ((tmp_normals[i] + tmp_normals[j]) * 0.5);
-				// IM_FIXNORMAL2F
-				auto len_sqr = dm.length_sqr();
-				if (len_sqr < 0.5f)
-					len_sqr = 0.5f;
-				dm *= (1.f / len_sqr);
-
-				dm *= aa_size;
+				const auto dm = fix_normal((tmp_normals[i] + tmp_normals[j]) * 0.5f) * aa_size;
 
 				const auto vtx_out = &tmp_points[j * 2];
 				vtx_out[0] = points[j] + dm;
@@ -686,7 +926,7 @@ void draw_buffer::poly_line(position* points,
 
 			for (auto i = 0u; i < points_count; ++i)
 			{
-				const auto col = cols[i];
+				const auto col = col_at(i);
 				const auto col_trans = pack_color{ col.r(), col.g(), col.b(), 0 };
 				write_vtx(points[i], uv, col);
 				write_vtx(tmp_points[i * 2], uv, col_trans);
@@ -696,18 +936,21 @@ void draw_buffer::poly_line(position* points,
 		else
 		{
 			const auto half_inner_thickness = (thickness - aa_size) * 0.5f;
-			tmp_points[0] = points[0] + tmp_normals[0] * (half_inner_thickness + aa_size);
-			tmp_points[1] = points[0] + tmp_normals[0] * (half_inner_thickness);
-			tmp_points[2] = points[0] - tmp_normals[0] * (half_inner_thickness);
-			tmp_points[3] = points[0] - tmp_normals[0] * (half_inner_thickness + aa_size);
-			tmp_points[(points_count - 1) * 4] = points[points_count - 1] + tmp_normals[points_count - 1] * (
-				half_inner_thickness + aa_size);
-			tmp_points[(points_count - 1) * 4 + 1] = points[points_count - 1] + tmp_normals[points_count - 1] * (
-				half_inner_thickness);
-			tmp_points[(points_count - 1) * 4 + 2] = points[points_count - 1] - tmp_normals[points_count - 1] * (
-				half_inner_thickness);
-			tmp_points[(points_count - 1) * 4 + 3] = points[points_count - 1] - tmp_normals[points_count - 1] * (
-				half_inner_thickness + aa_size);
+			if constexpr (!closed)
+			{
+				tmp_points[0] = points[0] + tmp_normals[0] * (half_inner_thickness + aa_size);
+				tmp_points[1] = points[0] + tmp_normals[0] * (half_inner_thickness);
+				tmp_points[2] = points[0] - tmp_normals[0] * (half_inner_thickness);
+				tmp_points[3] = points[0] - tmp_normals[0] * (half_inner_thickness + aa_size);
+				tmp_points[(points_count - 1) * 4] = points[points_count - 1] + tmp_normals[points_count - 1] * (
+					half_inner_thickness + aa_size);
+				tmp_points[(points_count - 1) * 4 + 1] = points[points_count - 1] + tmp_normals[points_count - 1] * (
+					half_inner_thickness);
+				tmp_points[(points_count - 1) * 4 + 2] = points[points_count - 1] - tmp_normals[points_count - 1] * (
+					half_inner_thickness);
+				tmp_points[(points_count - 1) * 4 + 3] = points[points_count - 1] - tmp_normals[points_count - 1] * (
+					half_inner_thickness + aa_size);
+			}
 
 			auto idx = cur_idx;
 			for (auto i = 0u; i < count; ++i)
@@ -715,8 +958,7 @@ void draw_buffer::poly_line(position* points,
 				const auto j = (i + 1 == points_count) ? 0 : i + 1;
 				const auto idx2 = (i + 1 == points_count) ? cur_idx : idx + 4;
 
-				auto dm = (tmp_normals[i] + tmp_normals[j]) * 0.5f;
-				dm.normalize();
+				const auto dm = fix_normal((tmp_normals[i] + tmp_normals[j]) * 0.5f);
 				const auto dm_out = dm * (half_inner_thickness + aa_size);
 				const auto dm_in = dm * half_inner_thickness;
 
@@ -750,7 +992,7 @@ void draw_buffer::poly_line(position* points,
 
 			for (auto i = 0u; i < points_count; ++i)
 			{
-				const auto col = cols[i];
+				const auto col = col_at(i);
 				const auto col_trans = pack_color{ col.r(), col.g(), col.b(), 0 };
 				write_vtx(tmp_points[i * 4], uv, col_trans);
 				write_vtx(tmp_points[i * 4 + 1], uv, col);
@@ -760,39 +1002,6 @@ void draw_buffer::poly_line(position* points,
 		}
 		cur_idx += vtx_count;
 	}
-	else
-	{
-		const auto idx_count = count * 6;
-		const auto vtx_count = count * 4;
-		reserve_primitives(idx_count, vtx_count);
-
-		for (auto i = 0u; i < count; ++i)
-		{
-			const auto j = (i + 1 == points_count) ? 0 : i + 1;
-			const auto& p1 = points[i];
-			const auto& p2 = points[j];
-
-			auto d = (p2 - p1).normalize();
-			d *= (thickness * 0.5f);
-			std::swap(d.x, d.y);
-			d.x = -d.x;
-
-			const auto col = cols[i];
-			write_vtx(p1 + d, uv, col);
-			write_vtx(p2 + d, uv, col);
-			write_vtx(p2 - d, uv, col);
-			write_vtx(p1 - d, uv, col);
-
-			write_idx(cur_idx);
-			write_idx(cur_idx + 1);
-			write_idx(cur_idx + 2);
-			write_idx(cur_idx);
-			write_idx(cur_idx + 2);
-			write_idx(cur_idx + 3);
-
-			cur_idx += 4;
-		}
-	}
 }
 
 void draw_buffer::poly_fill(position* points, const uint32_t count, const pack_color* col)
@@ -931,11 +1140,16 @@ void draw_buffer::text(font* font,
 	const position& top_left,
 	const pack_color col,
 	const bool outline,
-	const position& bot_right)
+	const position& bot_right,
+	const char* text_end)
 {
 	if (col.a() == 0)
 		return;
 
+	// once for the outline passes and the text
+	if (!text_end)
+		text_end = text + strlen(text);
+
 	if (font != nullptr)
 		push_font(font);
 
@@ -948,32 +1162,45 @@ void draw_buffer::text(font* font,
 		clip_rect.w = bot_right.y;
 	}
 
-	if (outline)
+	// sdf fonts get the outline from the distance field and fonts with stroked glyphs draw it in the same pass,
+	// everything else falls back to four extra draws
+	const auto sdf_outline    = outline && cur_font->sdf();
+	const auto stroke_outline = outline && !sdf_outline && cur_font->has_outline_glyphs();
+	const auto prev_style     = cur_sdf_style;
+	if (sdf_outline)
+		set_sdf_style({ color{ 0, 0, 0 }, 1.f, prev_style.glow_color, prev_style.glow_width });
+	else if (outline && !stroke_outline)
 	{
 		const auto col_out = color{ 0, 0, 0 };
 		auto copy_clip = clip_rect;
 		copy_clip.xy = top_left;
 		copy_clip.x -= 1.f;
 		copy_clip.z -= 1.f;
-		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 		copy_clip.x += 2.f;
 		copy_clip.z += 2.f;
 		if (copy_clip.z < 0)
 			copy_clip.z = std::numeric_limits<float>::max();
-		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 		copy_clip.x -= 1.f,
 			copy_clip.z -= 1.f;
 		copy_clip.y -= 1.f;
 		copy_clip.w -= 1.f;
-		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 		copy_clip.y += 2.f;
 		copy_clip.w += 2.f;
 		if (copy_clip.w < 0)
 			copy_clip.w = std::numeric_limits<float>::max();
-		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 	}
 
-	cur_font->render_text(this, cur_font->font_size, top_left, col, clip_rect, text, text + strlen(text));
+	if (stroke_outline)
+		cur_font->render_text(this, cur_font->font_size, top_left, col, clip_rect, text, text_end, 0.f, false, color{ 0, 0, 0 });
+	else
+		cur_font->render_text(this, cur_font->font_size, top_left, col, clip_rect, text, text_end);
+
+	if (sdf_outline)
+		set_sdf_style(prev_style);
 
 	if (font != nullptr)
 		pop_font();
@@ -985,11 +1212,16 @@ void draw_buffer::text(font* font,
 	const position& top_left,
 	const pack_color col,
 	bool outline,
-	const position& bot_right)
+	const position& bot_right,
+	const char* text_end)
 {
 	if (col.a() == 0)
 		return;
 
+	// once for the outline passes and the text
+	if (!text_end)
+		text_end = text + strlen(text);
+
 	if (font != nullptr)
 		push_font(font);
 
@@ -1002,32 +1234,45 @@ void draw_buffer::text(font* font,
 		clip_rect.w = bot_right.y;
 	}
 
-	if (outline)
+	// sdf fonts get the outline from the distance field and fonts with stroked glyphs draw it in the same pass,
+	// everything else falls back to four extra draws
+	const auto sdf_outline    = outline && cur_font->sdf();
+	const auto stroke_outline = outline && !sdf_outline && cur_font->has_outline_glyphs();
+	const auto prev_style     = cur_sdf_style;
+	if (sdf_outline)
+		set_sdf_style({ color{ 0, 0, 0 }, 1.f, prev_style.glow_color, prev_style.glow_width });
+	else if (outline && !stroke_outline)
 	{
 		const auto col_out = color{ 0, 0, 0 };
 		auto copy_clip = clip_rect;
 		copy_clip.xy = top_left;
 		copy_clip.x -= 1.f;
 		copy_clip.z -= 1.f;
-		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 		copy_clip.x += 2.f;
 		copy_clip.z += 2.f;
 		if (copy_clip.z < 0)
 			copy_clip.z = std::numeric_limits<float>::max();
-		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 		copy_clip.x -= 1.f,
 			copy_clip.z -= 1.f;
 		copy_clip.y -= 1.f;
 		copy_clip.w -= 1.f;
-		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 		copy_clip.y += 2.f;
 		copy_clip.w += 2.f;
 		if (copy_clip.w < 0)
 			copy_clip.w = std::numeric_limits<float>::max();
-		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw);
+		this->text(nullptr, target_size, text, copy_clip.xy, col_out, false, copy_clip.zw, text_end);
 	}
 
-	cur_font->render_text(this, target_size, top_left, col, clip_rect, text, text + strlen(text));
+	if (stroke_outline)
+		cur_font->render_text(this, target_size, top_left, col, clip_rect, text, text_end, 0.f, false, color{ 0, 0, 0 });
+	else
+		cur_font->render_text(this, target_size, top_left, col, clip_rect, text, text_end);
+
+	if (sdf_outline)
+		set_sdf_style(prev_style);
 
 	if (font != nullptr)
 		pop_font();
@@ -1040,7 +1285,7 @@ position draw_buffer::text_size(font* font, const char* text, const char* text_e
 		font = cur_font;
 	assert(font);
 
-	if (!strlen(text))
+	if (text_end ? text == text_end : !*text)
 		return position{ 0.f, font->font_size };
 
 	auto text_size = font->calc_text_size(font->font_size, FLT_MAX, -1.f, text, text_end);
@@ -1059,7 +1304,7 @@ position draw_buffer::text_size(font* font, float target_size, const char* text,
 		font = cur_font;
 	assert(font);
 
-	if (!strlen(text))
+	if (text_end ? text == text_end : !*text)
 		return position{ 0.f, font->font_size };
 
 	auto text_size = font->calc_text_size(target_size, FLT_MAX, -1.f, text, text_end);
@@ -1078,7 +1323,7 @@ rect draw_buffer::text_bounds(font* font, const char* text, const char* text_end
 		font = cur_font;
 	assert(font);
 
-	if (!strlen(text))
+	if (text_end ? text == text_end : !*text)
 		return rect{ 0.f, 0.f, 0.f, font->font_size };
 
 	auto text_bounds = font->calc_text_bounds(font->font_size, FLT_MAX, -1.f, text, text_end);
@@ -1097,7 +1342,7 @@ rect draw_buffer::text_bounds(font* font, float target_size, const char* text, c
 		font = cur_font;
 	assert(font);
 
-	if (!strlen(text))
+	if (text_end ? text == text_end : !*text)
 		return rect{ 0.f, 0.f, 0.f, target_size };
 
 	auto text_bounds = font->calc_text_bounds(target_size, FLT_MAX, -1.f, text, text_end);
@@ -1291,7 +1536,10 @@ void draw_manager::swap_buffers(const size_t idx)
 	const auto swap_buffer = [=](const size_t buf, const auto& self_ref) -> void
 	{
 		auto& element = _buffer_list[buf];
+		element.working_buffer->flush_clip();
 		element.active_buffer.swap(element.working_buffer);
+		// the mode belongs to the buffer node, not to one of the two buffers it alternates between
+		element.working_buffer->cpu_clipping = element.active_buffer->cpu_clipping;
 		element.working_buffer->clear_buffers();
 		for (auto& child : element.child_buffers)
 			self_ref(child.second, self_ref);
@@ -1367,6 +1615,30 @@ font* draw_manager::add_font_mem(uint8_t* data,
 	return fonts->add_font_from_ttf_mem(data, data_size, font_size, &font_cfg, ranges);
 }
 
+std::future<font*> draw_manager::add_font_async(const char* file,
+	const float size,
+	const bool italic,
+	const bool bold,
+	const GLYPH_RANGES range,
+	const int rasterizer_flags) const
+{
+	auto font_cfg = font_config();
+	if (italic)
+		font_cfg.rasterizer_flags |= OBLIQUE;
+	if (bold)
+		font_cfg.rasterizer_flags |= BOLD;
+
+	font_cfg.rasterizer_flags |= rasterizer_flags;
+
+	const font_wchar* ranges = nullptr;
+	if (range & GLYPH_RANGE_LATIN)
+		ranges = fonts->glyph_ranges_default();
+	if (range & GLYPH_RANGE_JAPANESE)
+		ranges = fonts->glyph_ranges_japanese();
+
+	return fonts->add_font_from_ttf_async(file, size, &font_cfg, ranges);
+}
+
 void draw_manager::remove_font(const font* font_ptr) const
 {
 	fonts->remove_font(font_ptr);
@@ -1381,11 +1653,32 @@ void draw_manager::update_matrix_translate(const size_t buffer, const position&
 	buffer_pair.active_buffer->update_matrix_translate(xy_translate, cmd_idx);
 }
 
+void draw_manager::collect_frame_textures()
+{
+	_frame_textures.clear();
+	if (!_upload_budget)
+		return;
+
+	for (const auto& node : _buffer_list)
+	{
+		if (node.is_free || !node.active_buffer)
+			continue;
+
+		for (const auto& cmd : node.active_buffer->cmds)
+		{
+			if (cmd.tex_id && !cmd.font_texture() && !cmd.native_texture())
+				_frame_textures.push_back(reinterpret_cast<slot_handle>(cmd.tex_id));
+		}
+	}
+
+	std::sort(_frame_textures.begin(), _frame_textures.end());
+	_frame_textures.erase(std::unique(_frame_textures.begin(), _frame_textures.end()), _frame_textures.end());
+}
+
 void draw_manager::init()
 {
 	fonts = std::make_unique<font_atlas>();
 	_buffer_list.reserve(1000);
-	init_circle_points();
 }
 
 
@@ -1477,67 +1770,3 @@ void util::draw::check_mark(draw_buffer* buf, position top_left, pos_type width,
 
 
 #pragma endregion
-
-#pragma region circle_points
-
-namespace
-{
-	void init_circle_points()
-	{
-		if (circle_points_initialized)
-			return;
-
-		circle_points_initialized = true;
-
-		std::array<position, CIRCLE_POINT_COUNT + 1> octant_buf{};
-		const auto step = (math::PI<double> * 0.25f) / CIRCLE_POINT_COUNT;
-		for (auto i = 0u; i <= CIRCLE_POINT_COUNT; ++i)
-		{
-			octant_buf[i] = position{ static_cast<float>(std::cos(step * i)), static_cast<float>(std::sin(step * i)) };
-		}
-
-		for (auto i = 0u; i < 8; ++i)
-		{
-			auto x_idx = 0;
-			auto y_idx = 1;
-			auto x_mult = 1.f;
-			auto y_mult = 1.f;
-			switch (i)
-			{
-			case 1:
-			case 2:
-			case 5:
-			case 6:
-				x_idx = 1;
-				y_idx = 0;
-			default:
-				break;
-			}
-
-			if (i >= 4)
-				y_mult = -1.f;
-			if (i >= 2 && i <= 5)
-				x_mult = -1.f;
-
-			const auto reverse = i % 2 == 1;
-
-			for (auto j = 0u; j <= CIRCLE_POINT_COUNT; ++j)
-			{
-				auto& fill_pos = circle_points[j + i * (CIRCLE_POINT_COUNT + 1)];
-				const auto& src_pos = octant_buf[reverse ? CIRCLE_POINT_COUNT - j : j];
-
-				fill_pos.x = src_pos[x_idx] * x_mult;
-				fill_pos.y = src_pos[y_idx] * y_mult;
-			}
-		}
-		std::rotate(circle_points.begin(), circle_points.begin() + (circle_points.size() - CIRCLE_POINT_COUNT * 2 - 2), circle_points.end());
-
-		for (auto i = 0u; i < circle_points.size(); ++i)
-		{
-			const auto& fill_pos = circle_points[i];
-			std::printf("Circle Point %u: %.4f, %.4f\n", i, fill_pos.x, fill_pos.y);
-		}
-	}
-}
-
-#pragma endregion 
@@ -2,6 +2,8 @@
 #include <algorithm>
 
 #include "font.hpp"
+#include "stream_buffer.hpp"
+#include "texture_upload.hpp"
 
 #include <functional>
 #include <assert.h>
@@ -20,6 +22,12 @@ enum ROUND_RECT_FLAG : uint8_t
 	ROUND_RECT_ALL = ROUND_RECT_TOP | ROUND_RECT_BOT
 };
 
+enum TEXTURE_FORMAT : uint8_t
+{
+	TEXTURE_FORMAT_RGBA8 = 0,
+	TEXTURE_FORMAT_A8 // single channel coverage, sampled as white with the texture as alpha (like the font atlas)
+};
+
 namespace util::draw
 {
 	struct callback_data
@@ -73,36 +81,191 @@ namespace util::draw
 		}
 	};
 
+	// 2D affine transform: p' = { m00 * x + m01 * y + t.x, m10 * x + m11 * y + t.y }
+	struct affine_transform
+	{
+		pos_type m00 = 1.f, m01 = 0.f;
+		pos_type m10 = 0.f, m11 = 1.f;
+		position translation = {};
+
+		static affine_transform translate(const position& t)
+		{
+			affine_transform r;
+			r.translation = t;
+			return r;
+		}
+
+		static affine_transform scale(const pos_type sx, const pos_type sy, const position& origin = {})
+		{
+			affine_transform r;
+			r.m00 = sx;
+			r.m11 = sy;
+			r.translation = { origin.x - origin.x * sx, origin.y - origin.y * sy };
+			return r;
+		}
+
+		static affine_transform rotate(const pos_type radians, const position& origin = {})
+		{
+			const auto c = std::cos(radians);
+			const auto s = std::sin(radians);
+			affine_transform r;
+			r.m00 = c;
+			r.m01 = -s;
+			r.m10 = s;
+			r.m11 = c;
+			r.translation = { origin.x - (c * origin.x - s * origin.y), origin.y - (s * origin.x + c * origin.y) };
+			return r;
+		}
+
+		bool translation_only() const
+		{
+			return m00 == 1.f && m01 == 0.f && m10 == 0.f && m11 == 1.f;
+		}
+
+		position apply(const position& p) const
+		{
+			return { m00 * p.x + m01 * p.y + translation.x, m10 * p.x + m11 * p.y + translation.y };
+		}
+
+		// Bounding box of the points this maps into r, everything if it collapses the plane. Exact for transforms
+		// without rotation, larger than needed otherwise
+		rect inverse_bounds(const rect& r) const
+		{
+			const auto det = m00 * m11 - m01 * m10;
+			if (det == 0.f)
+			{
+				constexpr auto max = std::numeric_limits<pos_type>::max();
+				return rect{ -max, -max, max, max };
+			}
+
+			const auto inverse = [&](const pos_type x, const pos_type y)
+			{
+				const auto px = x - translation.x;
+				const auto py = y - translation.y;
+				return position{ (m11 * px - m01 * py) / det, (m00 * py - m10 * px) / det };
+			};
+
+			const position corners[] = { inverse(r.x, r.y), inverse(r.z, r.y), inverse(r.z, r.w), inverse(r.x, r.w) };
+			auto bounds = rect{ corners[0].x, corners[0].y, corners[0].x, corners[0].y };
+			for (const auto& p : corners)
+			{
+				bounds.x = std::min(bounds.x, p.x);
+				bounds.y = std::min(bounds.y, p.y);
+				bounds.z = std::max(bounds.z, p.x);
+				bounds.w = std::max(bounds.w, p.y);
+			}
+			return bounds;
+		}
+
+		// Applies o first, then this
+		affine_transform operator*(const affine_transform& o) const
+		{
+			affine_transform r;
+			r.m00 = m00 * o.m00 + m01 * o.m10;
+			r.m01 = m00 * o.m01 + m01 * o.m11;
+			r.m10 = m10 * o.m00 + m11 * o.m10;
+			r.m11 = m10 * o.m01 + m11 * o.m11;
+			r.translation = apply(o.translation);
+			return r;
+		}
+	};
+
+	// Effects derived from the distance field of SDF fonts, widths are in pixels at the rasterized font size
+	// and can't exceed font_sdf_spread. Alpha 0 disables an effect
+	struct sdf_style
+	{
+		pack_color outline_color = { 0, 0, 0, 0 };
+		float outline_width = 0.f;
+		pack_color glow_color = { 0, 0, 0, 0 };
+		float glow_width = 0.f;
+
+		bool active() const
+		{
+			return (outline_color.a() != 0 && outline_width > 0.f) || (glow_color.a() != 0 && glow_width > 0.f);
+		}
+
+		// Distance values the effects start at, what the shaders get as sdf_params
+		float outline_edge() const
+		{
+			return std::clamp(0.5f - outline_width / (font_sdf_spread * 2.f), 0.f, 0.5f);
+		}
+
+		float glow_edge() const
+		{
+			return std::clamp(0.5f - glow_width / (font_sdf_spread * 2.f), 0.f, 0.5f - 1.f / 255.f);
+		}
+	};
+
+	// Software reference of the sdf pixel shaders, returns the straight alpha result for a sampled distance (0..1, 0.5 is the edge)
+	// smoothing is the half width of the anti-aliased edge in distance units, the shaders use fwidth for it
+	color sdf_shade(float dist, float smoothing, color fill, const sdf_style& style);
+
 	struct draw_buffer
 	{
 		using draw_index = std::uint32_t;
 
+		enum DRAW_CMD_FLAGS : uint8_t
+		{
+			CMD_FONT_TEXTURE = 1 << 0,
+			CMD_CIRCLE_SCISSOR = 1 << 1,
+			CMD_NATIVE_TEXTURE = 1 << 2,
+			CMD_SDF_TEXT = 1 << 3
+		};
+
+		// Kept small on purpose, everything that is rarely used lives in the cmd_exts side table
 		struct draw_cmd
 		{
-			std::uint32_t elem_count;
-			clip_rect clip_rect;
-			draw::clip_rect circle_outer_clip;
-			tex_id tex_id;
-			bool font_texture = false;
-			bool circle_scissor = false;
-			bool native_texture = false;
+			static constexpr std::uint32_t no_ext = std::numeric_limits<std::uint32_t>::max();
+
+			std::uint32_t elem_count = 0;
+			std::uint32_t vtx_count = 0;
+			clip_rect clip_rect = {};
+			tex_id tex_id = nullptr;
+			std::uint32_t ext_idx = no_ext; //Index into draw_buffer::cmd_exts, no_ext if unused
+			uint8_t flags = 0;
+
+			bool font_texture() const
+			{
+				return flags & CMD_FONT_TEXTURE;
+			}
+
+			bool circle_scissor() const
+			{
+				return flags & CMD_CIRCLE_SCISSOR;
+			}
+
+			bool native_texture() const
+			{
+				return flags & CMD_NATIVE_TEXTURE;
+			}
+
+			bool sdf_text() const
+			{
+				return flags & CMD_SDF_TEXT;
+			}
+
+			void set_flag(const DRAW_CMD_FLAGS flag, const bool enabled)
+			{
+				flags = static_cast<uint8_t>(enabled ? (flags | flag) : (flags & ~flag));
+			}
+		};
+
+		struct draw_cmd_ext;
+		// Gets the rare state of the command too, callback_data lives there
+		using draw_callback = std::function<void(const draw_cmd*, const draw_cmd_ext&)>;
+
+		// Rare per-command state, only allocated for commands that actually use it
+		struct draw_cmd_ext
+		{
+			draw::clip_rect circle_outer_clip = {};
 			uint8_t blur_strength = 0;
 			uint8_t blur_pass_count = 0;
-			std::uint32_t vtx_count = 0;
-			std::function<void(const draw_cmd*)> callback =
-				nullptr;
-			//Callback that will be called if not null instead of drawing
-			std::shared_ptr<callback_data> callback_data = nullptr; //Data for callback
 			// If color matches it will be made transparent, alpha indicates enabling of the feature
 			color key_color = { 0, 0, 0, 0 };
-			// TODO: optionally disable these with a define since their use case is limited and they just waste space in the draw_cmd?
-			// This will be used as the model matrix, e.g. "model space to world space", basically a tool to transform all vertexes
-			matrix matrix = {
-				vec4f{1.f, 0.f, 0.f, 0.f},
-				{0.f, 1.f, 0.f, 0.f},
-				{0.f, 0.f, 1.f, 0.f},
-				{0.f, 0.f, 0.f, 1.f}
-			};
+			sdf_style sdf = {}; //Only used by CMD_SDF_TEXT commands
+			//Callback that will be called if not null instead of drawing
+			draw_callback callback = nullptr;
+			std::shared_ptr<callback_data> callback_data = nullptr; //Data for callback
 		};
 
 		struct draw_vertex
@@ -125,6 +288,7 @@ namespace util::draw
 		};
 
 		std::vector<draw_cmd> cmds = {};
+		std::vector<draw_cmd_ext> cmd_exts = {};
 		std::vector<draw_vertex> vertices = {};
 		std::vector<draw_index> indices = {};
 
@@ -136,10 +300,18 @@ namespace util::draw
 		std::vector<tex_id> tex_id_stack = {};
 		std::vector<font*> font_stack = {};
 		std::vector<position> path = {};
+		std::vector<affine_transform> transform_stack = {};
+		size_t transform_vtx_start = 0; //First vertex the top of transform_stack hasn't been applied to yet
+		position cmd_translate = {}; //Translation of the last cmd from update_matrix_translate, also moves vertexes written later
+		size_t cmd_translate_vtx_start = 0; //First vertex cmd_translate hasn't been applied to yet
+		bool cpu_clipping = false;
+		size_t clip_idx_start = 0; //First index that hasn't been clipped against the current clip rect yet
+		size_t pinned_cmd_count = 0; //Cmds below were handed out by force_new_cmd, merging must not move them
 		draw_vertex* vtx_write_ptr = nullptr;
 		draw_index* idx_write_ptr = nullptr;
 		draw_index cur_idx = 0;
 		font* cur_font = nullptr;
+		sdf_style cur_sdf_style = {};
 		draw_manager* manager = nullptr;
 
 	public:
@@ -158,16 +330,24 @@ namespace util::draw
 		void clear_buffers()
 		{
 			cmds = {};
+			cmd_exts = {};
 			vertices = {};
 			indices = {};
 			clip_rect_stack = {};
 			tex_id_stack = {};
 			font_stack = {};
 			path = {};
+			transform_stack = {};
+			transform_vtx_start = 0;
+			cmd_translate = {};
+			cmd_translate_vtx_start = 0;
+			clip_idx_start = 0;
+			pinned_cmd_count = 0;
 			vtx_write_ptr = nullptr;
 			idx_write_ptr = nullptr;
 			cur_idx = 0;
 			cur_font = nullptr;
+			cur_sdf_style = {};
 			update_clip_rect();
 		}
 
@@ -177,6 +357,7 @@ namespace util::draw
 
 		void push_clip_rect(const position& min, const position& max, const bool circle = false) //rvalue reference?
 		{
+			flush_clip();
 			auto new_rect = rect{ min, max };
 			if (!circle)
 				new_rect = clip_rect_to_cur_rect(new_rect);
@@ -191,6 +372,7 @@ namespace util::draw
 			const pos_type max_y,
 			const bool circle = false)
 		{
+			flush_clip();
 			auto new_rect = rect{ min_x, min_y, max_x, max_y };
 			if (!circle)
 				new_rect = clip_rect_to_cur_rect(new_rect);
@@ -201,6 +383,7 @@ namespace util::draw
 
 		void push_clip_rect(const rect& clip_rect, const bool circle = false)
 		{
+			flush_clip();
 			const auto new_rect = circle ? clip_rect : clip_rect_to_cur_rect(clip_rect);
 			clip_rect_stack.emplace_back(std::make_pair(new_rect, circle));
 			update_clip_rect();
@@ -209,6 +392,7 @@ namespace util::draw
 		void pop_clip_rect()
 		{
 			assert(!clip_rect_stack.empty());
+			flush_clip();
 			clip_rect_stack.pop_back();
 			update_clip_rect();
 		}
@@ -243,11 +427,51 @@ namespace util::draw
 
 		// This is special: This function allows to move all vertexes in a cmd(or all vertexes) by the x&y-values specified in xy_translate
 		// This can be useful if you later want to move an already-swapped buffer without redoing all the computing
-		// Warning: This will add to the current translation
+		// Vertexes written into the last cmd afterwards are moved as well when it gets flushed, later cmds are not
+		// Warning: This will add to the current translation, clip rects are not moved
 		void update_matrix_translate(const position& xy_translate, const size_t cmd_idx = -1);
 
+		// Everything drawn until the matching pop_transform gets transformed on the cpu, nested transforms are combined
+		// Clip rects stay in screen space
+		void push_transform(const affine_transform& transform);
+		void pop_transform();
+
+		// Applies the current transform to all vertexes written since the last push/pop, done automatically on push/pop/swap
+		void flush_transform();
+
+		// When enabled clip rects (including circles) no longer split commands, triangles get clipped on the cpu instead
+		// Useful for lots of small clipped widgets, costs cpu time for every triangle crossing a clip edge
+		// Stays set for the following frames until it gets disabled again
+		void set_cpu_clipping(bool enabled);
+
+		// Clips everything written since the last clip change, flushes pending transforms first. Done automatically on clip/cmd changes and swap
+		void flush_clip();
+
+		// Gaussian blur of what's behind the following commands, strength is the radius in pixels. Radii beyond
+		// 2 * blur_kernel::max_taps sample a sparser grid, more passes hide the aliasing that comes with it
 		void set_blur(uint8_t strength = 2, uint8_t passes = 1);
 		void set_key_color(color col);
+		// Outline/glow for following text drawn with SDF fonts, passing {} disables it again
+		void set_sdf_style(const sdf_style& style);
+		// Starts a new command which will call cb instead of drawing
+		void set_callback(draw_callback cb, std::shared_ptr<callback_data> data = nullptr);
+
+		// Returns the rare state of a command, commands without any share a default one
+		const draw_cmd_ext& cmd_ext(const draw_cmd& cmd) const
+		{
+			static const draw_cmd_ext default_ext = {};
+			return cmd.ext_idx == draw_cmd::no_ext ? default_ext : cmd_exts[cmd.ext_idx];
+		}
+
+		draw_cmd_ext& cmd_ext_mut(draw_cmd& cmd)
+		{
+			if (cmd.ext_idx == draw_cmd::no_ext)
+			{
+				cmd.ext_idx = static_cast<std::uint32_t>(cmd_exts.size());
+				cmd_exts.emplace_back();
+			}
+			return cmd_exts[cmd.ext_idx];
+		}
 
 		//Drawing Funcs
 		//Triangles
@@ -435,12 +659,14 @@ namespace util::draw
 			uint32_t count,
 			pack_color col,
 			pos_type thickness,
-			bool anti_aliased = false/*, bool closed = false, bool anti_aliased = true*/);
+			bool anti_aliased = false,
+			bool closed = false);
 		void poly_line(position* points,
 			uint32_t count,
 			const pack_color* col,
 			pos_type thickness,
-			bool anti_aliased = false/*, bool closed = false, bool anti_aliased = true*/);
+			bool anti_aliased = false,
+			bool closed = false);
 
 		void poly_fill(position* points, uint32_t count, const pack_color* col); //TODO: Anti-Aliasing
 		void poly_fill(position* points, uint32_t count, pack_color col);
@@ -463,14 +689,15 @@ namespace util::draw
 			const position& uv4,
 			const pack_color col);
 
-		//Not formatted and auto-clipped rn
+		//Not formatted and auto-clipped rn. Pass text_end when the length is known, null measures text once
 		void text(font* font,
 			const char* text,
 			const position& top_left,
 			const pack_color col,
 			bool outline = false,
 			const position& bot_right = position
-			{ -1.f, -1.f });
+			{ -1.f, -1.f },
+			const char* text_end = nullptr);
 
 		void text(const char* text,
 			const position& top_left,
@@ -479,9 +706,10 @@ namespace util::draw
 			const position& bot_right = position{
 				-1.f,
 				-1.f
-			})
+			},
+			const char* text_end = nullptr)
 		{
-			this->text(nullptr, text, top_left, col, outline, bot_right);
+			this->text(nullptr, text, top_left, col, outline, bot_right, text_end);
 		}
 
 		position text_size(font* font, const char* text, const char* text_end = nullptr) const;
@@ -504,16 +732,18 @@ namespace util::draw
 			const position& top_left,
 			const pack_color col,
 			bool outline = false,
-			const position& bot_right = position{ -1.f, -1.f });
+			const position& bot_right = position{ -1.f, -1.f },
+			const char* text_end = nullptr);
 
 		void text(float target_size,
 			const char* text,
 			const position& top_left,
 			const pack_color col,
 			const bool outline = false,
-			const position& bot_right = position{ -1.f, -1.f })
+			const position& bot_right = position{ -1.f, -1.f },
+			const char* text_end = nullptr)
 		{
-			this->text(nullptr, target_size, text, top_left, col, outline, bot_right);
+			this->text(nullptr, target_size, text, top_left, col, outline, bot_right, text_end);
 		}
 
 		position text_size(font* font, float target_size, const char* text, const char* text_end = nullptr) const;
@@ -533,6 +763,29 @@ namespace util::draw
 	private:
 		void reserve_primitives(std::uint32_t idx_count, std::uint32_t vtx_count);
 
+		// Writes the current clip/texture state into cmd
+		void apply_cmd_state(draw_cmd& cmd, bool force_font, bool native_texture);
+		draw_cmd& new_cmd(bool force_font, bool native_texture, bool inherit_key = true);
+		// Drops an empty last command if it has the same state as the one before it
+		void merge_empty_cmd();
+
+		static void transform_vertices(draw_vertex* vtx, size_t count, const affine_transform& transform);
+		// Applies cmd_translate to the vertexes written since the last flush, done by flush_clip
+		void flush_cmd_translate();
+		void clip_triangles(size_t idx_start);
+
+		// picks the poly_line_impl specialization once per call so the kernels themselves don't branch on the flags
+		void poly_line_dispatch(const position* points,
+			uint32_t count,
+			const pack_color* cols,
+			bool per_vtx_col,
+			pos_type thickness,
+			bool anti_aliased,
+			bool closed);
+
+		template<bool anti_aliased, bool thick_line, bool per_vtx_col, bool closed>
+		void poly_line_impl(const position* points, uint32_t count, const pack_color* cols, pos_type thickness);
+
 		void write_vtx(const position& p, const position& uv, const std::uint32_t col)
 		{
 			vtx_write_ptr->pos = p;
@@ -627,6 +880,15 @@ namespace util::draw
 			GLYPH_RANGES range = GLYPH_RANGE_LATIN,
 			int rasterizer_flags = 0)
 			const;
+		// Like add_font, but rasterizes on a background thread. Text keeps drawing with the fonts added before and the
+		// new font is usable once the future is ready, after the next draw() published the rebuilt atlas
+		std::future<font*> add_font_async(const char* file,
+			float size,
+			bool italic = false,
+			bool bold = false,
+			GLYPH_RANGES range = GLYPH_RANGE_LATIN,
+			int rasterizer_flags = 0)
+			const;
 		void remove_font(const font*) const;
 
 		// This will call update_matrix_translate on the currently active(!) buffer in the "swapchain", 
@@ -635,8 +897,15 @@ namespace util::draw
 
 
 		// Texture Creation
-		virtual tex_id create_texture(uint32_t width, uint32_t height) = 0;
+		virtual tex_id create_texture(uint32_t width, uint32_t height, TEXTURE_FORMAT format = TEXTURE_FORMAT_RGBA8) = 0;
+		// Only for TEXTURE_FORMAT_RGBA8 textures
 		virtual bool set_texture_rgba(tex_id id, const uint8_t* rgba, uint32_t width, uint32_t height) = 0;
+		// Only for TEXTURE_FORMAT_A8 textures, one byte per pixel
+		virtual bool set_texture_alpha(tex_id id, const uint8_t* alpha, uint32_t width, uint32_t height) = 0;
+		// Replaces w*h pixels at x/y of a texture that already has data, in the format of set_texture_rgba or set_texture_alpha.
+		// pitch is the byte distance between rows of data, 0 if they are packed. Regions updated before the next draw()
+		// are merged and only they get uploaded, not the whole texture
+		virtual bool update_texture_region(tex_id id, uint32_t x, uint32_t y, uint32_t w, uint32_t h, const uint8_t* data, uint32_t pitch = 0) = 0;
 		// this function exists to fix bugs im too lazy to find out why they even happen
 		// also it may not even do what the name suggests
 		// the d3d9_manager feeds it directly to directx while the csgo impl converts the data to bgra
@@ -644,6 +913,44 @@ namespace util::draw
 		virtual bool texture_size(tex_id id, uint32_t& width, uint32_t& height) = 0;
 		virtual bool delete_texture(tex_id id) = 0;
 
+		// Textures for camera/video feeds that change every frame. A producer thread writes frames straight into the
+		// staging memory of the stream and draw() uploads the newest committed one, skipping the upload queue
+		virtual tex_id create_stream_texture(uint32_t width, uint32_t height, TEXTURE_FORMAT format = TEXTURE_FORMAT_RGBA8) = 0;
+		// Null if id isn't a stream texture. The texture must not be deleted while a producer uses it
+		virtual stream_buffer* stream_texture(tex_id id) = 0;
+
+		// Frame to write height rows of pitch bytes into, in the format of set_texture_rgba/set_texture_alpha
+		uint8_t* map_stream_texture(const tex_id id, uint32_t& pitch)
+		{
+			const auto stream = stream_texture(id);
+			if (!stream)
+				return nullptr;
+
+			pitch = stream->pitch();
+			return stream->map();
+		}
+
+		// Publishes the mapped frame, the next draw() picks it up
+		void commit_stream_texture(const tex_id id)
+		{
+			if (const auto stream = stream_texture(id))
+				stream->commit();
+		}
+
+		// Caps the texture data the backends upload per draw(), 0 uploads everything queued at once. Textures drawn in
+		// the frame go first, the rest waits for the following frames
+		void set_texture_upload_budget(const size_t bytes)
+		{
+			_upload_budget = bytes;
+		}
+
+		// Of the last draw()
+		texture_upload_stats upload_stats()
+		{
+			std::lock_guard<std::mutex> g(_list_mutex);
+			return _upload_stats;
+		}
+
 		virtual void draw() = 0;
 	protected:
 		std::vector<buffer_node> _buffer_list = {};
@@ -651,6 +958,13 @@ namespace util::draw
 		std::vector<size_t> _free_buffers = {};
 		std::mutex _list_mutex;
 		position _screen_size = position{};
+		std::atomic<size_t> _upload_budget{0};
+		texture_upload_stats _upload_stats = {}; // guarded by _list_mutex
+		std::vector<slot_handle> _frame_textures = {};
+
+		// Sorted handles of the user textures the active buffers draw with, needs _list_mutex.
+		// Left empty without an upload budget, the order doesn't matter then
+		void collect_frame_textures();
 
 		void sort_priorities()
 		{
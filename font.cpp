@@ -1,16 +1,36 @@
+#include <filesystem>
 #include <fstream>
+#include <string>
 
 #include <ft2build.h>
 #include <freetype/freetype.h>
 #include <freetype/ftglyph.h>
+#include <freetype/ftstroke.h>
 #include <freetype/ftsynth.h>
+#include <chrono>
+#include <future>
+#include <limits>
 #include <mutex>
+#include <unordered_map>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <Windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
 #include "freetype/ftcache.h"
 #include "freetype/ftbitmap.h"
 #include "freetype/ftsizes.h"
 
 #include "draw_manager.hpp"
+#include "hash_bytes.hpp"
+#include "text_scan.hpp"
 
 #define ARRAY_SIZE(x) ((int)(sizeof(x)/sizeof(*x)))
 
@@ -25,23 +45,6 @@ using namespace util::draw;
 
 #pragma region font_utils
 
-void* load_file_to_mem(const char *filename, size_t *data_size)
-{
-	std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
-
-	if (!file.is_open())
-		return nullptr;
-
-	const auto file_size = file.tellg();
-	const auto file_data = reinterpret_cast<char*>(malloc(static_cast<std::size_t>(file_size)));
-	file.seekg(0, std::ios::beg);
-	file.read(file_data, file_size);
-	file.close();
-
-	*data_size = static_cast<std::size_t>(file_size);
-	return file_data;
-}
-
 template<typename ...args>
 size_t format_string(char *buf, const size_t buf_size, const char *fmt, args ... arg_list)
 {
@@ -54,80 +57,6 @@ size_t format_string(char *buf, const size_t buf_size, const char *fmt, args ...
 	return req_size;
 }
 
-int text_char_from_utf8(unsigned int *out_char, const char *in_text, const char *in_text_end)
-{
-	auto c          = -1;
-	const auto *str = reinterpret_cast<const unsigned char*>(in_text);
-	if (!(*str & 0x80))
-	{
-		c         = static_cast<uint32_t>(*str++);
-		*out_char = c;
-		return 1;
-	}
-	if ((*str & 0xe0) == 0xc0)
-	{
-		*out_char = 0xFFFD; // will be invalid but not end of string
-		if (in_text_end && in_text_end - reinterpret_cast<const char*>(str) < 2)
-			return 1;
-		if (*str < 0xc2)
-			return 2;
-		c = static_cast<uint32_t>((*str++ & 0x1f) << 6);
-		if ((*str & 0xc0) != 0x80)
-			return 2;
-		c += (*str++ & 0x3f);
-		*out_char = c;
-		return 2;
-	}
-	if ((*str & 0xf0) == 0xe0)
-	{
-		*out_char = 0xFFFD; // will be invalid but not end of string
-		if (in_text_end && in_text_end - reinterpret_cast<const char*>(str) < 3)
-			return 1;
-		if (*str == 0xe0 && (str[1] < 0xa0 || str[1] > 0xbf))
-			return 3;
-		if (*str == 0xed && str[1] > 0x9f)
-			return 3; // str[1] < 0x80 is checked below
-		c = static_cast<uint32_t>((*str++ & 0x0f) << 12);
-		if ((*str & 0xc0) != 0x80)
-			return 3;
-		c += static_cast<uint32_t>((*str++ & 0x3f) << 6);
-		if ((*str & 0xc0) != 0x80)
-			return 3;
-		c += (*str++ & 0x3f);
-		*out_char = c;
-		return 3;
-	}
-	if ((*str & 0xf8) == 0xf0)
-	{
-		*out_char = 0xFFFD; // will be invalid but not end of string
-		if (in_text_end && in_text_end - reinterpret_cast<const char*>(str) < 4)
-			return 1;
-		if (*str > 0xf4)
-			return 4;
-		if (*str == 0xf0 && (str[1] < 0x90 || str[1] > 0xbf))
-			return 4;
-		if (*str == 0xf4 && str[1] > 0x8f)
-			return 4; // str[1] < 0x80 is checked below
-		c = static_cast<uint32_t>((*str++ & 0x07) << 18);
-		if ((*str & 0xc0) != 0x80)
-			return 4;
-		c += static_cast<uint32_t>((*str++ & 0x3f) << 12);
-		if ((*str & 0xc0) != 0x80)
-			return 4;
-		c += static_cast<uint32_t>((*str++ & 0x3f) << 6);
-		if ((*str & 0xc0) != 0x80)
-			return 4;
-		c += (*str++ & 0x3f);
-		// utf-8 encodings of values used in surrogate pairs are invalid
-		if ((c & 0xFFFFF800) == 0xD800)
-			return 4;
-		*out_char = c;
-		return 4;
-	}
-	*out_char = 0;
-	return 0;
-}
-
 static inline int upper_power_of_two(int v)
 {
 	v--;
@@ -142,6 +71,122 @@ static inline int upper_power_of_two(int v)
 
 #pragma endregion
 
+#pragma region font_file
+
+namespace
+{
+	std::mutex font_files_mutex;
+	std::unordered_map<std::string, std::weak_ptr<font_file>> font_files;
+
+	// One library for all fonts. Faces of one library may only be created and destroyed by one thread at a time,
+	// rasterizing into different faces in parallel is fine
+	std::mutex freetype_mutex;
+	FT_Library freetype_shared_library = nullptr;
+	uint32_t freetype_library_refs     = 0;
+
+	FT_Library acquire_freetype_library()
+	{
+		std::lock_guard g(freetype_mutex);
+		if (!freetype_shared_library && FT_Init_FreeType(&freetype_shared_library))
+			return nullptr;
+		freetype_library_refs++;
+		return freetype_shared_library;
+	}
+
+	void release_freetype_library()
+	{
+		std::lock_guard g(freetype_mutex);
+		assert(freetype_library_refs > 0);
+		if (--freetype_library_refs == 0)
+		{
+			FT_Done_FreeType(freetype_shared_library);
+			freetype_shared_library = nullptr;
+		}
+	}
+}
+
+std::shared_ptr<font_file> font_file::open(const char *file_name)
+{
+	std::lock_guard g(font_files_mutex);
+	auto &entry = font_files[file_name];
+	if (auto existing = entry.lock())
+		return existing;
+
+	const uint8_t *data = nullptr;
+	size_t size         = 0;
+#ifdef _WIN32
+	const auto file_handle = CreateFileA(file_name,
+	                                     GENERIC_READ,
+	                                     FILE_SHARE_READ,
+	                                     nullptr,
+	                                     OPEN_EXISTING,
+	                                     FILE_ATTRIBUTE_NORMAL,
+	                                     nullptr);
+	if (file_handle != INVALID_HANDLE_VALUE)
+	{
+		LARGE_INTEGER file_size;
+		const auto mapping = GetFileSizeEx(file_handle, &file_size) && file_size.QuadPart > 0
+			                     ? CreateFileMappingA(file_handle, nullptr, PAGE_READONLY, 0, 0, nullptr)
+			                     : nullptr;
+		if (mapping)
+		{
+			// the view keeps the mapping and the file alive on its own
+			data = static_cast<const uint8_t*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+			size = static_cast<size_t>(file_size.QuadPart);
+			CloseHandle(mapping);
+		}
+		CloseHandle(file_handle);
+	}
+#else
+	const auto fd = ::open(file_name, O_RDONLY);
+	if (fd >= 0)
+	{
+		struct stat st{};
+		if (fstat(fd, &st) == 0 && st.st_size > 0)
+		{
+			const auto mapped = mmap(nullptr, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+			if (mapped != MAP_FAILED)
+			{
+				data = static_cast<const uint8_t*>(mapped);
+				size = static_cast<size_t>(st.st_size);
+			}
+		}
+		close(fd);
+	}
+#endif
+	if (!data)
+	{
+		font_files.erase(file_name);
+		return nullptr;
+	}
+
+	auto file  = std::make_shared<font_file>();
+	file->path = file_name;
+	file->data = data;
+	file->size = size;
+	entry      = file;
+	return file;
+}
+
+font_file::~font_file()
+{
+	if (!data)
+		return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+#else
+	munmap(const_cast<uint8_t*>(data), size);
+#endif
+
+	std::lock_guard g(font_files_mutex);
+	const auto it = font_files.find(path);
+	if (it != font_files.end() && it->second.expired())
+		font_files.erase(it);
+}
+
+#pragma endregion
+
 #pragma region font_config
 
 font_config::font_config()
@@ -162,6 +207,9 @@ font_config::font_config()
 	merge_mode          = false;
 	rasterizer_flags    = 0;
 	rasterizer_multiply = 1.f;
+	dynamic_glyphs      = false;
+	dynamic_glyph_cells = 256;
+	outline_thickness   = 1.f;
 	dst_font            = nullptr;
 }
 
@@ -185,29 +233,39 @@ font::font()
 	fallback_char  = static_cast<font_wchar>('?');
 	display_offset = position{0.f, 0.f};
 	clear_output_data();
+	bump_layout_generation(true);
 }
 
 font::~font()
 {
+	shutdown();
 	clear_output_data();
 }
 
 
 bool font::init(const font_config &cfg, const uint32_t user_flags)
 {
-	auto result = FT_Init_FreeType(&freetype_library);
-	if (result)
-		return false;
+	// fonts with a glyph cache keep their face alive between builds
+	shutdown();
 
-	result = FT_New_Memory_Face(freetype_library,
-	                            reinterpret_cast<uint8_t*>(cfg.font_data),
-	                            cfg.font_data_size,
-	                            cfg.font_idx,
-	                            &freetype_face);
-	if (result)
+	freetype_library = acquire_freetype_library();
+	if (!freetype_library)
 		return false;
 
-	result = FT_Select_Charmap(freetype_face, FT_ENCODING_UNICODE);
+	{
+		std::lock_guard g(freetype_mutex);
+		if (FT_New_Memory_Face(freetype_library,
+		                       reinterpret_cast<uint8_t*>(cfg.font_data),
+		                       cfg.font_data_size,
+		                       cfg.font_idx,
+		                       &freetype_face))
+		{
+			freetype_face = nullptr;
+			return false;
+		}
+	}
+
+	auto result = FT_Select_Charmap(freetype_face, FT_ENCODING_UNICODE);
 	if (result)
 		return false;
 
@@ -229,18 +287,39 @@ bool font::init(const font_config &cfg, const uint32_t user_flags)
 	else
 		freetype_load_flags |= FT_LOAD_TARGET_NORMAL;
 
+	// sdf fonts derive their outline from the distance field
+	if ((this->user_flags & OUTLINE) && !(this->user_flags & SDF) && cfg.outline_thickness > 0.f)
+	{
+		if (FT_Stroker_New(freetype_library, &freetype_stroker))
+			return false;
+		FT_Stroker_Set(freetype_stroker,
+		               static_cast<FT_Fixed>(cfg.outline_thickness * 64.f),
+		               FT_STROKER_LINECAP_ROUND,
+		               FT_STROKER_LINEJOIN_ROUND,
+		               0);
+	}
+
 	return true;
 }
 
 void font::shutdown()
 {
-	if (!freetype_face)
-		return;
-
-	FT_Done_Face(freetype_face);
-	freetype_face = nullptr;
-	FT_Done_FreeType(freetype_library);
-	freetype_library = nullptr;
+	if (freetype_stroker)
+	{
+		FT_Stroker_Done(freetype_stroker);
+		freetype_stroker = nullptr;
+	}
+	if (freetype_face)
+	{
+		std::lock_guard g(freetype_mutex);
+		FT_Done_Face(freetype_face);
+		freetype_face = nullptr;
+	}
+	if (freetype_library)
+	{
+		release_freetype_library();
+		freetype_library = nullptr;
+	}
 }
 
 void font::set_pixel_height(uint32_t pixel_height)
@@ -265,8 +344,10 @@ void font::set_pixel_height(uint32_t pixel_height)
 bool font::calc_glyph_info(const uint32_t codepoint,
                            glyph_info &glyph_info,
                            FT_Glyph &ft_glyph,
-                           FT_BitmapGlyph &ft_bitmap) const
+                           FT_BitmapGlyph &ft_bitmap,
+                           const bool stroked) const
 {
+	assert(!stroked || freetype_stroker);
 	const auto glyph_idx = FT_Get_Char_Index(freetype_face, codepoint);
 	if (!glyph_idx)
 		return false;
@@ -288,6 +369,13 @@ bool font::calc_glyph_info(const uint32_t codepoint,
 	if (result)
 		return false;
 
+	// Grows the outline by outline_thickness, the result is drawn below the regular glyph
+	if (stroked && FT_Glyph_StrokeBorder(&ft_glyph, freetype_stroker, false, true))
+	{
+		FT_Done_Glyph(ft_glyph);
+		return false;
+	}
+
 	//Rasterize
 	result = FT_Glyph_To_Bitmap(&ft_glyph, FT_RENDER_MODE_NORMAL, nullptr, true);
 	if (result)
@@ -300,18 +388,36 @@ bool font::calc_glyph_info(const uint32_t codepoint,
 	glyph_info.width     = static_cast<float>(ft_bitmap->bitmap.width);
 	glyph_info.height    = static_cast<float>(ft_bitmap->bitmap.rows);
 
+	// The distance field extends past the outline, grow the quad so positions stay the same
+	if ((user_flags & SDF) && !stroked && ft_bitmap->bitmap.width && ft_bitmap->bitmap.rows)
+	{
+		const auto spread = static_cast<float>(font_sdf_spread);
+		glyph_info.offset_x -= spread;
+		glyph_info.offset_y -= spread;
+		glyph_info.width += spread * 2.f;
+		glyph_info.height += spread * 2.f;
+	}
+
 	return true;
 }
 
 void font::blit_glyph(const FT_BitmapGlyph ft_bitmap,
                       uint8_t *dst,
                       const uint32_t dst_pitch,
-                      const unsigned char *multiply_table) const
+                      const unsigned char *multiply_table,
+                      const uint32_t max_width,
+                      const uint32_t max_height) const
 {
 	assert(ft_bitmap != nullptr);
 
-	const auto w         = ft_bitmap->bitmap.width;
-	const auto h         = ft_bitmap->bitmap.rows;
+	if (user_flags & SDF)
+	{
+		blit_glyph_sdf(ft_bitmap, dst, dst_pitch, max_width, max_height);
+		return;
+	}
+
+	const auto w         = std::min(static_cast<uint32_t>(ft_bitmap->bitmap.width), max_width);
+	const auto h         = std::min(static_cast<uint32_t>(ft_bitmap->bitmap.rows), max_height);
 	auto src             = ft_bitmap->bitmap.buffer;
 	const auto src_pitch = ft_bitmap->bitmap.pitch;
 
@@ -329,14 +435,68 @@ void font::blit_glyph(const FT_BitmapGlyph ft_bitmap,
 	}
 }
 
+void font::blit_glyph_sdf(const FT_BitmapGlyph ft_bitmap,
+                          uint8_t *dst,
+                          const uint32_t dst_pitch,
+                          const uint32_t max_width,
+                          const uint32_t max_height) const
+{
+	const auto spread    = static_cast<int32_t>(font_sdf_spread);
+	const auto src_w     = static_cast<int32_t>(ft_bitmap->bitmap.width);
+	const auto src_h     = static_cast<int32_t>(ft_bitmap->bitmap.rows);
+	const auto src_pitch = ft_bitmap->bitmap.pitch;
+	const auto src       = ft_bitmap->bitmap.buffer;
+	if (!src_w || !src_h)
+		return;
+
+	const auto coverage = [&](const int32_t x, const int32_t y) -> uint8_t
+	{
+		if (x < 0 || y < 0 || x >= src_w || y >= src_h)
+			return 0;
+		return src[y * src_pitch + x];
+	};
+
+	// Brute force search for the nearest pixel on the other side of the outline, fine for glyph sized
+	// bitmaps and a small spread. Partially covered pixels use their coverage for sub-pixel precision
+	const auto out_w = std::min(static_cast<uint32_t>(src_w + spread * 2), max_width);
+	const auto out_h = std::min(static_cast<uint32_t>(src_h + spread * 2), max_height);
+	for (auto out_y = 0u; out_y < out_h; out_y++, dst += dst_pitch)
+	{
+		for (auto out_x = 0u; out_x < out_w; out_x++)
+		{
+			const auto x      = static_cast<int32_t>(out_x) - spread;
+			const auto y      = static_cast<int32_t>(out_y) - spread;
+			const auto cov    = coverage(x, y);
+			const auto inside = cov >= 128;
+
+			auto best_sqr = spread * spread * 2;
+			for (auto dy = -spread; dy <= spread; dy++)
+			{
+				for (auto dx = -spread; dx <= spread; dx++)
+				{
+					const auto d_sqr = dx * dx + dy * dy;
+					if (d_sqr < best_sqr && (coverage(x + dx, y + dy) >= 128) != inside)
+						best_sqr = d_sqr;
+				}
+			}
+
+			auto dist = std::sqrt(static_cast<float>(best_sqr)) - 0.5f;
+			if (cov > 0 && cov < 255)
+				dist = std::min(dist, std::abs(cov / 255.f - 0.5f));
+
+			const auto signed_dist = inside ? dist : -dist;
+			const auto value       = std::clamp(0.5f + signed_dist / (spread * 2.f), 0.f, 1.f);
+			dst[out_x]             = static_cast<uint8_t>(value * 255.f + 0.5f);
+		}
+	}
+}
 
 void font::clear_output_data()
 {
 	font_size = 0.f;
 	glyphs.clear();
-	index_advance_x.clear();
-	index_lookup.clear();
-	index_glyph_y.clear();
+	outline_glyphs.clear();
+	reset_lookup_tables();
 	fallback_glyph        = nullptr;
 	fallback_advance_x    = 0.f;
 	config_data_count     = 0;
@@ -345,61 +505,103 @@ void font::clear_output_data()
 	ascent                = descent = 0.f;
 	dirty_lookup_tables   = true;
 	metrics_total_surface = 0;
+	cache                 = nullptr;
+	retired               = false;
 }
 
 void font::build_lookup_table()
 {
-	auto max_codepoint = 0;
-	for (const auto &glyph : glyphs)
-		max_codepoint = std::max(max_codepoint, static_cast<int32_t>(glyph.codepoint));
-
-	assert(glyphs.size() < 0xFFFF);
-	index_advance_x.clear();
-	index_lookup.clear();
+	assert(glyphs.size() < glyph_cache_base);
+	reset_lookup_tables();
 	dirty_lookup_tables = false;
-	grow_index(max_codepoint + 1);
 	for (auto i = 0u; i < glyphs.size(); i++)
 	{
-		const auto codepoint       = static_cast<int32_t>(glyphs[i].codepoint);
-		index_advance_x[codepoint] = glyphs[i].advance_x;
-		index_glyph_y[codepoint]   = glyphs[i].y1;
-		index_lookup[codepoint]    = i;
+		const auto codepoint             = glyphs[i].codepoint;
+		auto &page                       = lookup_page_mut(codepoint);
+		page.advance_x[codepoint & 0xFF] = glyphs[i].advance_x;
+		page.glyph[codepoint & 0xFF]     = static_cast<uint16_t>(i);
 	}
 
-	if (find_glyph(static_cast<font_wchar>(' ')))
+	if (find_glyph_no_fallback(static_cast<font_wchar>(' ')))
 	{
 		if (glyphs.back().codepoint != '\t')
 			glyphs.resize(glyphs.size() + 1);
 		auto &tab_glyph     = glyphs.back();
-		tab_glyph           = *find_glyph(static_cast<font_wchar>(' '));
+		tab_glyph           = *find_glyph_no_fallback(static_cast<font_wchar>(' '));
 		tab_glyph.codepoint = '\t';
 		tab_glyph.advance_x *= 4;
-		index_advance_x[tab_glyph.codepoint] = tab_glyph.advance_x;
-		index_lookup[tab_glyph.codepoint]    = static_cast<font_wchar>(glyphs.size() - 1);
-		index_glyph_y[tab_glyph.codepoint]   = font_size;
+		auto &page                          = lookup_page_mut(tab_glyph.codepoint);
+		page.advance_x[tab_glyph.codepoint] = tab_glyph.advance_x;
+		page.glyph[tab_glyph.codepoint]     = static_cast<uint16_t>(glyphs.size() - 1);
 	}
 
+	if (!outline_glyphs.empty())
+		outline_glyphs.resize(glyphs.size());
+
 	fallback_glyph     = find_glyph_no_fallback(fallback_char);
 	fallback_advance_x = fallback_glyph ? fallback_glyph->advance_x : 0.f;
-	for (auto i = 0; i < max_codepoint + 1; i++)
-		if (index_advance_x[i] < 0.f)
-			index_advance_x[i] = fallback_advance_x;
+
+	// With a glyph cache, codepoints above ascii inside the ranges stay unloaded (negative advance) until first use
+	if (cache)
+	{
+		for (auto in_range = config_data->glyph_ranges; in_range[0] && in_range[1]; in_range += 2)
+		{
+			for (auto c = std::max<font_wchar>(in_range[0], 0x80); c <= std::min(in_range[1], font_max_codepoint); ++c)
+			{
+				auto &page = lookup_page_mut(c);
+				if (page.glyph[c & 0xFF] == glyph_missing)
+					page.glyph[c & 0xFF] = glyph_not_loaded;
+			}
+		}
+
+		for (auto i = 0u; i < cache->glyphs.size(); i++)
+			cache->glyphs[i] = {};
+		std::fill(cache->last_use.begin(), cache->last_use.end(), 0u);
+	}
+
+	// Includes the shared empty page, pages allocated later start as a copy of it
+	for (auto &page : lookup_page_data)
+	{
+		for (auto i = 0u; i < page.glyph.size(); i++)
+		{
+			if (page.glyph[i] == glyph_missing && page.advance_x[i] < 0.f)
+				page.advance_x[i] = fallback_advance_x;
+		}
+	}
 }
 
 void font::set_fallback_char(font_wchar c)
 {
 	fallback_char = c;
-	build_lookup_table();
+	if (const auto gen = std::atomic_load(&generation))
+		gen->set_fallback_char(c);
+	else
+		build_lookup_table();
+	bump_layout_generation(true);
 }
 
-void font::grow_index(const size_t new_size)
+void font::reset_lookup_tables()
 {
-	assert(index_advance_x.size() == index_lookup.size());
-	if (new_size <= index_lookup.size())
-		return;
-	index_advance_x.resize(new_size, -1.f);
-	index_lookup.resize(new_size, -1);
-	index_glyph_y.resize(new_size, -1);
+	glyph_lookup_page empty_page;
+	empty_page.advance_x.fill(-1.f);
+	empty_page.glyph.fill(glyph_missing);
+
+	lookup_pages.assign(1, 1);
+	lookup_page_data.assign(2, empty_page);
+}
+
+glyph_lookup_page& font::lookup_page_mut(const uint32_t c)
+{
+	assert(c <= font_max_codepoint && lookup_page_data.size() >= 2);
+	const auto page = c >> 8;
+	if (page >= lookup_pages.size())
+		lookup_pages.resize(page + 1, 0);
+	if (lookup_pages[page] == 0)
+	{
+		lookup_pages[page] = static_cast<uint16_t>(lookup_page_data.size());
+		lookup_page_data.push_back(lookup_page_data[0]);
+	}
+	return lookup_page_data[lookup_pages[page]];
 }
 
 void font::add_glyph(const font_wchar c,
@@ -430,47 +632,264 @@ void font::add_glyph(const font_wchar c,
 		glyph.advance_x = std::roundf(glyph.advance_x);
 
 	dirty_lookup_tables   = true;
-	metrics_total_surface = static_cast<int32_t>((glyph.u1 - glyph.u0) * container_atlas->tex_width + 1.99f) *
+	metrics_total_surface += static_cast<int32_t>((glyph.u1 - glyph.u0) * container_atlas->tex_width + 1.99f) *
 			static_cast<int32_t>((glyph.v1 - glyph.v0) * container_atlas->tex_height + 1.99f);
 }
 
-void font::add_remap_char(const font_wchar dst, const font_wchar src, const bool overwrite_dst)
+void font::add_outline_glyph(const float x0,
+                             const float y0,
+                             const float x1,
+                             const float y1,
+                             const float u0,
+                             const float v0,
+                             const float u1,
+                             const float v1)
 {
-	const auto index_size = index_lookup.size();
-	assert(index_size > 0);
+	assert(!glyphs.empty());
+	outline_glyphs.resize(glyphs.size());
+	auto &outline     = outline_glyphs.back();
+	outline           = glyphs.back();
+	outline.x0        = x0;
+	outline.y0        = y0;
+	outline.x1        = x1;
+	outline.y1        = y1;
+	outline.u0        = u0;
+	outline.v0        = v0;
+	outline.u1        = u1;
+	outline.v1        = v1;
+}
 
-	if (dst < index_size && index_lookup[dst] == 0xFFFF && !overwrite_dst) //dst exists
-		return;
-	if (src >= index_size && dst >= index_size) //src & dst dont exist
+void font::add_remap_char(const font_wchar dst, const font_wchar src, const bool overwrite_dst)
+{
+	if (!overwrite_dst && lookup_page(dst).glyph[dst & 0xFF] != glyph_missing) //dst exists
 		return;
 
-	grow_index(dst + 1);
-	index_lookup[dst]    = (src < index_size) ? index_lookup[src] : -1;
-	index_advance_x[dst] = (src < index_size) ? index_advance_x[src] : 1.f;
+	// copy before lookup_page_mut, adding a page moves the others
+	const auto glyph   = lookup_page(src).glyph[src & 0xFF];
+	const auto advance = lookup_page(src).advance_x[src & 0xFF];
+	auto &page         = lookup_page_mut(dst);
+	page.glyph[dst & 0xFF]     = glyph;
+	page.advance_x[dst & 0xFF] = advance;
+}
+
+void font::publish_generation(std::shared_ptr<font> gen, const bool advances_changed)
+{
+	const auto replaces_own = gen != nullptr;
+	const auto previous     = std::atomic_exchange(&generation, std::move(gen));
+	if (previous)
+		previous->retired = true;
+	else if (replaces_own)
+		retired = true;
+	bump_layout_generation(advances_changed);
+}
+
+void font::bump_layout_generation(const bool advances_changed)
+{
+	static std::atomic<uint32_t> counter{0};
+	const auto generation = ++counter;
+	if (advances_changed)
+		advance_generation = generation;
+	layout_generation = generation;
+}
+
+bool font::touch_layout(const text_layout &layout) const
+{
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->touch_layout(layout);
+	if (layout.cached_glyphs.empty())
+		return true;
+	if (!cache)
+		return false;
+
+	// an evicted cell holds another codepoint now, c itself is in no cell or another one
+	std::lock_guard g(cache->mutex);
+	const auto frame = container_atlas->glyph_frame.load();
+	for (const auto &cached : layout.cached_glyphs)
+	{
+		if (cached.cell >= cache->glyphs.size() || cache->glyphs[cached.cell].codepoint != cached.codepoint)
+			return false;
+		cache->last_use[cached.cell] = frame;
+	}
+	return true;
 }
 
 const font_glyph* font::find_glyph(const font_wchar c) const
 {
-	if (c >= index_lookup.size())
-		return fallback_glyph;
-	const auto i = index_lookup[c];
-	if (i == 0xFFFF)
-		return fallback_glyph;
+	if (!cache || c <= 0x7F)
+	{
+		const auto i = lookup_page(c).glyph[c & 0xFF];
+		return i == glyph_missing ? fallback_glyph : &glyphs[i];
+	}
+
+	{
+		std::lock_guard g(cache->mutex);
+		const auto i = lookup_page(c).glyph[c & 0xFF];
+		if (i == glyph_missing)
+			return fallback_glyph;
+		if (i != glyph_not_loaded && i < glyph_cache_base)
+			return &glyphs[i];
+		if (i != glyph_not_loaded)
+		{
+			// pinned now, eviction leaves it alone until the second draw from here
+			const auto cell = i - glyph_cache_base;
+			cache->last_use[cell] = container_atlas->glyph_frame.load();
+			return &cache->glyphs[cell];
+		}
+	}
+
+	// loading only touches the cache, the lookup pages and the atlas pixels, guarded by tex_mutex and the cache lock
+	const auto glyph = const_cast<font*>(this)->cache_glyph(c);
+	return glyph ? glyph : fallback_glyph;
+}
+
+const font_glyph* font::find_glyph_no_fallback(const font_wchar c) const
+{
+	const auto i = lookup_page(c).glyph[c & 0xFF];
+	if (i == glyph_not_loaded || i == glyph_missing)
+		return nullptr;
+	if (i >= glyph_cache_base)
+		return &cache->glyphs[i - glyph_cache_base];
 	return &glyphs[i];
 }
 
-const font_glyph* font::find_glyph_no_fallback(font_wchar c) const
+const font_glyph* font::find_outline_glyph(const font_wchar c) const
+{
+	size_t i = lookup_glyph(c);
+	if (i == glyph_missing && fallback_glyph >= glyphs.data() && fallback_glyph < glyphs.data() + glyphs.size())
+		i = fallback_glyph - glyphs.data();
+	if (i >= outline_glyphs.size())
+		return nullptr;
+	return outline_glyphs[i].codepoint ? &outline_glyphs[i] : nullptr;
+}
+
+// Glyph placement shared by the atlas build and the glyph cache
+static void layout_glyph(const font_config &cfg,
+                         const float ascent,
+                         const glyph_info &glyph_info,
+                         float &out_x0,
+                         float &out_y0,
+                         float &out_advance_x)
+{
+	const auto font_off_x = cfg.glyph_offset.x;
+	const auto font_off_y = cfg.glyph_offset.y + static_cast<float>(static_cast<int>(ascent + 0.5f));
+
+	auto char_advance_x_org = glyph_info.advance_x;
+	auto char_advance_x_mod = std::clamp(char_advance_x_org, cfg.glyph_min_advance, cfg.glyph_max_advance);
+	auto char_off_x         = font_off_x;
+	if (char_advance_x_org != char_advance_x_mod)
+		char_off_x += cfg.pixel_snap_h
+			              ? (float)(int)((char_advance_x_mod - char_advance_x_org) * 0.5f)
+			              : (char_advance_x_mod - char_advance_x_org) * 0.5f;
+
+	out_x0        = glyph_info.offset_x + char_off_x;
+	out_y0        = glyph_info.offset_y + font_off_y;
+	out_advance_x = char_advance_x_mod;
+}
+
+const font_glyph* font::cache_glyph(const font_wchar c)
 {
-	if (c >= index_lookup.size())
+	assert(cache && container_atlas && config_data);
+	std::scoped_lock g(container_atlas->tex_mutex, cache->mutex);
+	if (retired)
+		return nullptr; // the texture has another layout by now, a running text call finishes with fallback glyphs
+
+	// Someone else might have loaded it while we waited, the page of c exists since it's in the ranges
+	auto &page = lookup_page_mut(c);
+	const auto frame = container_atlas->glyph_frame.load();
+	if (const auto i = page.glyph[c & 0xFF]; i != glyph_not_loaded)
+	{
+		if (i == glyph_missing)
+			return nullptr;
+		if (i < glyph_cache_base)
+			return &glyphs[i];
+		cache->last_use[i - glyph_cache_base] = frame;
+		return &cache->glyphs[i - glyph_cache_base];
+	}
+
+	FT_Glyph ft_glyph              = nullptr;
+	FT_BitmapGlyph ft_glyph_bitmap = nullptr;
+	glyph_info glyph_info;
+	if (!freetype_face || !container_atlas->tex_pixels_alpha_8
+		|| !calc_glyph_info(c, glyph_info, ft_glyph, ft_glyph_bitmap))
+	{
+		page.glyph[c & 0xFF]     = glyph_missing;
+		page.advance_x[c & 0xFF] = fallback_advance_x;
 		return nullptr;
-	const auto i = index_lookup[c];
-	if (i == 0xFFFF)
+	}
+
+	float x0, y0, advance_x;
+	layout_glyph(*config_data, ascent, glyph_info, x0, y0, advance_x);
+	advance_x += config_data->glyph_extra_spacing.x;
+	if (config_data->pixel_snap_h)
+		advance_x = std::roundf(advance_x);
+	page.advance_x[c & 0xFF] = advance_x;
+
+	// Unused cells first, then the least recently used one. Cells looked up since the draw before the last one may
+	// still be in a buffer that gets drawn, with all of them pinned c waits as fallback glyph for a later frame
+	auto cell = static_cast<uint32_t>(-1);
+	for (auto i = 0u; i < cache->glyphs.size(); i++)
+	{
+		if (!cache->glyphs[i].codepoint)
+		{
+			cell = i;
+			break;
+		}
+		if (frame - cache->last_use[i] < 2)
+			continue;
+		if (cell == static_cast<uint32_t>(-1) || cache->last_use[i] < cache->last_use[cell])
+			cell = i;
+	}
+	if (cell == static_cast<uint32_t>(-1))
+	{
+		FT_Done_Glyph(ft_glyph);
 		return nullptr;
-	return &glyphs[i];
+	}
+
+	auto &glyph = cache->glyphs[cell];
+	// advance stays valid, only the pixels are gone. Layouts using the cell notice in touch_layout
+	if (glyph.codepoint)
+		lookup_page_mut(glyph.codepoint).glyph[glyph.codepoint & 0xFF] = glyph_not_loaded;
+
+	const auto atlas  = container_atlas;
+	const auto cell_x = cache->origin_x + (cell % cache->cells_x) * cache->cell_size;
+	const auto cell_y = cache->origin_y + (cell / cache->cells_x) * cache->cell_size;
+	const auto max_size = cache->cell_size - atlas->tex_glyph_padding;
+	auto dst = atlas->tex_pixels_alpha_8 + cell_y * atlas->tex_width + cell_x;
+	for (auto y = 0u; y < cache->cell_size; y++)
+		memset(dst + y * atlas->tex_width, 0, cache->cell_size);
+	blit_glyph(ft_glyph_bitmap,
+	           dst,
+	           atlas->tex_width,
+	           cache->multiply_enabled ? cache->multiply_table : nullptr,
+	           max_size,
+	           max_size);
+	FT_Done_Glyph(ft_glyph);
+	atlas->mark_dirty(cell_x, cell_y, cache->cell_size, cache->cell_size);
+
+	const auto width  = std::min(glyph_info.width, static_cast<float>(max_size));
+	const auto height = std::min(glyph_info.height, static_cast<float>(max_size));
+
+	glyph.codepoint = c;
+	glyph.x0        = x0;
+	glyph.y0        = y0;
+	glyph.x1        = x0 + width;
+	glyph.y1        = y0 + height;
+	glyph.u0        = cell_x * atlas->tex_uv_scale.x;
+	glyph.v0        = cell_y * atlas->tex_uv_scale.y;
+	glyph.u1        = (cell_x + width) * atlas->tex_uv_scale.x;
+	glyph.v1        = (cell_y + height) * atlas->tex_uv_scale.y;
+	glyph.advance_x = advance_x;
+
+	page.glyph[c & 0xFF]  = static_cast<uint16_t>(glyph_cache_base + cell);
+	cache->last_use[cell] = frame;
+	return &glyph;
 }
 
 const char* font::calc_word_wrap_pos(float scale, const char *text, const char *text_end, float wrap_width) const
 {
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->calc_word_wrap_pos(scale, text, text_end, wrap_width);
+
 	//TODO: Blatant c&p
 	// Simple word-wrapping for English, not full-featured. Please submit failing cases!
 	// FIXME: Much possible improvements (don't cut things like "word !", "word!!!" but cut within "word,,,,", more sensible support for punctuations, support for Unicode punctuations, etc.)
@@ -499,6 +918,25 @@ const char* font::calc_word_wrap_pos(float scale, const char *text, const char *
 	auto s = text;
 	while (s < text_end)
 	{
+		// Runs of ascii word characters only grow the current word, so skip the decoding and separator checks
+		if (inside_word)
+		{
+			const auto run_end = text_word_end(s, text_end);
+			for (; s < run_end; s++)
+			{
+				word_width += char_advance(static_cast<uint8_t>(*s));
+				word_end = s + 1;
+				if (line_width + word_width >= wrap_width)
+				{
+					if (word_width < wrap_width)
+						s = prev_word_end ? prev_word_end : word_end;
+					return s;
+				}
+			}
+			if (s >= text_end)
+				break;
+		}
+
 		auto c = static_cast<uint32_t>(*s);
 		const char *next_s;
 		if (c < 0x80)
@@ -524,7 +962,7 @@ const char* font::calc_word_wrap_pos(float scale, const char *text, const char *
 			}
 		}
 
-		const float char_width = (c < index_advance_x.size() ? index_advance_x[c] : fallback_advance_x);
+		const float char_width = char_advance(c);
 		if (c == ' ' || c == '\t' || c == 0x3000)
 		{
 			if (inside_word)
@@ -576,6 +1014,9 @@ position font::calc_text_size(const float size,
                               const char *text_end,
                               const char **remaining) const
 {
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->calc_text_size(size, max_width, wrap_width, text_begin, text_end, remaining);
+
 	if (!text_end)
 		text_end = text_begin + strlen(text_begin); // FIXME-OPT: Need to avoid this.
 
@@ -633,6 +1074,22 @@ position font::calc_text_size(const float size,
 			}
 		}
 
+		// Printable ascii runs only need their advances summed
+		if (static_cast<uint8_t>(*s) >= 0x20 && static_cast<uint8_t>(*s) < 0x80)
+		{
+			const auto run_end = text_plain_ascii_end(s, word_wrap_eol ? word_wrap_eol : text_end);
+			for (; s < run_end; s++)
+			{
+				const auto char_width = char_advance(static_cast<uint8_t>(*s)) * scale;
+				if (line_width + char_width >= max_width)
+					break;
+				line_width += char_width;
+			}
+			if (s < run_end)
+				break;
+			continue;
+		}
+
 		// Decode and advance source
 		const auto prev_s = s;
 		auto c            = static_cast<uint32_t>(*s);
@@ -660,7 +1117,7 @@ position font::calc_text_size(const float size,
 				continue;
 		}
 
-		const auto char_width = (c < index_advance_x.size() ? index_advance_x[c] : fallback_advance_x) * scale;
+		const auto char_width = char_advance(c) * scale;
 		if (line_width + char_width >= max_width)
 		{
 			s = prev_s;
@@ -689,6 +1146,9 @@ rect font::calc_text_bounds(const float size,
                             const char *text_end,
                             const char **remaining) const
 {
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->calc_text_bounds(size, max_width, wrap_width, text_begin, text_end, remaining);
+
 	if (!text_end)
 		text_end = text_begin + strlen(text_begin); // FIXME-OPT: Need to avoid this.
 
@@ -703,6 +1163,25 @@ rect font::calc_text_bounds(const float size,
 	const auto word_wrap_enabled = (wrap_width > 0.0f);
 	const char *word_wrap_eol    = nullptr;
 
+	// False if c doesn't fit into max_width anymore
+	const auto add_glyph = [&](const uint32_t c)
+	{
+		const auto glyph_info = find_glyph(c);
+		const auto char_width = glyph_info->advance_x * scale;
+		if (line_width + char_width >= max_width)
+			return false;
+
+		if (first_char_of_line)
+		{
+			first_char_of_line = false;
+			line_width += glyph_info->x0 * scale;
+		}
+		line_width += char_width;
+		line_height = std::max(line_height, glyph_info->y1 * scale);
+		offset_y    = std::min(offset_y, glyph_info->y0 * scale);
+		return true;
+	};
+
 	auto s = text_begin;
 	while (s < text_end)
 	{
@@ -748,6 +1227,17 @@ rect font::calc_text_bounds(const float size,
 			}
 		}
 
+		// Printable ascii runs skip the decoding and the control character checks
+		if (static_cast<uint8_t>(*s) >= 0x20 && static_cast<uint8_t>(*s) < 0x80)
+		{
+			const auto run_end = text_plain_ascii_end(s, word_wrap_eol ? word_wrap_eol : text_end);
+			while (s < run_end && add_glyph(static_cast<uint8_t>(*s)))
+				s++;
+			if (s < run_end)
+				break;
+			continue;
+		}
+
 		// Decode and advance source
 		const auto prev_s = s;
 		auto c            = static_cast<uint32_t>(*s);
@@ -777,22 +1267,11 @@ rect font::calc_text_bounds(const float size,
 				continue;
 		}
 
-		const auto glyph_info = find_glyph(c);
-		const auto char_width = glyph_info->advance_x * scale;
-		if (line_width + char_width >= max_width)
+		if (!add_glyph(c))
 		{
 			s = prev_s;
 			break;
 		}
-
-		if (first_char_of_line)
-		{
-			first_char_of_line = false;
-			line_width += glyph_info->x0 * scale;
-		}
-		line_width += char_width;
-		line_height = std::max(line_height, glyph_info->y1 * scale);
-		offset_y    = std::min(offset_y, glyph_info->y0 * scale);
 	}
 
 	if (text_size.x < line_width)
@@ -813,6 +1292,10 @@ void font::render_char(draw_buffer *draw_buffer,
                        const pack_color col,
                        const font_wchar c) const
 {
+	// a generation keeps the default display_offset, the one users set is on this font
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->render_char(draw_buffer, size, pos + display_offset, col, c);
+
 	if (c == ' ' || c == '\t' || c == '\n' || c == '\r')
 		return;
 	if (const auto glyph = find_glyph(c))
@@ -833,17 +1316,41 @@ void font::render_text(draw_buffer *draw_buffer,
                        const float size,
                        position pos,
                        const pack_color col,
-                       const rect &clip_rect,
+                       const rect &screen_clip_rect,
                        const char *text_begin,
                        const char *text_end,
                        const float wrap_width,
-                       const bool cpu_fine_clip) const
+                       const bool fine_clip,
+                       const pack_color outline_col) const
 {
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->render_text(draw_buffer,
+		                        size,
+		                        pos + display_offset,
+		                        col,
+		                        screen_clip_rect,
+		                        text_begin,
+		                        text_end,
+		                        wrap_width,
+		                        fine_clip,
+		                        outline_col);
+
 	//TODO: more c&p
 	if (!text_end)
 		text_end = text_begin + strlen(text_begin);
 	// ImGui functions generally already provides a valid text_end, so this is merely to handle direct calls.
 
+	// Vertexes get the transform of the buffer when it's flushed, culling and fine clipping happen before that in local
+	// space. Fine clipping cuts along the local axes, which only match the screen ones without rotation
+	auto clip_rect     = screen_clip_rect;
+	auto cpu_fine_clip = fine_clip;
+	if (!draw_buffer->transform_stack.empty())
+	{
+		const auto &transform = draw_buffer->transform_stack.back();
+		clip_rect             = transform.inverse_bounds(screen_clip_rect);
+		cpu_fine_clip         = cpu_fine_clip && transform.m01 == 0.f && transform.m10 == 0.f;
+	}
+
 	// Align to be pixel perfect
 	pos.x  = static_cast<float>(static_cast<int>(pos.x + display_offset.x));
 	pos.y  = static_cast<float>(static_cast<int>(pos.y + display_offset.y));
@@ -876,7 +1383,7 @@ void font::render_text(draw_buffer *draw_buffer,
 		while (y_end < clip_rect.w && s_end < text_end)
 		{
 			s_end = reinterpret_cast<const char*>(memchr(s_end, '\n', text_end - s_end));
-			s     = s ? s + 1 : text_end;
+			s_end = s_end ? s_end + 1 : text_end;
 			y_end += line_height;
 		}
 		text_end = s_end;
@@ -884,34 +1391,134 @@ void font::render_text(draw_buffer *draw_buffer,
 	if (s == text_end)
 		return;
 
+	// Outlines go below every glyph of the string, not just their own one, so their indices fill the front of the
+	// reservation and the glyph indices its back half. The gap between both is closed once the count is known
+	const auto outlined = outline_col.a() != 0 && !outline_glyphs.empty();
+	const auto quads_per_char = outlined ? 2 : 1;
+
 	// Reserve vertices for remaining worse case (over-reserving is useful and easily amortized)
-	const auto vtx_count_max     = static_cast<int32_t>(text_end - s) * 4;
-	const auto idx_count_max     = static_cast<int32_t>(text_end - s) * 6;
+	const auto vtx_count_max     = static_cast<int32_t>(text_end - s) * 4 * quads_per_char;
+	const auto idx_count_max     = static_cast<int32_t>(text_end - s) * 6 * quads_per_char;
 	const auto idx_expected_size = draw_buffer->indices.size() + idx_count_max;
 	const auto vtx_expected_size = draw_buffer->vertices.size() + vtx_count_max;
 	draw_buffer->prim_reserve(idx_count_max, vtx_count_max);
 
-	auto vtx_write       = draw_buffer->vtx_write_ptr;
-	auto idx_write       = draw_buffer->idx_write_ptr;
-	auto vtx_current_idx = draw_buffer->cur_idx;
+	auto vtx_write        = draw_buffer->vtx_write_ptr;
+	auto idx_write        = draw_buffer->idx_write_ptr;
+	auto vtx_current_idx  = draw_buffer->cur_idx;
+	const auto idx_glyphs = outlined ? idx_write + (text_end - s) * 6 : idx_write;
+	auto idx_outline      = idx_write;
+	if (outlined)
+		idx_write = idx_glyphs;
 
-	while (s < text_end)
+	// Returns false if the quad got clipped away completely
+	const auto write_quad = [&](draw_buffer::draw_index *&idx_out, const font_glyph &glyph, const float x, const float y, const pack_color quad_col)
 	{
-		if (word_wrap_enabled)
+		// We don't do a second finer clipping test on the Y axis as we've already skipped anything before clip_rect.y and exit once we pass clip_rect.w
+		auto x1 = x + glyph.x0 * scale;
+		auto x2 = x + glyph.x1 * scale;
+		auto y1 = y + glyph.y0 * scale;
+		auto y2 = y + glyph.y1 * scale;
+		if (x1 > clip_rect.z || x2 < clip_rect.x)
+			return true;
+
+		auto u1 = glyph.u0;
+		auto v1 = glyph.v0;
+		auto u2 = glyph.u1;
+		auto v2 = glyph.v1;
+
+		// CPU side clipping used to fit text in their frame when the frame is too small. Only does clipping for axis aligned quads.
+		if (cpu_fine_clip)
 		{
-			// Calculate how far we can render. Requires two passes on the string data but keeps the code simple and not intrusive for what's essentially an uncommon feature.
-			if (!word_wrap_eol)
+			if (x1 < clip_rect.x)
 			{
-				word_wrap_eol = calc_word_wrap_pos(scale, s, text_end, wrap_width - (x - pos.x));
-				if (word_wrap_eol == s)
-					// Wrap_width is too small to fit anything. Force displaying 1 character to minimize the height discontinuity.
-					word_wrap_eol++;
-				// +1 may not be a character start point in UTF-8 but it's ok because we use s >= word_wrap_eol below
+				u1 = u1 + (1.0f - (x2 - clip_rect.x) / (x2 - x1)) * (u2 - u1);
+				x1 = clip_rect.x;
 			}
-
-			if (s >= word_wrap_eol)
+			if (y1 < clip_rect.y)
 			{
-				x = pos.x;
+				v1 = v1 + (1.0f - (y2 - clip_rect.y) / (y2 - y1)) * (v2 - v1);
+				y1 = clip_rect.y;
+			}
+			if (x2 > clip_rect.z)
+			{
+				u2 = u1 + ((clip_rect.z - x1) / (x2 - x1)) * (u2 - u1);
+				x2 = clip_rect.z;
+			}
+			if (y2 > clip_rect.w)
+			{
+				v2 = v1 + ((clip_rect.w - y1) / (y2 - y1)) * (v2 - v1);
+				y2 = clip_rect.w;
+			}
+			if (y1 >= y2)
+				return false;
+		}
+
+		// We are NOT calling PrimRectUV() here because non-inlined causes too much overhead in a debug builds. Inlined here:
+		idx_out[0]         = (draw_buffer::draw_index)(vtx_current_idx);
+		idx_out[1]         = (draw_buffer::draw_index)(vtx_current_idx + 1);
+		idx_out[2]         = (draw_buffer::draw_index)(vtx_current_idx + 2);
+		idx_out[3]         = (draw_buffer::draw_index)(vtx_current_idx);
+		idx_out[4]         = (draw_buffer::draw_index)(vtx_current_idx + 2);
+		idx_out[5]         = (draw_buffer::draw_index)(vtx_current_idx + 3);
+		vtx_write[0].pos.x = x1;
+		vtx_write[0].pos.y = y1;
+		vtx_write[0].col   = quad_col;
+		vtx_write[0].uv.x  = u1;
+		vtx_write[0].uv.y  = v1;
+		vtx_write[1].pos.x = x2;
+		vtx_write[1].pos.y = y1;
+		vtx_write[1].col   = quad_col;
+		vtx_write[1].uv.x  = u2;
+		vtx_write[1].uv.y  = v1;
+		vtx_write[2].pos.x = x2;
+		vtx_write[2].pos.y = y2;
+		vtx_write[2].col   = quad_col;
+		vtx_write[2].uv.x  = u2;
+		vtx_write[2].uv.y  = v2;
+		vtx_write[3].pos.x = x1;
+		vtx_write[3].pos.y = y2;
+		vtx_write[3].col   = quad_col;
+		vtx_write[3].uv.x  = u1;
+		vtx_write[3].uv.y  = v2;
+		vtx_write += 4;
+		vtx_current_idx += 4;
+		idx_out += 6;
+		return true;
+	};
+
+	const auto render_glyph = [&](const font_wchar c)
+	{
+		const auto glyph = find_glyph(c);
+		if (!glyph)
+			return;
+
+		// Arbitrarily assume that both space and tabs are empty glyphs as an optimization
+		if (c != ' ' && c != '\t' && write_quad(idx_write, *glyph, x, y, col) && outlined)
+		{
+			if (const auto outline = find_outline_glyph(c))
+				write_quad(idx_outline, *outline, x, y, outline_col);
+		}
+		x += glyph->advance_x * scale;
+	};
+
+	while (s < text_end)
+	{
+		if (word_wrap_enabled)
+		{
+			// Calculate how far we can render. Requires two passes on the string data but keeps the code simple and not intrusive for what's essentially an uncommon feature.
+			if (!word_wrap_eol)
+			{
+				word_wrap_eol = calc_word_wrap_pos(scale, s, text_end, wrap_width - (x - pos.x));
+				if (word_wrap_eol == s)
+					// Wrap_width is too small to fit anything. Force displaying 1 character to minimize the height discontinuity.
+					word_wrap_eol++;
+				// +1 may not be a character start point in UTF-8 but it's ok because we use s >= word_wrap_eol below
+			}
+
+			if (s >= word_wrap_eol)
+			{
+				x = pos.x;
 				y += line_height;
 				word_wrap_eol = nullptr;
 
@@ -937,6 +1544,15 @@ void font::render_text(draw_buffer *draw_buffer,
 			}
 		}
 
+		// Printable ascii runs skip the decoding and the control character checks
+		if (static_cast<uint8_t>(*s) >= 0x20 && static_cast<uint8_t>(*s) < 0x80)
+		{
+			const auto run_end = text_plain_ascii_end(s, word_wrap_eol ? word_wrap_eol : text_end);
+			for (; s < run_end; s++)
+				render_glyph(static_cast<uint8_t>(*s));
+			continue;
+		}
+
 		// Decode and advance source
 		auto c = static_cast<uint32_t>(*s);
 		if (c < 0x80)
@@ -964,105 +1580,174 @@ void font::render_text(draw_buffer *draw_buffer,
 				continue;
 		}
 
-		auto char_width = 0.0f;
-		if (const auto glyph = find_glyph(static_cast<font_wchar>(c)))
+		render_glyph(static_cast<font_wchar>(c));
+	}
+
+	if (outlined)
+	{
+		const auto glyph_idx_count = idx_write - idx_glyphs;
+		memmove(idx_outline, idx_glyphs, glyph_idx_count * sizeof(draw_buffer::draw_index));
+		idx_write = idx_outline + glyph_idx_count;
+	}
+
+	// Give back unused vertices
+	draw_buffer->vertices.resize(static_cast<int32_t>(vtx_write - draw_buffer->vertices.data()));
+	draw_buffer->indices.resize(static_cast<int32_t>(idx_write - draw_buffer->indices.data()));
+	draw_buffer->cmds[draw_buffer->cmds.size() - 1].elem_count -= (idx_expected_size - draw_buffer->indices.size());
+	draw_buffer->cmds[draw_buffer->cmds.size() - 1].vtx_count -= (vtx_expected_size - draw_buffer->vertices.size());
+	draw_buffer->vtx_write_ptr = vtx_write;
+	draw_buffer->idx_write_ptr = idx_write;
+	draw_buffer->cur_idx       = static_cast<uint32_t>(draw_buffer->vertices.size());
+}
+
+void font::layout_text(const float size,
+                       const float wrap_width,
+                       const char *text_begin,
+                       const char *text_end,
+                       text_layout &out) const
+{
+	if (const auto gen = std::atomic_load(&generation))
+		return gen->layout_text(size, wrap_width, text_begin, text_end, out);
+
+	if (!text_end)
+		text_end = text_begin + strlen(text_begin);
+
+	out.quads.clear();
+	out.lines.clear();
+	out.cached_glyphs.clear();
+	out.size = position{0.f, 0.f};
+
+	const auto scale             = size / font_size;
+	const auto line_height       = font_size * scale;
+	const auto word_wrap_enabled = (wrap_width > 0.0f);
+	const char *word_wrap_eol    = nullptr;
+
+	// Matches draw_buffer::text_size, which cancels the spacing baked into the last advance
+	const auto visible_width = [](const float width)
+	{
+		return std::roundf((width > 0.f ? width - 1.f : width) + 0.95f);
+	};
+
+	auto x          = 0.f;
+	auto y          = 0.f;
+	auto line_begin = 0u;
+	const auto end_line = [&]()
+	{
+		out.lines.push_back({line_begin, static_cast<uint32_t>(out.quads.size()), visible_width(x)});
+		out.size.x = std::max(out.size.x, x);
+		line_begin = static_cast<uint32_t>(out.quads.size());
+		x          = 0.f;
+		y += line_height;
+	};
+
+	const auto add_glyph = [&](const uint32_t c)
+	{
+		const auto glyph = find_glyph(c);
+		if (!glyph)
+			return;
+
+		// cells are pinned by the lookup, so reading the codepoint back is safe
+		if (cache && glyph >= cache->glyphs.data() && glyph < cache->glyphs.data() + cache->glyphs.size())
+		{
+			const auto cell = static_cast<uint32_t>(glyph - cache->glyphs.data());
+			if (out.cached_glyphs.empty() || out.cached_glyphs.back().cell != cell)
+				out.cached_glyphs.push_back({cell, glyph->codepoint});
+		}
+		else if (cache && glyph == fallback_glyph && c != fallback_char && lookup_glyph(c) != glyph_missing)
+		{
+			out.cached_glyphs.push_back({text_layout::cached_glyph::no_cell, c});
+		}
+
+		if (c != ' ' && c != '\t')
 		{
-			char_width = glyph->advance_x * scale;
+			out.quads.push_back({position{x + glyph->x0 * scale, y + glyph->y0 * scale},
+			                     position{x + glyph->x1 * scale, y + glyph->y1 * scale},
+			                     position{glyph->u0, glyph->v0},
+			                     position{glyph->u1, glyph->v1}});
+		}
+		x += glyph->advance_x * scale;
+	};
+
+	// Same walk as render_text without the clipping
+	auto s = text_begin;
+	while (s < text_end)
+	{
+		if (word_wrap_enabled)
+		{
+			if (!word_wrap_eol)
+			{
+				word_wrap_eol = calc_word_wrap_pos(scale, s, text_end, wrap_width - x);
+				if (word_wrap_eol == s)
+					word_wrap_eol++;
+			}
 
-			// Arbitrarily assume that both space and tabs are empty glyphs as an optimization
-			if (c != ' ' && c != '\t')
+			if (s >= word_wrap_eol)
 			{
-				// We don't do a second finer clipping test on the Y axis as we've already skipped anything before clip_rect.y and exit once we pass clip_rect.w
-				float x1 = x + glyph->x0 * scale;
-				float x2 = x + glyph->x1 * scale;
-				float y1 = y + glyph->y0 * scale;
-				float y2 = y + glyph->y1 * scale;
-				if (x1 <= clip_rect.z && x2 >= clip_rect.x)
+				end_line();
+				word_wrap_eol = nullptr;
+
+				// Wrapping skips upcoming blanks
+				while (s < text_end)
 				{
-					// Render a character
-					float u1 = glyph->u0;
-					float v1 = glyph->v0;
-					float u2 = glyph->u1;
-					float v2 = glyph->v1;
-
-					// CPU side clipping used to fit text in their frame when the frame is too small. Only does clipping for axis aligned quads.
-					if (cpu_fine_clip)
+					const char c = *s;
+					if (c == ' ' || c == '\t' || c == 0x3000)
 					{
-						if (x1 < clip_rect.x)
-						{
-							u1 = u1 + (1.0f - (x2 - clip_rect.x) / (x2 - x1)) * (u2 - u1);
-							x1 = clip_rect.x;
-						}
-						if (y1 < clip_rect.y)
-						{
-							v1 = v1 + (1.0f - (y2 - clip_rect.y) / (y2 - y1)) * (v2 - v1);
-							y1 = clip_rect.y;
-						}
-						if (x2 > clip_rect.z)
-						{
-							u2 = u1 + ((clip_rect.z - x1) / (x2 - x1)) * (u2 - u1);
-							x2 = clip_rect.z;
-						}
-						if (y2 > clip_rect.w)
-						{
-							v2 = v1 + ((clip_rect.w - y1) / (y2 - y1)) * (v2 - v1);
-							y2 = clip_rect.w;
-						}
-						if (y1 >= y2)
-						{
-							x += char_width;
-							continue;
-						}
+						s++;
 					}
-
-					//TODO: Reformat to proper stuff
-					// We are NOT calling PrimRectUV() here because non-inlined causes too much overhead in a debug builds. Inlined here:
+					else if (c == '\n')
+					{
+						s++;
+						break;
+					}
+					else
 					{
-						idx_write[0]       = (draw_buffer::draw_index)(vtx_current_idx);
-						idx_write[1]       = (draw_buffer::draw_index)(vtx_current_idx + 1);
-						idx_write[2]       = (draw_buffer::draw_index)(vtx_current_idx + 2);
-						idx_write[3]       = (draw_buffer::draw_index)(vtx_current_idx);
-						idx_write[4]       = (draw_buffer::draw_index)(vtx_current_idx + 2);
-						idx_write[5]       = (draw_buffer::draw_index)(vtx_current_idx + 3);
-						vtx_write[0].pos.x = x1;
-						vtx_write[0].pos.y = y1;
-						vtx_write[0].col   = col;
-						vtx_write[0].uv.x  = u1;
-						vtx_write[0].uv.y  = v1;
-						vtx_write[1].pos.x = x2;
-						vtx_write[1].pos.y = y1;
-						vtx_write[1].col   = col;
-						vtx_write[1].uv.x  = u2;
-						vtx_write[1].uv.y  = v1;
-						vtx_write[2].pos.x = x2;
-						vtx_write[2].pos.y = y2;
-						vtx_write[2].col   = col;
-						vtx_write[2].uv.x  = u2;
-						vtx_write[2].uv.y  = v2;
-						vtx_write[3].pos.x = x1;
-						vtx_write[3].pos.y = y2;
-						vtx_write[3].col   = col;
-						vtx_write[3].uv.x  = u1;
-						vtx_write[3].uv.y  = v2;
-						vtx_write += 4;
-						vtx_current_idx += 4;
-						idx_write += 6;
+						break;
 					}
 				}
+				continue;
+			}
+		}
+
+		// Printable ascii runs skip the decoding and the control character checks
+		if (static_cast<uint8_t>(*s) >= 0x20 && static_cast<uint8_t>(*s) < 0x80)
+		{
+			const auto run_end = text_plain_ascii_end(s, word_wrap_eol ? word_wrap_eol : text_end);
+			for (; s < run_end; s++)
+				add_glyph(static_cast<uint8_t>(*s));
+			continue;
+		}
+
+		auto c = static_cast<uint32_t>(*s);
+		if (c < 0x80)
+		{
+			s += 1;
+		}
+		else
+		{
+			s += text_char_from_utf8(&c, s, text_end);
+			if (c == 0) // Malformed UTF-8?
+				break;
+		}
+
+		if (c < 32)
+		{
+			if (c == '\n')
+			{
+				end_line();
+				continue;
 			}
+			if (c == '\r')
+				continue;
 		}
 
-		x += char_width;
+		add_glyph(c);
 	}
 
-	// Give back unused vertices
-	draw_buffer->vertices.resize(static_cast<int32_t>(vtx_write - draw_buffer->vertices.data()));
-	draw_buffer->indices.resize(static_cast<int32_t>(idx_write - draw_buffer->indices.data()));
-	draw_buffer->cmds[draw_buffer->cmds.size() - 1].elem_count -= (idx_expected_size - draw_buffer->indices.size());
-	draw_buffer->cmds[draw_buffer->cmds.size() - 1].vtx_count -= (vtx_expected_size - draw_buffer->vertices.size());
-	draw_buffer->vtx_write_ptr = vtx_write;
-	draw_buffer->idx_write_ptr = idx_write;
-	draw_buffer->cur_idx       = static_cast<uint32_t>(draw_buffer->vertices.size());
+	if (x > 0.f || out.lines.empty())
+		end_line();
+
+	out.size.x = visible_width(out.size.x);
+	out.size.y = static_cast<float>(out.lines.size()) * line_height;
 }
 
 
@@ -1106,12 +1791,29 @@ font_atlas::font_atlas()
 font_atlas::~font_atlas()
 {
 	assert(!locked);
+
+	// The background build borrows the font data, it has to finish first
+	if (async_build.valid())
+		async_build.get();
+	for (auto *pending_fonts : {&async_queue, &async_building})
+	{
+		for (auto &pending : *pending_fonts)
+		{
+			if (pending.cfg.owned_by_atlas)
+				free(pending.cfg.font_data);
+			pending.promise.set_value(nullptr);
+		}
+		pending_fonts->clear();
+	}
 	clear();
 }
 
 void font_atlas::clear_input_data()
 {
 	assert(!locked);
+	if (async_build.valid())
+		async_build.wait();
+	config_serial++;
 
 	for (auto &data : config_data)
 	{
@@ -1234,21 +1936,27 @@ font* font_atlas::add_font(const font_config *font_cfg)
 	else
 		assert(!fonts.empty());
 
+	// glyph caches read config_data while rasterizing, so it may only move under tex_mutex
+	std::lock_guard g(tex_mutex);
+	config_serial++;
 	config_data.emplace_back(*font_cfg);
 	auto &new_font_cfg = config_data.back();
 
 	if (!new_font_cfg.dst_font)
 		new_font_cfg.dst_font = fonts.back();
-	if (!new_font_cfg.owned_by_atlas)
+	if (!new_font_cfg.owned_by_atlas && !new_font_cfg.file)
 	{
 		new_font_cfg.font_data      = malloc(new_font_cfg.font_data_size);
 		new_font_cfg.owned_by_atlas = true;
 		memcpy(new_font_cfg.font_data, font_cfg->font_data, new_font_cfg.font_data_size);
 	}
+	relink_config_data();
 
-	std::lock_guard g(tex_mutex);
-	clear_tex_data(false);
-	build();
+	if (!build_incremental(static_cast<uint32_t>(config_data.size() - 1)))
+	{
+		clear_tex_data(false);
+		build();
+	}
 	return new_font_cfg.dst_font.get();
 }
 
@@ -1261,22 +1969,24 @@ font* font_atlas::add_font_from_ttf(const char *file_name,
 {
 	//assert(!locked);
 
-	size_t data_size = 0u;
-	auto data        = load_file_to_mem(file_name, &data_size);
-	if (!data)
+	// Mapped once per path, more sizes of the same file share the mapping
+	auto file = font_file::open(file_name);
+	if (!file)
 	{
 		assert(0);
 		return nullptr;
 	}
 
-	auto font_cfg = font_cfg_template ? *font_cfg_template : font_config();
+	auto font_cfg           = font_cfg_template ? *font_cfg_template : font_config();
+	font_cfg.file           = file;
+	font_cfg.owned_by_atlas = false;
 	if (font_cfg.name[0] == '\0')
 	{
 		const char *p;
 		for (p = file_name + strlen(file_name); p > file_name && p[-1] != '/' && p[-1] != '\\'; p--) { }
 		format_string(font_cfg.name.data(), font_cfg.name.size(), "%s, %.0fpx", p, size_pixels);
 	}
-	return add_font_from_ttf_mem(data, data_size, size_pixels, &font_cfg, glyph_ranges);
+	return add_font_from_ttf_mem(const_cast<uint8_t*>(file->data), file->size, size_pixels, &font_cfg, glyph_ranges);
 }
 
 font* font_atlas::add_font_from_ttf_mem(void *font_data,
@@ -1298,16 +2008,83 @@ font* font_atlas::add_font_from_ttf_mem(void *font_data,
 	return add_font(&font_cfg);
 }
 
+std::future<font*> font_atlas::add_font_async(const font_config *font_cfg)
+{
+	assert(font_cfg->font_data != nullptr && font_cfg->font_data_size > 0);
+	assert(font_cfg->size_pixels > 0.f);
+	// Merged inputs need the font they go into, it may still be waiting in the queue itself
+	assert(!font_cfg->merge_mode || font_cfg->dst_font);
+
+	auto pending = async_font{};
+	pending.cfg  = *font_cfg;
+	if (!pending.cfg.merge_mode)
+		pending.cfg.dst_font = std::make_shared<font>();
+	if (!pending.cfg.owned_by_atlas && !pending.cfg.file)
+	{
+		pending.cfg.font_data      = malloc(pending.cfg.font_data_size);
+		pending.cfg.owned_by_atlas = true;
+		memcpy(pending.cfg.font_data, font_cfg->font_data, pending.cfg.font_data_size);
+	}
+
+	auto result = pending.promise.get_future();
+	std::lock_guard g(tex_mutex);
+	async_queue.push_back(std::move(pending));
+	start_async_build();
+	return result;
+}
+
+std::future<font*> font_atlas::add_font_from_ttf_async(const char *file_name,
+                                                       const float size_pixels,
+                                                       const font_config *font_cfg_template,
+                                                       const font_wchar *glyph_ranges)
+{
+	// Mapping is cheap next to rasterizing, only the build moves to the background
+	auto file = font_file::open(file_name);
+	if (!file)
+	{
+		assert(0);
+		std::promise<font*> failed;
+		failed.set_value(nullptr);
+		return failed.get_future();
+	}
+
+	auto font_cfg = font_cfg_template ? *font_cfg_template : font_config();
+	assert(font_cfg.font_data == nullptr);
+	font_cfg.file           = file;
+	font_cfg.owned_by_atlas = false;
+	font_cfg.font_data      = const_cast<uint8_t*>(file->data);
+	font_cfg.font_data_size = file->size;
+	font_cfg.size_pixels    = size_pixels;
+	if (glyph_ranges)
+		font_cfg.glyph_ranges = glyph_ranges;
+	if (font_cfg.name[0] == '\0')
+	{
+		const char *p;
+		for (p = file_name + strlen(file_name); p > file_name && p[-1] != '/' && p[-1] != '\\'; p--) { }
+		format_string(font_cfg.name.data(), font_cfg.name.size(), "%s, %.0fpx", p, size_pixels);
+	}
+	return add_font_async(&font_cfg);
+}
+
 void font_atlas::remove_font(const font *font_ptr)
 {
 	//assert( !locked );
 
+	std::lock_guard g(tex_mutex);
+	// The background build may still read the data freed below
+	if (async_build.valid())
+		async_build.wait();
+	config_serial++;
 	config_data.erase(
 		std::remove_if(config_data.begin(),
 		               config_data.end(),
-		               [&](const font_config &cfg) -> bool
+		               [&](font_config &cfg) -> bool
 		               {
-			               return (cfg.dst_font.get() == font_ptr);
+			               if (cfg.dst_font.get() != font_ptr)
+				               return false;
+			               if (cfg.font_data && cfg.owned_by_atlas)
+				               free(cfg.font_data);
+			               return true;
 		               }),
 		config_data.end());
 
@@ -1316,12 +2093,25 @@ void font_atlas::remove_font(const font *font_ptr)
 		               fonts.end(),
 		               [&](const std::shared_ptr<font> &ptr) -> bool
 		               {
-			               return (ptr.get() == font_ptr);
+			               if (ptr.get() != font_ptr)
+				               return false;
+			               // its generation may be kept alive by the others, it must not load from the freed data
+			               ptr->publish_generation(nullptr);
+			               return true;
 		               }),
 		fonts.end());
-
-	std::lock_guard g(tex_mutex);
-	build();
+	relink_config_data();
+
+	// The removed glyphs just become unused space until the next full build() compacts the atlas.
+	// Custom rect glyphs belong to specific fonts, so those still need a full build
+	const auto had_custom_rects = std::any_of(custom_rects.begin(),
+	                                          custom_rects.end(),
+	                                          [&](const custom_rect &rect)
+	                                          {
+		                                          return rect.font == font_ptr;
+	                                          });
+	if (!config_data.empty() && (!tex_pixels_alpha_8 || had_custom_rects))
+		build();
 }
 
 
@@ -1360,6 +2150,44 @@ uint32_t font_atlas::add_custom_rect_glyph(font *font,
 	return custom_rects.size() - 1;
 }
 
+float font_atlas::utilization() const
+{
+	if (!tex_width || !tex_height)
+		return 0.f;
+
+	uint64_t used = 0;
+	for (const auto &font : fonts)
+	{
+		used += font->metrics_total_surface;
+		if (font->cache)
+			used += static_cast<uint64_t>(font->cache->glyphs.size()) * font->cache->cell_size * font->cache->cell_size;
+	}
+	for (const auto &rect : custom_rects)
+	{
+		if (rect.font == nullptr && rect.is_packed())
+			used += static_cast<uint64_t>(rect.width) * rect.height;
+	}
+
+	return static_cast<float>(static_cast<double>(used) / (static_cast<double>(tex_width) * tex_height));
+}
+
+void font_atlas::mark_dirty(const uint32_t x, const uint32_t y, const uint32_t w, const uint32_t h)
+{
+	assert(x + w <= tex_width && y + h <= tex_height);
+	if (tex_pixels_rgba_32)
+	{
+		for (auto row = y; row < y + h; row++)
+		{
+			const auto src = tex_pixels_alpha_8 + row * tex_width + x;
+			const auto dst = tex_pixels_rgba_32 + row * tex_width + x;
+			for (auto i = 0u; i < w; i++)
+				dst[i] = pack_color{color{255, 255, 255, src[i]}}.as_argb();
+		}
+	}
+
+	dirty_rects.push_back({x, y, w, h});
+}
+
 void font_atlas::calc_custom_rect_uv(const custom_rect *rect, position *out_uv_min, position *out_uv_max)
 {
 	assert(tex_width > 0 && tex_height > 0);
@@ -1369,10 +2197,186 @@ void font_atlas::calc_custom_rect_uv(const custom_rect *rect, position *out_uv_m
 }
 
 void font_atlas_build_register_default_custom_rects(font_atlas *atlas);
-void font_atlas_build_pack_custom_rects(font_atlas *atlas, stbrp_context *pack_context);
+void font_atlas_build_pack_rects(font_atlas *atlas, std::vector<stbrp_rect> &rects);
 void font_atlas_build_setup_font(font_atlas *atlas, font *font, font_config *font_config, float ascent, float descent);
 void font_atlas_build_multiply_calc_lookup_table(unsigned char out_table[ 256 ], float in_brighten_factor);
 void font_atlas_build_finish(font_atlas *atlas);
+void font_atlas_build_render_default_tex_data(font_atlas *atlas);
+void font_atlas_build_glyph_cache_layout(const font_atlas *atlas, const font_config &cfg, const font_info &info, uint32_t &cell_size, uint32_t &cells_x, uint32_t &cells_y);
+void font_atlas_build_setup_glyph_cache(font_atlas *atlas, font *font, const stbrp_rect &region, const unsigned char *multiply_table);
+uint64_t font_atlas_cache_key(const font_atlas *atlas, uint32_t extra_flags);
+bool font_atlas_cache_load(font_atlas *atlas, uint64_t key, uint32_t extra_flags);
+void font_atlas_cache_save(const font_atlas *atlas, uint64_t key);
+
+namespace
+{
+	// A rasterized glyph waiting to be packed and blitted into the atlas
+	struct build_glyph
+	{
+		uint32_t codepoint;
+		glyph_info info;
+		FT_Glyph ft_glyph;
+		FT_BitmapGlyph ft_bitmap; // points into ft_glyph
+		uint32_t rect_idx;        // into the batched pack rects, -1 if dropped
+
+		// Stroked copy for OUTLINE fonts, outline_ft_glyph is null without one
+		glyph_info outline_info;
+		FT_Glyph outline_ft_glyph;
+		FT_BitmapGlyph outline_ft_bitmap;
+		uint32_t outline_rect_idx;
+	};
+
+	struct build_input
+	{
+		std::vector<build_glyph> glyphs;
+		unsigned char multiply_table[ 256 ];
+		bool multiply_enabled;
+		bool init_ok;
+	};
+
+	// All fonts share one FT_Library, creating and destroying faces is serialized by freetype_mutex. Every input has its own
+	// face, and loading and rendering glyphs on different faces of one library is safe, so inputs can run in parallel
+	template<typename Fn>
+	void for_each_input_parallel(const size_t count, Fn &&fn)
+	{
+		std::vector<std::future<void>> tasks;
+		tasks.reserve(count);
+		for (auto i = 0u; i < count; i++)
+			tasks.emplace_back(std::async(std::launch::async, fn, i));
+		for (auto &task : tasks)
+			task.get();
+	}
+}
+
+void font_atlas_build_rasterize_input(font_atlas *atlas, const uint32_t input_i, const uint32_t extra_flags, build_input &input)
+{
+	const auto &cfg = atlas->config_data[input_i];
+	auto &font_face = atlas->fonts[input_i];
+	input.init_ok   = font_face->init(cfg, extra_flags);
+	if (!input.init_ok)
+		return;
+
+	// dynamic fonts only rasterize ascii up front, the rest goes through their glyph cache
+	const auto dynamic = cfg.dynamic_glyphs && !cfg.merge_mode;
+	for (auto in_range = cfg.glyph_ranges; in_range[0] && in_range[1]; in_range += 2)
+	{
+		for (uint32_t codepoint = in_range[0]; codepoint <= in_range[1]; ++codepoint)
+		{
+			if (dynamic && codepoint > 0x7F)
+				break;
+
+			build_glyph glyph      = {};
+			glyph.codepoint        = codepoint;
+			glyph.rect_idx         = static_cast<uint32_t>(-1);
+			glyph.outline_rect_idx = static_cast<uint32_t>(-1);
+			if (!font_face->calc_glyph_info(codepoint, glyph.info, glyph.ft_glyph, glyph.ft_bitmap))
+				continue;
+
+			if (font_face->freetype_stroker && glyph.info.width > 0.f
+				&& !font_face->calc_glyph_info(codepoint, glyph.outline_info, glyph.outline_ft_glyph, glyph.outline_ft_bitmap, true))
+				glyph.outline_ft_glyph = nullptr;
+			input.glyphs.push_back(glyph);
+		}
+	}
+
+	input.multiply_enabled = (cfg.rasterizer_multiply != 1.0f);
+	if (input.multiply_enabled)
+		font_atlas_build_multiply_calc_lookup_table(input.multiply_table, cfg.rasterizer_multiply);
+}
+
+void font_atlas_build_add_glyph_rects(build_glyph &glyph, std::vector<stbrp_rect> &pack_rects)
+{
+	stbrp_rect rect = {};
+	rect.w          = static_cast<stbrp_coord>(glyph.info.width + 1.f); // Account for texture filtering
+	rect.h          = static_cast<stbrp_coord>(glyph.info.height + 1.f);
+	glyph.rect_idx  = static_cast<uint32_t>(pack_rects.size());
+	pack_rects.push_back(rect);
+
+	if (!glyph.outline_ft_glyph)
+		return;
+
+	rect.w                 = static_cast<stbrp_coord>(glyph.outline_info.width + 1.f);
+	rect.h                 = static_cast<stbrp_coord>(glyph.outline_info.height + 1.f);
+	glyph.outline_rect_idx = static_cast<uint32_t>(pack_rects.size());
+	pack_rects.push_back(rect);
+}
+
+void font_atlas_build_register_input(font_atlas *atlas,
+                                     const uint32_t input_i,
+                                     const build_input &input,
+                                     const std::vector<stbrp_rect> &pack_rects)
+{
+	const auto &cfg = atlas->config_data[input_i];
+	auto dst_font   = cfg.dst_font;
+	for (const auto &glyph : input.glyphs)
+	{
+		if (glyph.rect_idx == static_cast<uint32_t>(-1) || !pack_rects[glyph.rect_idx].was_packed)
+			continue;
+
+		const auto &rect = pack_rects[glyph.rect_idx];
+		float x0, y0, advance_x;
+		layout_glyph(cfg, dst_font->ascent, glyph.info, x0, y0, advance_x);
+
+		// Register glyph
+		dst_font->add_glyph(glyph.codepoint,
+		                    x0,
+		                    y0,
+		                    x0 + glyph.info.width,
+		                    y0 + glyph.info.height,
+		                    rect.x / (float)atlas->tex_width,
+		                    rect.y / (float)atlas->tex_height,
+		                    (rect.x + glyph.info.width) / (float)atlas->tex_width,
+		                    (rect.y + glyph.info.height) / (float)atlas->tex_height,
+		                    advance_x);
+
+		if (glyph.outline_rect_idx == static_cast<uint32_t>(-1) || !pack_rects[glyph.outline_rect_idx].was_packed)
+			continue;
+
+		const auto &outline_rect = pack_rects[glyph.outline_rect_idx];
+		layout_glyph(cfg, dst_font->ascent, glyph.outline_info, x0, y0, advance_x);
+		dst_font->add_outline_glyph(x0,
+		                            y0,
+		                            x0 + glyph.outline_info.width,
+		                            y0 + glyph.outline_info.height,
+		                            outline_rect.x / (float)atlas->tex_width,
+		                            outline_rect.y / (float)atlas->tex_height,
+		                            (outline_rect.x + glyph.outline_info.width) / (float)atlas->tex_width,
+		                            (outline_rect.y + glyph.outline_info.height) / (float)atlas->tex_height);
+	}
+}
+
+// Also releases the rasterized glyphs
+void font_atlas_build_blit_input(font_atlas *atlas,
+                                 const uint32_t input_i,
+                                 build_input &input,
+                                 const std::vector<stbrp_rect> &pack_rects)
+{
+	for (auto &glyph : input.glyphs)
+	{
+		if (glyph.rect_idx != static_cast<uint32_t>(-1) && pack_rects[glyph.rect_idx].was_packed)
+		{
+			const auto &rect  = pack_rects[glyph.rect_idx];
+			uint8_t *blit_dst = atlas->tex_pixels_alpha_8 + rect.y * atlas->tex_width + rect.x;
+			atlas->fonts[input_i]->blit_glyph(glyph.ft_bitmap,
+			                                  blit_dst,
+			                                  atlas->tex_width,
+			                                  input.multiply_enabled ? input.multiply_table : nullptr);
+		}
+		if (glyph.outline_rect_idx != static_cast<uint32_t>(-1) && pack_rects[glyph.outline_rect_idx].was_packed)
+		{
+			const auto &rect  = pack_rects[glyph.outline_rect_idx];
+			uint8_t *blit_dst = atlas->tex_pixels_alpha_8 + rect.y * atlas->tex_width + rect.x;
+			atlas->fonts[input_i]->blit_glyph(glyph.outline_ft_bitmap,
+			                                  blit_dst,
+			                                  atlas->tex_width,
+			                                  input.multiply_enabled ? input.multiply_table : nullptr);
+		}
+		FT_Done_Glyph(glyph.ft_glyph);
+		if (glyph.outline_ft_glyph)
+			FT_Done_Glyph(glyph.outline_ft_glyph);
+	}
+	input.glyphs.clear();
+}
 
 bool font_atlas::build(const uint32_t extra_flags)
 {
@@ -1386,176 +2390,825 @@ bool font_atlas::build(const uint32_t extra_flags)
 	tex_uv_scale       = position{0.f, 0.f};
 	tex_uv_white_pixel = position{0.f, 0.f};
 	clear_tex_data(false);
+	pack_context       = nullptr;
 
-	//std::vector<font> fonts;
-	//fonts.resize( config_data.size( ) );
+	for (auto &cfg : config_data)
+	{
+		assert(cfg.dst_font && (!cfg.dst_font->loaded( ) || cfg.dst_font->container_atlas == this));
+		if (!cfg.glyph_ranges)
+			cfg.glyph_ranges = glyph_ranges_default();
+	}
 
-	auto max_glyph_size = position{1.f, 1.f};
+	const auto cache_key = cache_dir.empty() ? 0u : font_atlas_cache_key(this, extra_flags);
+	if (!cache_dir.empty() && font_atlas_cache_load(this, cache_key, extra_flags))
+	{
+		for (auto &font : fonts)
+			font->publish_generation(nullptr);
+		dirty_rects.clear();
+		has_updated = true;
+		return true;
+	}
 
-	auto total_glyphs_count = 0;
-	auto total_ranges_count = 0;
-	for (auto input_i = 0u; input_i < config_data.size(); input_i++)
+	// Init and rasterize every input on its own thread
+	std::vector<build_input> inputs(config_data.size());
+	for_each_input_parallel(config_data.size(),
+	                        [&](const uint32_t input_i)
+	                        {
+		                        font_atlas_build_rasterize_input(this, input_i, extra_flags, inputs[input_i]);
+	                        });
+
+	// Drops everything the inputs rasterized and the faces of the fonts that did init
+	const auto release_glyphs = [this, &inputs]()
 	{
-		auto &cfg       = config_data[input_i];
-		auto &font_face = fonts[input_i];
-		assert(cfg.dst_font && (!cfg.dst_font->loaded( ) || cfg.dst_font->container_atlas == this));
+		for (auto input_i = 0u; input_i < inputs.size(); input_i++)
+		{
+			for (auto &glyph : inputs[input_i].glyphs)
+			{
+				FT_Done_Glyph(glyph.ft_glyph);
+				if (glyph.outline_ft_glyph)
+					FT_Done_Glyph(glyph.outline_ft_glyph);
+			}
+			inputs[input_i].glyphs.clear();
+			fonts[input_i]->shutdown();
+		}
+	};
 
-		if (!font_face->init(cfg, extra_flags))
+	for (const auto &input : inputs)
+	{
+		if (!input.init_ok)
+		{
+			release_glyphs();
 			return false;
+		}
+	}
 
-		max_glyph_size.x = std::max(max_glyph_size.x, font_face->info.max_advance_width);
-		max_glyph_size.y = std::max(max_glyph_size.y, font_face->info.ascender - font_face->info.descender);
+	// Everything goes into one batch: custom rects, glyph cache regions, then the glyphs
+	std::vector<stbrp_rect> pack_rects;
+	for (const auto &user_rect : custom_rects)
+	{
+		stbrp_rect rect = {};
+		rect.w          = user_rect.width;
+		rect.h          = user_rect.height;
+		pack_rects.push_back(rect);
+	}
 
-		if (!cfg.glyph_ranges)
-			cfg.glyph_ranges = glyph_ranges_default();
-		for (auto in_range = cfg.glyph_ranges; in_range[0] && in_range[1]; in_range += 2, total_ranges_count++)
+	std::vector<uint32_t> cache_rect_idx(config_data.size(), static_cast<uint32_t>(-1));
+	for (auto input_i = 0u; input_i < config_data.size(); input_i++)
+	{
+		if (!config_data[input_i].dynamic_glyphs || config_data[input_i].merge_mode)
+			continue;
+
+		uint32_t cell_size, cells_x, cells_y;
+		font_atlas_build_glyph_cache_layout(this, config_data[input_i], fonts[input_i]->info, cell_size, cells_x, cells_y);
+		stbrp_rect rect         = {};
+		rect.w                  = static_cast<stbrp_coord>(cells_x * cell_size);
+		rect.h                  = static_cast<stbrp_coord>(cells_y * cell_size);
+		cache_rect_idx[input_i] = static_cast<uint32_t>(pack_rects.size());
+		pack_rects.push_back(rect);
+	}
+
+	// Merged inputs only add codepoints the earlier inputs of their destination font didn't have
+	std::unordered_map<const font*, std::vector<bool>> taken_codepoints;
+	for (auto input_i = 0u; input_i < config_data.size(); input_i++)
+	{
+		auto &taken = taken_codepoints[config_data[input_i].dst_font.get()];
+		if (taken.empty())
+			taken.resize(font_max_codepoint + 1, false);
+
+		for (auto &glyph : inputs[input_i].glyphs)
 		{
-			total_glyphs_count += (in_range[1] - in_range[0]) + 1;
+			if (glyph.codepoint >= taken.size() || taken[glyph.codepoint])
+				continue;
+			taken[glyph.codepoint] = true;
+
+			font_atlas_build_add_glyph_rects(glyph, pack_rects);
 		}
 	}
 
-	tex_width = (tex_desired_width > 0)
-		            ? tex_desired_width
-		            : (total_glyphs_count > 4000)
-		            ? 4096
-		            : (total_glyphs_count > 2000)
-		            ? 2048
-		            : (total_glyphs_count > 1000)
-		            ? 1024
-		            : 512;
+	font_atlas_build_pack_rects(this, pack_rects);
 
-	const auto total_rects    = total_glyphs_count + custom_rects.size();
-	auto min_rects_per_row    = std::ceilf((tex_width / (max_glyph_size.x + 1.f)));
-	auto min_rects_per_column = std::ceilf(total_rects / min_rects_per_row);
-	tex_height                = static_cast<uint32_t>(min_rects_per_column * (max_glyph_size.y + 1.f));
-
-	tex_height = (flags & FONT_ATLAS_FLAGS_NO_POWER_OF_TWO_HEIGHT)
-		             ? (tex_height + 1)
-		             : upper_power_of_two(tex_height);
 	tex_uv_scale       = position{1.f / tex_width, 1.f / tex_height};
 	tex_pixels_alpha_8 = reinterpret_cast<unsigned char *>(malloc(tex_width * tex_height));
 	memset(tex_pixels_alpha_8, 0, tex_width * tex_height);
 
-	std::vector<stbrp_node> pack_nodes;
-	pack_nodes.resize(total_rects);
-	stbrp_context context;
-	stbrp_init_target(&context, tex_width, tex_height, pack_nodes.data(), total_rects);
+	for (auto i = 0u; i < custom_rects.size(); i++)
+	{
+		if (!pack_rects[i].was_packed)
+			continue;
 
-	font_atlas_build_pack_custom_rects(this, &context);
+		custom_rects[i].x = static_cast<uint16_t>(pack_rects[i].x);
+		custom_rects[i].y = static_cast<uint16_t>(pack_rects[i].y);
+	}
 
 	for (auto input_i = 0u; input_i < config_data.size(); input_i++)
 	{
 		auto &cfg       = config_data[input_i];
 		auto &font_face = fonts[input_i];
-		auto dst_font   = cfg.dst_font;
-		if (cfg.merge_mode)
-			dst_font->build_lookup_table();
+		auto &input     = inputs[input_i];
+		font_atlas_build_setup_font(this, cfg.dst_font.get(), &cfg, font_face->info.ascender, font_face->info.descender);
+
+		if (cache_rect_idx[input_i] != static_cast<uint32_t>(-1))
+			font_atlas_build_setup_glyph_cache(this,
+			                                   cfg.dst_font.get(),
+			                                   pack_rects[cache_rect_idx[input_i]],
+			                                   input.multiply_enabled ? input.multiply_table : nullptr);
+	}
 
-		const auto ascent  = font_face->info.ascender;
-		const auto descent = font_face->info.descender;
-		font_atlas_build_setup_font(this, dst_font.get(), &cfg, ascent, descent);
-		const auto font_off_x = cfg.glyph_offset.x;
-		const auto font_off_y = cfg.glyph_offset.y + static_cast<float>(static_cast<int>(dst_font->ascent + 0.5f));
+	for (auto input_i = 0u; input_i < config_data.size(); input_i++)
+		font_atlas_build_register_input(this, input_i, inputs[input_i], pack_rects);
 
-		auto multiply_enabled = (cfg.rasterizer_multiply != 1.0f);
-		unsigned char multiply_table[ 256 ];
-		if (multiply_enabled)
-			font_atlas_build_multiply_calc_lookup_table(multiply_table, cfg.rasterizer_multiply);
+	// Copy rasterized pixels to main texture, every glyph owns a disjoint rect
+	for_each_input_parallel(config_data.size(),
+	                        [&](const uint32_t input_i)
+	                        {
+		                        font_atlas_build_blit_input(this, input_i, inputs[input_i], pack_rects);
+	                        });
 
-		for (auto in_range = cfg.glyph_ranges; in_range[0] && in_range[1]; in_range += 2)
+	for (auto &font : fonts)
+	{
+		if (!font->cache)
+			font->shutdown();
+	}
+
+	font_atlas_build_finish(this);
+
+	if (!cache_dir.empty())
+		font_atlas_cache_save(this, cache_key);
+
+	// Text calls go back to the fonts' own tables, which were rebuilt for the new texture
+	for (auto &font : fonts)
+		font->publish_generation(nullptr);
+	dirty_rects.clear();
+	has_updated = true;
+
+	return true;
+}
+
+bool font_atlas::build_incremental(const uint32_t input_i)
+{
+	assert(input_i < config_data.size());
+	auto &cfg = config_data[input_i];
+
+	// With a disk cache a full build is mostly a file read, which also keeps the cache keys in sync
+	if (!tex_pixels_alpha_8 || !pack_context || cfg.merge_mode || !cache_dir.empty()
+		|| input_i >= fonts.size() || fonts[input_i] != cfg.dst_font)
+		return false;
+
+	if (!cfg.glyph_ranges)
+		cfg.glyph_ranges = glyph_ranges_default();
+
+	build_input input;
+	font_atlas_build_rasterize_input(this, input_i, 0, input);
+	if (!input.init_ok)
+		return false;
+
+	std::vector<stbrp_rect> pack_rects;
+	auto cache_rect_idx = static_cast<uint32_t>(-1);
+	if (cfg.dynamic_glyphs)
+	{
+		uint32_t cell_size, cells_x, cells_y;
+		font_atlas_build_glyph_cache_layout(this, cfg, fonts[input_i]->info, cell_size, cells_x, cells_y);
+		stbrp_rect rect = {};
+		rect.w          = static_cast<stbrp_coord>(cells_x * cell_size);
+		rect.h          = static_cast<stbrp_coord>(cells_y * cell_size);
+		cache_rect_idx  = 0;
+		pack_rects.push_back(rect);
+	}
+
+	std::vector<bool> taken(font_max_codepoint + 1, false);
+	for (auto &glyph : input.glyphs)
+	{
+		if (glyph.codepoint >= taken.size() || taken[glyph.codepoint])
+			continue;
+		taken[glyph.codepoint] = true;
+
+		font_atlas_build_add_glyph_rects(glyph, pack_rects);
+	}
+
+	// Only the free space of the current texture counts, growing it would move every uv anyway.
+	// A failed attempt leaves dead nodes in the packer, the full build that follows replaces it
+	if (!pack_rects.empty())
+		stbrp_pack_rects(pack_context.get(), pack_rects.data(), static_cast<int>(pack_rects.size()));
+
+	auto min_x = tex_width, min_y = tex_height, max_x = 0u, max_y = 0u;
+	for (const auto &rect : pack_rects)
+	{
+		if (!rect.was_packed || static_cast<uint32_t>(rect.y + rect.h) > tex_height)
 		{
-			for (uint32_t codepoint = in_range[0]; codepoint <= in_range[1]; ++codepoint)
+			for (auto &glyph : input.glyphs)
 			{
-				if (cfg.merge_mode && dst_font->find_glyph_no_fallback(codepoint))
-					continue;
-
-				FT_Glyph ft_glyph              = nullptr;
-				FT_BitmapGlyph ft_glyph_bitmap = nullptr; // NB: will point to bitmap within FT_Glyph
-				glyph_info glyph_info;
-				if (!font_face->calc_glyph_info(codepoint, glyph_info, ft_glyph, ft_glyph_bitmap))
-					continue;
-
-				// Pack rectangle
-				stbrp_rect rect;
-				rect.w = static_cast<stbrp_coord>(glyph_info.width + 1.f); // Account for texture filtering
-				rect.h = static_cast<stbrp_coord>(glyph_info.height + 1.f);
-				stbrp_pack_rects(&context, &rect, 1);
-
-				// Copy rasterized pixels to main texture
-				uint8_t *blit_dst = tex_pixels_alpha_8 + rect.y * tex_width + rect.x;
-				font_face->blit_glyph(ft_glyph_bitmap,
-				                      blit_dst,
-				                      tex_width,
-				                      multiply_enabled ? multiply_table : nullptr);
-				FT_Done_Glyph(ft_glyph);
-
-				auto char_advance_x_org = glyph_info.advance_x;
-				auto char_advance_x_mod = std::clamp(char_advance_x_org, cfg.glyph_min_advance, cfg.glyph_max_advance);
-				auto char_off_x         = font_off_x;
-				if (char_advance_x_org != char_advance_x_mod)
-					char_off_x += cfg.pixel_snap_h
-						              ? (float)(int)((char_advance_x_mod - char_advance_x_org) * 0.5f)
-						              : (char_advance_x_mod - char_advance_x_org) * 0.5f;
-
-				// Register glyph
-				dst_font->add_glyph(codepoint,
-				                    glyph_info.offset_x + char_off_x,
-				                    glyph_info.offset_y + font_off_y,
-				                    glyph_info.offset_x + char_off_x + glyph_info.width,
-				                    glyph_info.offset_y + font_off_y + glyph_info.height,
-				                    rect.x / (float)tex_width,
-				                    rect.y / (float)tex_height,
-				                    (rect.x + glyph_info.width) / (float)tex_width,
-				                    (rect.y + glyph_info.height) / (float)tex_height,
-				                    char_advance_x_mod);
+				FT_Done_Glyph(glyph.ft_glyph);
+				if (glyph.outline_ft_glyph)
+					FT_Done_Glyph(glyph.outline_ft_glyph);
 			}
+			fonts[input_i]->shutdown();
+			pack_context = nullptr;
+			return false;
 		}
+
+		min_x = std::min(min_x, static_cast<uint32_t>(rect.x));
+		min_y = std::min(min_y, static_cast<uint32_t>(rect.y));
+		max_x = std::max(max_x, static_cast<uint32_t>(rect.x + rect.w));
+		max_y = std::max(max_y, static_cast<uint32_t>(rect.y + rect.h));
 	}
 
-	for (auto &font : fonts)
-		font->shutdown();
+	const auto dst_font = cfg.dst_font.get();
+	font_atlas_build_setup_font(this, dst_font, &cfg, fonts[input_i]->info.ascender, fonts[input_i]->info.descender);
+	if (cache_rect_idx != static_cast<uint32_t>(-1))
+		font_atlas_build_setup_glyph_cache(this,
+		                                   dst_font,
+		                                   pack_rects[cache_rect_idx],
+		                                   input.multiply_enabled ? input.multiply_table : nullptr);
+
+	font_atlas_build_register_input(this, input_i, input, pack_rects);
+	font_atlas_build_blit_input(this, input_i, input, pack_rects);
+	if (!dst_font->cache)
+		dst_font->shutdown();
+	dst_font->build_lookup_table();
+
+	// One rect around the new glyphs, the texture itself stays
+	if (max_x > min_x && max_y > min_y)
+		mark_dirty(min_x, min_y, max_x - min_x, max_y - min_y);
+	return true;
+}
 
-	font_atlas_build_finish(this);
+void font_atlas::relink_config_data()
+{
+	// config_data reallocates on add/remove, fonts point into it
+	for (auto &cfg : config_data)
+	{
+		if (!cfg.merge_mode && cfg.dst_font)
+			cfg.dst_font->config_data = &cfg;
+	}
+}
+
+void font_atlas::start_async_build()
+{
+	if (async_build.valid() || async_queue.empty())
+		return;
+
+	async_building.swap(async_queue);
+	async_build_serial = config_serial;
+
+	// The next generation is a separate atlas with its own fonts, built from copies of the current inputs plus the
+	// queued ones. It borrows their font data, which is why removing fonts waits for the build
+	auto staged               = std::make_unique<font_atlas>();
+	staged->flags             = flags;
+	staged->tex_desired_width = tex_desired_width;
+	staged->tex_glyph_padding = tex_glyph_padding;
+	staged->cache_dir         = cache_dir;
+
+	std::unordered_map<const font*, std::shared_ptr<font>> staged_fonts;
+	const auto add_input = [&](font_config cfg)
+	{
+		auto &staged_font = staged_fonts[cfg.dst_font.get()];
+		if (!staged_font)
+			staged_font = std::make_shared<font>();
+		if (!cfg.merge_mode)
+			staged->fonts.push_back(staged_font);
+
+		cfg.dst_font       = staged_font;
+		cfg.owned_by_atlas = false;
+		staged->config_data.push_back(std::move(cfg));
+	};
+	for (const auto &cfg : config_data)
+		add_input(cfg);
+	for (const auto &pending : async_building)
+		add_input(pending.cfg);
+	staged->relink_config_data();
+
+	staged->custom_rects    = custom_rects;
+	staged->custom_rect_idx = custom_rect_idx;
+	for (auto &rect : staged->custom_rects)
+	{
+		if (rect.font)
+			rect.font = staged_fonts[rect.font].get();
+	}
 
+	async_build = std::async(std::launch::async,
+	                         [staged = std::move(staged)]() mutable
+	                         {
+		                         if (!staged->build())
+			                         staged = nullptr;
+		                         return std::move(staged);
+	                         });
+}
+
+bool font_atlas::publish_async()
+{
+	if (!async_build.valid() || async_build.wait_for(std::chrono::seconds(0)) != std::future_status::ready)
+		return false;
+
+	auto staged    = async_build.get();
+	auto published = std::move(async_building);
+	async_building.clear();
+
+	if (async_build_serial != config_serial)
+	{
+		// Fonts were added or removed synchronously meanwhile, the result lacks those changes
+		async_queue.insert(async_queue.begin(),
+		                   std::make_move_iterator(published.begin()),
+		                   std::make_move_iterator(published.end()));
+		start_async_build();
+		return false;
+	}
+
+	if (!staged)
+	{
+		for (auto &pending : published)
+		{
+			if (pending.cfg.owned_by_atlas)
+				free(pending.cfg.font_data);
+			pending.promise.set_value(nullptr);
+		}
+		start_async_build();
+		return false;
+	}
+
+	// Running text calls never see config_data, they are on the staged copies or load glyphs under tex_mutex
+	for (const auto &pending : published)
+	{
+		if (!pending.cfg.merge_mode)
+			fonts.push_back(pending.cfg.dst_font);
+		config_data.push_back(pending.cfg);
+	}
+	relink_config_data();
+
+	// Both config_data are in the same order. Every built font becomes the generation of the font users hold, which
+	// keeps the staged atlas with its configs alive until the last text call running on it is done
+	const auto owner = std::shared_ptr<font_atlas>(std::move(staged));
+	assert(owner->config_data.size() == config_data.size());
+	std::unordered_map<const font*, font*> live_fonts;
+	for (auto i = 0u; i < config_data.size(); i++)
+	{
+		auto &cfg        = config_data[i];
+		auto &staged_cfg = owner->config_data[i];
+		cfg.glyph_ranges = staged_cfg.glyph_ranges;
+		if (cfg.merge_mode)
+			continue;
+
+		// its glyph cache loads into the pixels taken over below
+		const auto staged_font       = staged_cfg.dst_font.get();
+		staged_font->container_atlas = this;
+
+		// same configs as the live font, only the extra flags of its last synchronous build can differ
+		const auto live             = cfg.dst_font.get();
+		const auto advances_changed = !live->loaded() || live->user_flags != staged_font->user_flags;
+		if (!live->loaded())
+		{
+			// first build of this font, the metrics callers read directly have to be there before the promise
+			live->info              = staged_font->info;
+			live->font_size         = staged_font->font_size;
+			live->ascent            = staged_font->ascent;
+			live->descent           = staged_font->descent;
+			live->config_data_count = staged_font->config_data_count;
+			live->config_data       = &cfg;
+			live->container_atlas   = this;
+		}
+		live->user_flags = staged_font->user_flags; // sdf() has to match the tables text calls run on
+		live->publish_generation(std::shared_ptr<font>(owner, staged_font), advances_changed);
+		live_fonts[staged_font] = live;
+	}
+
+	custom_rects    = owner->custom_rects;
+	custom_rect_idx = owner->custom_rect_idx;
+	for (auto &rect : custom_rects)
+	{
+		if (rect.font)
+			rect.font = live_fonts[rect.font];
+	}
+
+	// the old pixels go with the staged atlas, nothing writes them anymore since the old tables are retired
+	std::swap(tex_pixels_alpha_8, owner->tex_pixels_alpha_8);
+	std::swap(tex_pixels_rgba_32, owner->tex_pixels_rgba_32);
+	tex_width          = owner->tex_width;
+	tex_height         = owner->tex_height;
+	tex_uv_scale       = owner->tex_uv_scale;
+	tex_uv_white_pixel = owner->tex_uv_white_pixel;
+	pack_context.swap(owner->pack_context);
+	pack_nodes.swap(owner->pack_nodes);
+	dirty_rects.clear();
 	has_updated = true;
 
+	for (auto &pending : published)
+		pending.promise.set_value(pending.cfg.dst_font.get());
+
+	start_async_build();
 	return true;
 }
 
+#pragma region atlas_cache
 
-void font_atlas_build_register_default_custom_rects(font_atlas *atlas)
+namespace
 {
-	if (atlas->custom_rect_idx[0] >= 0)
-		return;
+	constexpr uint32_t atlas_cache_magic   = 0x41464455; // 'UDFA'
+	constexpr uint32_t atlas_cache_version = 3;
+	// Every add_font leaves a file for its intermediate atlas, the least recently used ones past this get deleted
+	constexpr size_t atlas_cache_max_files = 16;
+	// Larger than any atlas build_pack_rects produces, a header past it is corrupt
+	constexpr uint32_t atlas_cache_max_tex_size = 16384;
+
+	struct atlas_cache_header
+	{
+		uint32_t magic;
+		uint32_t version;
+		uint64_t key;
+		uint32_t tex_width, tex_height;
+		uint32_t custom_rect_count;
+		uint32_t input_count;
+	};
 
-	atlas->custom_rect_idx[0] = atlas->add_custom_rect_regular(FONT_ATLAS_DEFAULT_TEX_DATA_ID, 2, 2);
+	struct atlas_cache_font
+	{
+		float ascent, descent;
+		int32_t metrics_total_surface;
+		uint32_t glyph_count;
+		uint32_t outline_glyph_count; // 0 or glyph_count
+		uint32_t cache_origin_x, cache_origin_y; // cache_cell_count is 0 without a glyph cache
+		uint32_t cache_cell_size, cache_cells_x, cache_cell_count;
+	};
+
+	template<typename T>
+	uint64_t hash_value(const T &value, const uint64_t hash)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+		return hash_bytes(&value, sizeof(T), hash);
+	}
+
+	std::string atlas_cache_file(const font_atlas *atlas, const uint64_t key)
+	{
+		// One file per key, every add_font rebuilds the atlas and each of those intermediate states gets its own hit
+		char name[ 32 ];
+		snprintf(name, sizeof(name), "/%016llx.fac", static_cast<unsigned long long>(key));
+		return atlas->cache_dir + name;
+	}
+
+	// Loads touch their file, so this drops the atlases that weren't built or loaded for the longest time
+	void atlas_cache_prune(const font_atlas *atlas)
+	{
+		namespace fs = std::filesystem;
+
+		std::error_code ec;
+		std::vector<std::pair<fs::file_time_type, fs::path>> files;
+		for (fs::directory_iterator it(atlas->cache_dir, ec), end; !ec && it != end; it.increment(ec))
+		{
+			if (it->path().extension() != ".fac" || !it->is_regular_file(ec))
+				continue;
+			const auto time = it->last_write_time(ec);
+			if (!ec)
+				files.emplace_back(time, it->path());
+		}
+		if (files.size() <= atlas_cache_max_files)
+			return;
+
+		std::sort(files.begin(), files.end(), [](const auto &a, const auto &b) { return a.first > b.first; });
+		for (auto i = atlas_cache_max_files; i < files.size(); i++)
+			fs::remove(files[i].second, ec);
+	}
 }
 
-void font_atlas_build_pack_custom_rects(font_atlas *atlas, stbrp_context *pack_context)
+uint64_t font_atlas_cache_key(const font_atlas *atlas, const uint32_t extra_flags)
 {
-	auto &user_rects = atlas->custom_rects;
-	assert(user_rects.size() >= 1);
+	auto hash = hash_value(atlas_cache_version, hash_bytes_seed);
+	hash      = hash_value(extra_flags, hash);
+	hash      = hash_value(atlas->flags, hash);
+	hash      = hash_value(atlas->tex_desired_width, hash);
+	hash      = hash_value(atlas->tex_glyph_padding, hash);
+	for (const auto &cfg : atlas->config_data)
+	{
+		hash = hash_bytes(cfg.font_data, cfg.font_data_size, hash);
+		hash = hash_value(cfg.font_data_size, hash);
+		hash = hash_value(cfg.font_idx, hash);
+		hash = hash_value(cfg.size_pixels, hash);
+		hash = hash_value(cfg.pixel_snap_h, hash);
+		hash = hash_value(cfg.glyph_extra_spacing, hash);
+		hash = hash_value(cfg.glyph_offset, hash);
+		hash = hash_value(cfg.glyph_min_advance, hash);
+		hash = hash_value(cfg.glyph_max_advance, hash);
+		hash = hash_value(cfg.merge_mode, hash);
+		hash = hash_value(cfg.rasterizer_flags, hash);
+		hash = hash_value(cfg.rasterizer_multiply, hash);
+		hash = hash_value(cfg.dynamic_glyphs, hash);
+		hash = hash_value(cfg.dynamic_glyph_cells, hash);
+		hash = hash_value(cfg.outline_thickness, hash);
+		for (auto in_range = cfg.glyph_ranges; in_range[0] && in_range[1]; in_range += 2)
+			hash = hash_bytes(in_range, sizeof(font_wchar) * 2, hash);
+	}
+	for (const auto &rect : atlas->custom_rects)
+	{
+		hash = hash_value(rect.id, hash);
+		hash = hash_value(rect.width, hash);
+		hash = hash_value(rect.height, hash);
+		hash = hash_value(rect.glyph_advance_x, hash);
+		hash = hash_value(rect.glyph_offset, hash);
+	}
+	return hash;
+}
 
-	std::vector<stbrp_rect> pack_rects;
-	pack_rects.resize(user_rects.size());
-	memset(pack_rects.data(), 0, sizeof(stbrp_rect) * user_rects.size());
+bool font_atlas_cache_load(font_atlas *atlas, const uint64_t key, const uint32_t extra_flags)
+{
+	const auto path = atlas_cache_file(atlas, key);
+	std::ifstream file(path, std::ios::in | std::ios::binary | std::ios::ate);
+	if (!file.is_open())
+		return false;
 
-	for (auto i = 0u; i < user_rects.size(); i++)
+	// Every count in the file is checked against the bytes left before anything gets allocated for it
+	const auto file_size = file.tellg();
+	if (file_size < 0 || !file.seekg(0))
+		return false;
+	auto remaining = static_cast<uint64_t>(file_size);
+	const auto take = [&remaining](const uint64_t bytes)
+	{
+		if (bytes > remaining)
+			return false;
+		remaining -= bytes;
+		return true;
+	};
+
+	atlas_cache_header header;
+	if (!take(sizeof(header))
+		|| !file.read(reinterpret_cast<char*>(&header), sizeof(header))
+		|| header.magic != atlas_cache_magic
+		|| header.version != atlas_cache_version
+		|| header.key != key
+		|| header.custom_rect_count != atlas->custom_rects.size()
+		|| header.input_count != atlas->config_data.size()
+		|| !header.tex_width || header.tex_width > atlas_cache_max_tex_size
+		|| !header.tex_height || header.tex_height > atlas_cache_max_tex_size)
+		return false;
+
+	std::vector<std::pair<uint16_t, uint16_t>> rect_pos(header.custom_rect_count);
+	if (!take(rect_pos.size() * sizeof(rect_pos[0])) || !file.read(reinterpret_cast<char*>(rect_pos.data()), rect_pos.size() * sizeof(rect_pos[0])))
+		return false;
+
+	// Read everything before touching the atlas so a truncated file leaves it untouched
+	std::vector<atlas_cache_font> font_data(header.input_count);
+	std::vector<std::vector<font_glyph>> glyph_data(header.input_count);
+	std::vector<std::vector<font_glyph>> outline_glyph_data(header.input_count);
+	for (auto input_i = 0u; input_i < header.input_count; input_i++)
+	{
+		if (atlas->config_data[input_i].merge_mode)
+			continue;
+
+		auto &font_entry = font_data[input_i];
+		if (!take(sizeof(font_entry)) || !file.read(reinterpret_cast<char*>(&font_entry), sizeof(font_entry)))
+			return false;
+		if ((font_entry.outline_glyph_count && font_entry.outline_glyph_count != font_entry.glyph_count)
+			|| !take((static_cast<uint64_t>(font_entry.glyph_count) + font_entry.outline_glyph_count) * sizeof(font_glyph)))
+			return false;
+
+		// the cells have to lie inside the texture, cache_cell_count sizes two vectors
+		if (font_entry.cache_cell_count)
+		{
+			const auto cell_size = static_cast<uint64_t>(font_entry.cache_cell_size);
+			const auto cells_x   = static_cast<uint64_t>(font_entry.cache_cells_x);
+			if (!cell_size || !cells_x)
+				return false;
+			const auto cells_y = (font_entry.cache_cell_count + cells_x - 1) / cells_x;
+			if (font_entry.cache_origin_x + cells_x * cell_size > header.tex_width
+				|| font_entry.cache_origin_y + cells_y * cell_size > header.tex_height)
+				return false;
+		}
+
+		glyph_data[input_i].resize(font_entry.glyph_count);
+		if (!file.read(reinterpret_cast<char*>(glyph_data[input_i].data()), font_entry.glyph_count * sizeof(font_glyph)))
+			return false;
+		outline_glyph_data[input_i].resize(font_entry.outline_glyph_count);
+		if (!file.read(reinterpret_cast<char*>(outline_glyph_data[input_i].data()), font_entry.outline_glyph_count * sizeof(font_glyph)))
+			return false;
+	}
+
+	const auto pixel_count = static_cast<size_t>(header.tex_width) * header.tex_height;
+	if (!take(pixel_count))
+		return false;
+	auto pixels = reinterpret_cast<unsigned char *>(malloc(pixel_count));
+	if (!file.read(reinterpret_cast<char*>(pixels), pixel_count))
 	{
-		pack_rects[i].w = user_rects[i].width;
-		pack_rects[i].h = user_rects[i].height;
+		free(pixels);
+		return false;
 	}
-	stbrp_pack_rects(pack_context, pack_rects.data(), pack_rects.size());
-	for (auto i = 0u; i < pack_rects.size(); i++)
+
+	// Fonts with a glyph cache still need their face to rasterize on first use
+	for (auto input_i = 0u; input_i < header.input_count; input_i++)
 	{
-		if (pack_rects[i].was_packed)
+		if (font_data[input_i].cache_cell_count && !atlas->fonts[input_i]->init(atlas->config_data[input_i], extra_flags))
 		{
-			user_rects[i].x = pack_rects[i].x;
-			user_rects[i].y = pack_rects[i].y;
-			assert(pack_rects[i].w == user_rects[i].width && pack_rects[i].h == user_rects[i].height);
-			atlas->tex_height = std::max(atlas->tex_height, static_cast<uint32_t>(pack_rects[i].y + pack_rects[i].h));
+			free(pixels);
+			return false;
 		}
 	}
+
+	atlas->tex_width          = header.tex_width;
+	atlas->tex_height         = header.tex_height;
+	atlas->tex_uv_scale       = position{1.f / atlas->tex_width, 1.f / atlas->tex_height};
+	atlas->tex_pixels_alpha_8 = pixels;
+	for (auto i = 0u; i < rect_pos.size(); i++)
+	{
+		atlas->custom_rects[i].x = rect_pos[i].first;
+		atlas->custom_rects[i].y = rect_pos[i].second;
+	}
+
+	for (auto input_i = 0u; input_i < header.input_count; input_i++)
+	{
+		auto &cfg               = atlas->config_data[input_i];
+		const auto &font_entry  = font_data[input_i];
+		const auto dst_font     = cfg.dst_font.get();
+		font_atlas_build_setup_font(atlas, dst_font, &cfg, font_entry.ascent, font_entry.descent);
+		if (cfg.merge_mode)
+			continue;
+
+		// the same flags font::init folds together, fonts without a glyph cache never init here
+		dst_font->user_flags            = cfg.rasterizer_flags | extra_flags;
+		dst_font->glyphs                = std::move(glyph_data[input_i]);
+		dst_font->outline_glyphs        = std::move(outline_glyph_data[input_i]);
+		dst_font->metrics_total_surface = font_entry.metrics_total_surface;
+		dst_font->dirty_lookup_tables   = true;
+		if (!font_entry.cache_cell_count)
+			continue;
+
+		auto cache       = std::make_unique<glyph_cache>();
+		cache->origin_x  = font_entry.cache_origin_x;
+		cache->origin_y  = font_entry.cache_origin_y;
+		cache->cell_size = font_entry.cache_cell_size;
+		cache->cells_x   = font_entry.cache_cells_x;
+		cache->glyphs.resize(font_entry.cache_cell_count);
+		cache->last_use.resize(font_entry.cache_cell_count, 0u);
+		cache->multiply_enabled = cfg.rasterizer_multiply != 1.0f;
+		if (cache->multiply_enabled)
+			font_atlas_build_multiply_calc_lookup_table(cache->multiply_table, cfg.rasterizer_multiply);
+		dst_font->cache = std::move(cache);
+	}
+
+	// The stored tables already contain the custom rect glyphs, only the white pixel and lookups are left
+	font_atlas_build_render_default_tex_data(atlas);
+	for (auto &font : atlas->fonts)
+		if (font->dirty_lookup_tables)
+			font->build_lookup_table();
+
+	// a hit counts as a use for atlas_cache_prune
+	file.close();
+	std::error_code ec;
+	std::filesystem::last_write_time(path, std::filesystem::file_time_type::clock::now(), ec);
+	return true;
+}
+
+void font_atlas_cache_save(const font_atlas *atlas, const uint64_t key)
+{
+	std::ofstream file(atlas_cache_file(atlas, key), std::ios::out | std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+		return;
+
+	atlas_cache_header header;
+	header.magic             = atlas_cache_magic;
+	header.version           = atlas_cache_version;
+	header.key               = key;
+	header.tex_width         = atlas->tex_width;
+	header.tex_height        = atlas->tex_height;
+	header.custom_rect_count = static_cast<uint32_t>(atlas->custom_rects.size());
+	header.input_count       = static_cast<uint32_t>(atlas->config_data.size());
+	file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+	for (const auto &rect : atlas->custom_rects)
+	{
+		const auto pos = std::make_pair(rect.x, rect.y);
+		file.write(reinterpret_cast<const char*>(&pos), sizeof(pos));
+	}
+
+	for (auto input_i = 0u; input_i < atlas->config_data.size(); input_i++)
+	{
+		const auto &cfg = atlas->config_data[input_i];
+		if (cfg.merge_mode)
+			continue;
+
+		const auto &dst_font  = *cfg.dst_font;
+		atlas_cache_font font_entry = {};
+		font_entry.ascent                = dst_font.ascent;
+		font_entry.descent               = dst_font.descent;
+		font_entry.metrics_total_surface = dst_font.metrics_total_surface;
+		font_entry.glyph_count           = static_cast<uint32_t>(dst_font.glyphs.size());
+		font_entry.outline_glyph_count   = static_cast<uint32_t>(dst_font.outline_glyphs.size());
+		if (dst_font.cache)
+		{
+			font_entry.cache_origin_x   = dst_font.cache->origin_x;
+			font_entry.cache_origin_y   = dst_font.cache->origin_y;
+			font_entry.cache_cell_size  = dst_font.cache->cell_size;
+			font_entry.cache_cells_x    = dst_font.cache->cells_x;
+			font_entry.cache_cell_count = static_cast<uint32_t>(dst_font.cache->glyphs.size());
+		}
+		file.write(reinterpret_cast<const char*>(&font_entry), sizeof(font_entry));
+		file.write(reinterpret_cast<const char*>(dst_font.glyphs.data()), dst_font.glyphs.size() * sizeof(font_glyph));
+		file.write(reinterpret_cast<const char*>(dst_font.outline_glyphs.data()), dst_font.outline_glyphs.size() * sizeof(font_glyph));
+	}
+
+	file.write(reinterpret_cast<const char*>(atlas->tex_pixels_alpha_8), static_cast<size_t>(atlas->tex_width) * atlas->tex_height);
+	file.close();
+
+	atlas_cache_prune(atlas);
+}
+
+#pragma endregion
+
+
+void font_atlas_build_register_default_custom_rects(font_atlas *atlas)
+{
+	if (atlas->custom_rect_idx[0] >= 0)
+		return;
+
+	atlas->custom_rect_idx[0] = atlas->add_custom_rect_regular(FONT_ATLAS_DEFAULT_TEX_DATA_ID, 2, 2);
+}
+
+void font_atlas_build_pack_rects(font_atlas *atlas, std::vector<stbrp_rect> &rects)
+{
+	// Packing is cheap next to rasterizing, so unless a width is forced every candidate width gets a try
+	// and the one with the smallest texture wins. Heights are shrunk to what the packer actually used
+	std::vector<uint32_t> widths;
+	if (atlas->tex_desired_width > 0)
+		widths.push_back(atlas->tex_desired_width);
+	else if (atlas->flags & FONT_ATLAS_FLAGS_NO_COMPACT)
+		widths.push_back(rects.size() > 4000 ? 4096 : rects.size() > 2000 ? 2048 : rects.size() > 1000 ? 1024 : 512);
+	else
+		widths = {512, 1024, 2048, 4096};
+
+	// The winning packer is kept on the atlas so build_incremental can keep filling its free space
+	const auto max_height = 8192u;
+	std::vector<stbrp_rect> attempt;
+	std::vector<stbrp_rect> best;
+	atlas->pack_context = nullptr;
+	auto best_dropped = std::numeric_limits<size_t>::max();
+	auto best_area    = std::numeric_limits<uint64_t>::max();
+	for (const auto width : widths)
+	{
+		attempt      = rects;
+		auto context = std::make_unique<stbrp_context>();
+		std::vector<stbrp_node> nodes(width);
+		stbrp_init_target(context.get(), width, max_height, nodes.data(), static_cast<int>(nodes.size()));
+		stbrp_pack_rects(context.get(), attempt.data(), static_cast<int>(attempt.size()));
+
+		auto dropped = 0u;
+		auto height  = 1u;
+		for (const auto &rect : attempt)
+		{
+			if (rect.was_packed)
+				height = std::max(height, static_cast<uint32_t>(rect.y + rect.h));
+			else
+				dropped++;
+		}
+
+		height = (atlas->flags & FONT_ATLAS_FLAGS_NO_POWER_OF_TWO_HEIGHT)
+			         ? height
+			         : upper_power_of_two(height);
+		const auto area = static_cast<uint64_t>(width) * height;
+		if (dropped < best_dropped || (dropped == best_dropped && area < best_area))
+		{
+			best_dropped      = dropped;
+			best_area         = area;
+			atlas->tex_width  = width;
+			atlas->tex_height = height;
+			best.swap(attempt);
+			atlas->pack_context = std::move(context);
+			atlas->pack_nodes.swap(nodes); // swapping keeps the node storage the context points into
+		}
+	}
+
+	rects.swap(best);
+}
+
+void font_atlas_build_glyph_cache_layout(const font_atlas *atlas,
+                                         const font_config &cfg,
+                                         const font_info &info,
+                                         uint32_t &cell_size,
+                                         uint32_t &cells_x,
+                                         uint32_t &cells_y)
+{
+	// Square cells big enough for the widest/tallest glyph plus padding, laid out as a roughly square region
+	cell_size = static_cast<uint32_t>(std::ceilf(std::max(info.max_advance_width, info.ascender - info.descender)))
+		+ atlas->tex_glyph_padding + 1;
+	if (cfg.rasterizer_flags & SDF)
+		cell_size += font_sdf_spread * 2;
+	cells_x = std::max(1u, static_cast<uint32_t>(std::ceilf(std::sqrt(static_cast<float>(cfg.dynamic_glyph_cells)))));
+	cells_y = (cfg.dynamic_glyph_cells + cells_x - 1) / cells_x;
+}
+
+void font_atlas_build_setup_glyph_cache(font_atlas *atlas,
+                                        font *font,
+                                        const stbrp_rect &region,
+                                        const unsigned char *multiply_table)
+{
+	if (!region.was_packed)
+		return; // atlas too small, the font just falls back to its ascii glyphs
+
+	uint32_t cells_y;
+	auto cache = std::make_unique<glyph_cache>();
+	font_atlas_build_glyph_cache_layout(atlas, *font->config_data, font->info, cache->cell_size, cache->cells_x, cells_y);
+	cache->origin_x = region.x;
+	cache->origin_y = region.y;
+	cache->glyphs.resize(cache->cells_x * cells_y);
+	cache->last_use.resize(cache->glyphs.size(), 0u);
+	cache->multiply_enabled = multiply_table != nullptr;
+	if (multiply_table)
+		memcpy(cache->multiply_table, multiply_table, sizeof(cache->multiply_table));
+
+	font->cache = std::move(cache);
 }
 
 void font_atlas_build_setup_font(font_atlas *atlas, font *font, font_config *font_config, float ascent, float descent)
@@ -1612,7 +3265,7 @@ void font_atlas_build_finish(font_atlas *atlas)
 	for (auto i = 0u; i < atlas->custom_rects.size(); i++)
 	{
 		const auto &r = atlas->custom_rects[i];
-		if (r.font == nullptr || r.id > 0x10000)
+		if (r.font == nullptr || r.id > font_max_codepoint)
 			continue;
 
 		assert(r.font->container_atlas == atlas);
@@ -2,13 +2,20 @@
 
 #include <vector>
 #include <mutex>
+#include <atomic>
+#include <future>
+#include <memory>
+#include <string>
 #include "math.h"
 
 typedef struct FT_LibraryRec_ *FT_Library;
+struct stbrp_context;
+struct stbrp_node;
 typedef struct FT_FaceRec_ *FT_Face;
 typedef int32_t FT_Int32;
 typedef struct FT_BitmapGlyphRec_ *FT_BitmapGlyph;
 typedef struct FT_GlyphRec_ *FT_Glyph;
+typedef struct FT_StrokerRec_ *FT_Stroker;
 
 namespace util::draw
 {
@@ -33,7 +40,8 @@ namespace util::draw
 	{
 		FONT_ATLAS_FLAGS_NONE = 0,
 		FONT_ATLAS_FLAGS_NO_POWER_OF_TWO_HEIGHT = 1 << 0,
-		FONT_ATLAS_FLAGS_NO_MOUSE_CURSORS = 1 << 1
+		FONT_ATLAS_FLAGS_NO_MOUSE_CURSORS = 1 << 1,
+		FONT_ATLAS_FLAGS_NO_COMPACT = 1 << 2 // Skip trying every texture width for the smallest atlas
 	};
 
 	enum RASTERIZER_FLAGS
@@ -53,12 +61,19 @@ namespace util::draw
 		// Styling: Should we artificially embolden the font?
 		OBLIQUE = 1 << 6,    
 		// Styling: Should we slant the font, emulating italic style?
-        NO_ANTIALIASING = 1 << 7 
+        NO_ANTIALIASING = 1 << 7,
 		// Disable anti-aliasing. Combine this with MonoHinting for best results!
+		SDF = 1 << 8,
+		// Store a signed distance field instead of coverage, one size then stays sharp at any target size. See sdf_style
+		OUTLINE = 1 << 9
+		// Also rasterize stroked copies of the glyphs (font_config::outline_thickness) so outlined text takes a single pass
 	};
 
+	// Pixels (at the rasterized size) the 0..255 range of sdf glyphs covers on each side of the outline, 128 is the edge
+	constexpr uint32_t font_sdf_spread = 4;
 
-	using font_wchar = uint16_t;
+
+	using font_wchar = uint32_t;
 	using font_char = char;
 
 	struct font_config;
@@ -69,11 +84,28 @@ namespace util::draw
 	struct draw_manager;
 	struct draw_buffer;
 
+	// Read-only mapping of a font file. Every font_config loaded from the same path shares one mapping, which is
+	// released together with the last config referencing it
+	struct font_file
+	{
+		static std::shared_ptr<font_file> open(const char *file_name);
+
+		font_file() = default;
+		~font_file();
+		font_file(const font_file&)            = delete;
+		font_file& operator=(const font_file&) = delete;
+
+		std::string path;
+		const uint8_t *data = nullptr;
+		size_t size         = 0;
+	};
+
 	struct font_config
 	{
 		void *font_data;
 		uint32_t font_data_size;
 		bool owned_by_atlas;
+		std::shared_ptr<const font_file> file; // font_data points into it if set, never owned_by_atlas
 		font_t font_idx;
 
 		float size_pixels;
@@ -91,6 +123,15 @@ namespace util::draw
 		uint32_t rasterizer_flags;
 		float rasterizer_multiply;
 
+		// Only ascii is rasterized at build time, everything else in glyph_ranges on first use into a cache of
+		// dynamic_glyph_cells cells with lru eviction. Keep the cell count above the distinct glyphs drawn per frame,
+		// glyphs that find no free cell are drawn as the fallback glyph until one frees up. Off by default
+		bool dynamic_glyphs;
+		uint32_t dynamic_glyph_cells;
+
+		// Stroke width in pixels of the OUTLINE glyphs. Only build time glyphs get one, not the dynamic ones
+		float outline_thickness;
+
 		std::array<font_char, 40> name{};
 		std::shared_ptr<font> dst_font;
 
@@ -115,25 +156,87 @@ namespace util::draw
 		float u0, v0, u1, v1;
 	};
 
+	// Atlas region of a font with font_config::dynamic_glyphs, split into square cells
+	struct glyph_cache
+	{
+		uint32_t origin_x = 0, origin_y = 0;
+		uint32_t cell_size = 0;
+		uint32_t cells_x = 0;
+		// Guards glyphs, last_use and the lookup entries of every codepoint above ascii, text calls on any thread
+		// load and touch cells. Taken after font_atlas::tex_mutex
+		std::mutex mutex;
+		std::vector<font_glyph> glyphs = {}; //One per cell, codepoint 0 if unused
+		std::vector<uint32_t> last_use = {}; //font_atlas::glyph_frame of the last lookup
+		bool multiply_enabled = false;
+		unsigned char multiply_table[256] = {};
+	};
+
+	constexpr font_wchar font_max_codepoint = 0x10FFFF;
+
+	// 256 codepoints of a font's lookup table
+	struct glyph_lookup_page
+	{
+		std::array<float, 256> advance_x; //Negative while a dynamic glyph isn't loaded
+		std::array<uint16_t, 256> glyph;  //Index into font::glyphs, see font::glyph_cache_base
+	};
+
+	// Result of font::layout_text, quads are relative to the pixel aligned origin render_text would draw at
+	struct text_layout
+	{
+		struct quad
+		{
+			position p0, p1;
+			position uv0, uv1;
+		};
+
+		struct line
+		{
+			uint32_t quad_begin, quad_end;
+			float width;
+		};
+
+		// Glyph cache cell a quad came from, no_cell if the glyph fell back because every cell was pinned
+		struct cached_glyph
+		{
+			static constexpr uint32_t no_cell = 0xFFFFFFFF;
+			uint32_t cell;
+			font_wchar codepoint;
+		};
+
+		std::vector<quad> quads = {};
+		std::vector<line> lines = {};
+		std::vector<cached_glyph> cached_glyphs = {}; //See font::touch_layout
+		position size = {}; //Same as draw_buffer::text_size
+	};
+
 	struct font
 	{
+		// glyph_lookup_page::glyph values, everything from glyph_cache_base on is a glyph_cache cell
+		static constexpr uint16_t glyph_cache_base = 0xC000;
+		static constexpr uint16_t glyph_missing = 0xFFFE;
+		static constexpr uint16_t glyph_not_loaded = 0xFFFF;
+
 		font_info info;
 		uint32_t user_flags;
 		FT_Library freetype_library{};
 		FT_Face freetype_face{};
 		FT_Int32 freetype_load_flags{};
+		FT_Stroker freetype_stroker{}; //Only with OUTLINE
 
 		//Other stuff
 		float font_size;
 		float scale;
 		position display_offset;
 		std::vector<font_glyph> glyphs;
-		std::vector<float> index_advance_x;
-		std::vector<float> index_glyph_y;
-		std::vector<font_wchar> index_lookup;
+		std::vector<font_glyph> outline_glyphs; //Same indices as glyphs, codepoint 0 if a glyph has none
+		// Two level table, codepoint >> 8 selects the page. Page 0 is shared by every block without glyphs,
+		// page 1 always holds U+0000..U+00FF so ascii text skips the first level
+		std::vector<uint16_t> lookup_pages;
+		std::vector<glyph_lookup_page> lookup_page_data;
 		const font_glyph *fallback_glyph;
 		float fallback_advance_x;
 		font_wchar fallback_char;
+		std::unique_ptr<glyph_cache> cache;
 
 		short config_data_count;
 		font_config *config_data;
@@ -142,6 +245,19 @@ namespace util::draw
 		bool dirty_lookup_tables;
 		int metrics_total_surface;
 
+		// Output of the last background build for this font, null while its own tables are current. Text calls load it
+		// once and run on it, so publishing never changes tables under a running call. Only used through
+		// std::atomic_load/std::atomic_store, set by publish_generation
+		std::shared_ptr<font> generation;
+		bool retired = false; // tables replaced by a newer build, the glyph cache stops loading. Guarded by tex_mutex
+		// Changes whenever glyphs of this font can move (builds, published background builds, a new fallback char),
+		// anything keeping uvs around compares it. Unique across fonts, so a font allocated where a removed one was
+		// doesn't match its old value. Evicted glyph cache cells don't change it, see touch_layout
+		std::atomic<uint32_t> layout_generation{0};
+		// Changes with layout_generation when advances or metrics can change too: synchronous builds, the first
+		// background build of the font or one with other flags, a new fallback char. For anything only measuring text
+		std::atomic<uint32_t> advance_generation{0};
+
 		font();
 		~font();
 
@@ -151,24 +267,75 @@ namespace util::draw
 		bool calc_glyph_info(uint32_t codepoint,
 		                     glyph_info &glyph_info,
 		                     FT_Glyph &ft_glyph,
-		                     FT_BitmapGlyph &ft_bitmap) const;
+		                     FT_BitmapGlyph &ft_bitmap,
+		                     bool stroked = false) const;
 		void blit_glyph(FT_BitmapGlyph ft_bitmap,
 		                uint8_t *dst,
 		                uint32_t dst_pitch,
-		                const unsigned char *multiply_table = nullptr) const;
+		                const unsigned char *multiply_table = nullptr,
+		                uint32_t max_width                  = 0xFFFFFFFF,
+		                uint32_t max_height                 = 0xFFFFFFFF) const;
+		void blit_glyph_sdf(FT_BitmapGlyph ft_bitmap,
+		                    uint8_t *dst,
+		                    uint32_t dst_pitch,
+		                    uint32_t max_width,
+		                    uint32_t max_height) const;
 
 
 		void clear_output_data();
 		void build_lookup_table();
 		void set_fallback_char(font_wchar c);
+		// Glyphs from the glyph cache stay where they are until the second draw() after the lookup
 		const font_glyph* find_glyph(font_wchar c) const;
+		// Build time only, doesn't load or touch cache cells
 		const font_glyph* find_glyph_no_fallback(font_wchar c) const;
+		const font_glyph* find_outline_glyph(font_wchar c) const;
+		// Rasterizes c into the glyph cache, evicting the least recently used cell that isn't pinned. Null if c has no
+		// glyph or every cell is pinned, the advance of c is known afterwards either way
+		const font_glyph* cache_glyph(font_wchar c);
 
-		float char_advance(font_wchar c) const
+		const glyph_lookup_page& lookup_page(const uint32_t c) const
 		{
-			return (static_cast<uint32_t>(c) < index_advance_x.size())
-				       ? index_advance_x[static_cast<uint32_t>(c)]
-				       : fallback_advance_x;
+			if (c < 0x100)
+				return lookup_page_data[1];
+			const auto page = c >> 8;
+			return lookup_page_data[page < lookup_pages.size() ? lookup_pages[page] : 0];
+		}
+
+		// Lookup entries the glyph cache fills in are read under its lock
+		uint16_t lookup_glyph(const uint32_t c) const
+		{
+			if (!cache || c <= 0x7F)
+				return lookup_page(c).glyph[c & 0xFF];
+			std::lock_guard g(cache->mutex);
+			return lookup_page(c).glyph[c & 0xFF];
+		}
+
+		float lookup_advance(const uint32_t c) const
+		{
+			if (!cache || c <= 0x7F)
+				return lookup_page(c).advance_x[c & 0xFF];
+			std::lock_guard g(cache->mutex);
+			return lookup_page(c).advance_x[c & 0xFF];
+		}
+
+		float char_advance(const uint32_t c) const
+		{
+			// negative until a dynamic glyph has been loaded the first time
+			const auto advance = lookup_advance(c);
+			if (advance >= 0.f)
+				return advance;
+
+			// loading stores the advance even if there was no cell left for the pixels
+			find_glyph(c);
+			const auto loaded = lookup_advance(c);
+			return loaded >= 0.f ? loaded : fallback_advance_x;
+		}
+
+		// Bytes used by the lookup tables, for comparing fonts/ranges
+		size_t lookup_table_size() const
+		{
+			return lookup_pages.size() * sizeof(uint16_t) + lookup_page_data.size() * sizeof(glyph_lookup_page);
 		}
 
 		bool loaded() const
@@ -176,6 +343,18 @@ namespace util::draw
 			return container_atlas != nullptr;
 		}
 
+		bool has_outline_glyphs() const
+		{
+			if (const auto gen = std::atomic_load(&generation))
+				return gen->has_outline_glyphs();
+			return !outline_glyphs.empty();
+		}
+
+		bool sdf() const
+		{
+			return (user_flags & SDF) != 0;
+		}
+
 		const char* debug_name() const
 		{
 			return config_data ? config_data->name.data() : "<unknown>";
@@ -196,6 +375,10 @@ namespace util::draw
 		                      const char **remaining = nullptr) const;
 		const char* calc_word_wrap_pos(float scale, const char *text, const char *text_end, float wrap_width) const;
 		void render_char(draw_buffer *draw_buffer, float size, position pos, pack_color col, font_wchar c) const;
+		// Measures and positions text in one pass without drawing it, see text_cache
+		void layout_text(float size, float wrap_width, const char *text_begin, const char *text_end, text_layout &out) const;
+		// outline_col draws the OUTLINE glyphs below the text in the same pass, alpha 0 disables it. clip_rect is in screen
+		// space, the transform of draw_buffer is taken into account
 		void render_text(draw_buffer *draw_buffer,
 		                 float size,
 		                 position pos,
@@ -203,11 +386,14 @@ namespace util::draw
 		                 const rect &clip_rect,
 		                 const char *text_begin,
 		                 const char *text_end,
-		                 float wrap_width   = 0.0f,
-		                 bool cpu_fine_clip = false) const;
+		                 float wrap_width       = 0.0f,
+		                 bool cpu_fine_clip     = false,
+		                 pack_color outline_col = pack_color{0, 0, 0, 0}) const;
 
 
-		void grow_index(size_t new_size);
+		void reset_lookup_tables();
+		// Allocates the page of c if it still uses the shared empty page
+		glyph_lookup_page& lookup_page_mut(uint32_t c);
 		void add_glyph(font_wchar c,
 		               float x0,
 		               float y0,
@@ -218,7 +404,16 @@ namespace util::draw
 		               float u1,
 		               float v1,
 		               float advance_x);
+		// Outline variant of the glyph added last
+		void add_outline_glyph(float x0, float y0, float x1, float y1, float u0, float v0, float u1, float v1);
 		void add_remap_char(font_wchar dst, font_wchar src, bool overwrite_dst = true);
+		// Makes gen the tables text calls run on, null goes back to the font's own ones after a synchronous build.
+		// Whatever was current before is retired. Call with tex_mutex held
+		void publish_generation(std::shared_ptr<font> gen, bool advances_changed = true);
+		void bump_layout_generation(bool advances_changed);
+		// Pins the glyph cache cells a layout of this font uses for another replay. False if one of them was evicted
+		// since, or a glyph fell back for lack of a cell, the layout has to be redone then
+		bool touch_layout(const text_layout &layout) const;
 	};
 
 	struct glyph_info
@@ -270,6 +465,39 @@ namespace util::draw
 		std::array<int32_t, 1> custom_rect_idx;
 		std::mutex tex_mutex;
 
+		struct dirty_rect
+		{
+			uint32_t x, y, w, h;
+		};
+		// Regions changed since the last upload, backends upload just these unless has_updated is set. Guarded by tex_mutex
+		std::vector<dirty_rect> dirty_rects;
+
+		// Directory for built atlas caches, empty disables them. build() loads the matching file instead of
+		// running freetype when the fonts, sizes, flags and ranges all match, and writes one after a real build.
+		// Only the most recently used files are kept
+		std::string cache_dir;
+
+		// Packer state of the last build, build_incremental packs new fonts into its free space
+		std::unique_ptr<stbrp_context> pack_context;
+		std::vector<stbrp_node> pack_nodes;
+
+		// Counts draw()s, the backends bump it at the start of each. Glyph cache cells looked up since the one before the
+		// last bump are pinned, they may still be in a buffer that gets drawn
+		std::atomic<uint32_t> glyph_frame{0};
+
+		// Fonts from add_font_async, everything below is guarded by tex_mutex
+		struct async_font
+		{
+			font_config cfg;
+			std::promise<font*> promise;
+		};
+		std::vector<async_font> async_queue;    // waiting for the next background build
+		std::vector<async_font> async_building; // part of the running one
+		std::future<std::unique_ptr<font_atlas>> async_build;
+		uint32_t async_build_serial = 0;
+		// Bumped by synchronous changes to config_data, a background build started before one of them is redone
+		uint32_t config_serial = 0;
+
 
 		font_atlas();
 		~font_atlas();
@@ -285,6 +513,13 @@ namespace util::draw
 		                            float size_pixels,
 		                            const font_config *font_cfg    = nullptr,
 		                            const font_wchar *glyph_ranges = nullptr);
+		// Load and build on a background thread into a new atlas generation, fonts added before keep drawing from the
+		// current one until publish_async() swaps it in. The future is ready once the font is usable, null if the build failed
+		std::future<font*> add_font_async(const font_config *font_cfg);
+		std::future<font*> add_font_from_ttf_async(const char *file_name,
+		                                           float size_pixels,
+		                                           const font_config *font_cfg    = nullptr,
+		                                           const font_wchar *glyph_ranges = nullptr);
 		//Skipped Compressed Fonts
 		void remove_font(const font *);
 
@@ -295,6 +530,16 @@ namespace util::draw
 
 
 		bool build(uint32_t extra_flags = 0);
+		// Packs config_data[input_i] into the free space of the current texture and marks the new area dirty.
+		// Returns false if it doesn't fit, callers then do a full build()
+		bool build_incremental(uint32_t input_i);
+		void relink_config_data();
+		// Takes over a finished background build, never waits for a running one. Call with tex_mutex held, the backends
+		// do it at the start of draw(). Every font gets its built copy as font::generation, text calls already running
+		// finish on the tables they loaded. Returns true if a new generation was published
+		bool publish_async();
+		// Starts a background build for async_queue unless one is running. Call with tex_mutex held
+		void start_async_build();
 
 		bool is_built()
 		{
@@ -305,6 +550,8 @@ namespace util::draw
 		                         uint32_t *out_width,
 		                         uint32_t *out_height,
 		                         uint32_t *out_bytes_per_pixel = nullptr);
+		// Expands into a second, 4x larger copy that is kept up to date from then on. The bundled backends upload
+		// the alpha 8 data as a coverage texture instead, this is only for renderers without single channel textures
 		void tex_data_as_rgba_32(uint8_t **out_pixels,
 		                         uint32_t *out_width,
 		                         uint32_t *out_height,
@@ -327,5 +574,11 @@ namespace util::draw
 		                               const position &offset = position{0.f, 0.f});
 
 		void calc_custom_rect_uv(const custom_rect *rect, position *out_uv_min, position *out_uv_max);
+
+		// Share of the texture covered by glyphs, glyph caches and custom rects
+		float utilization() const;
+
+		// Call with tex_mutex held after changing tex_pixels_alpha_8, also updates the rgba copy if there is one
+		void mark_dirty(uint32_t x, uint32_t y, uint32_t w, uint32_t h);
 	};
 }
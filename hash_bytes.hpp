@@ -0,0 +1,21 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace util::draw
+{
+	constexpr uint64_t hash_bytes_seed = 0xcbf29ce484222325ull;
+
+	// FNV-1a, pass the previous result as hash to continue it over more data
+	inline uint64_t hash_bytes(const void* data, const size_t size, uint64_t hash = hash_bytes_seed)
+	{
+		const auto bytes = static_cast<const uint8_t*>(data);
+		for (auto i = size_t{ 0 }; i < size; i++)
+		{
+			hash ^= bytes[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash;
+	}
+}
@@ -0,0 +1,133 @@
+#include "image_atlas.hpp"
+
+#include <cstring>
+
+#define STBRP_ASSERT(x)    assert(x)
+#define STBRP_STATIC
+#define STB_RECT_PACK_IMPLEMENTATION
+#include <stb/stb_rectpack.h>
+
+using namespace util::draw;
+
+image_atlas::image_atlas(draw_manager* manager, const uint32_t page_size, const uint32_t max_image_size)
+	: _manager(manager),
+	  _page_size(page_size),
+	  _max_image_size(std::min(max_image_size, page_size - 2))
+{
+	assert(manager != nullptr && page_size > 2);
+}
+
+image_atlas::~image_atlas()
+{
+	clear();
+}
+
+sub_image image_atlas::add_image(const uint8_t* rgba, const uint32_t width, const uint32_t height)
+{
+	assert(rgba != nullptr && width > 0 && height > 0);
+	std::lock_guard<std::mutex> g(_mutex);
+
+	sub_image out = {};
+	if (width > _max_image_size || height > _max_image_size)
+	{
+		const auto tex = _manager->create_texture(width, height);
+		if (!tex)
+			return out;
+		if (!_manager->set_texture_rgba(tex, rgba, width, height))
+		{
+			_manager->delete_texture(tex);
+			return out;
+		}
+
+		_standalone.emplace_back(tex);
+		out.tex_id = tex;
+		out.uv_min = { 0.f, 0.f };
+		out.uv_max = { 1.f, 1.f };
+		out.size = { static_cast<float>(width), static_cast<float>(height) };
+		return out;
+	}
+
+	for (auto& page : _pages)
+	{
+		if (pack_into(*page, rgba, width, height, out))
+			return out;
+	}
+
+	const auto page = new_page();
+	if (page)
+		pack_into(*page, rgba, width, height, out);
+	return out;
+}
+
+void image_atlas::clear()
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	for (const auto& page : _pages)
+		_manager->delete_texture(page->tex_id);
+	for (const auto tex : _standalone)
+		_manager->delete_texture(tex);
+
+	_pages.clear();
+	_standalone.clear();
+}
+
+image_atlas::page* image_atlas::new_page()
+{
+	auto added = std::make_unique<page>();
+	added->tex_id = _manager->create_texture(_page_size, _page_size);
+	if (!added->tex_id)
+		return nullptr;
+
+	// cleared once, afterwards only the packed rects get uploaded
+	const auto clear = std::vector<uint8_t>(static_cast<size_t>(_page_size) * _page_size * 4u);
+	if (!_manager->set_texture_rgba(added->tex_id, clear.data(), _page_size, _page_size))
+	{
+		_manager->delete_texture(added->tex_id);
+		return nullptr;
+	}
+
+	added->context = std::make_unique<stbrp_context>();
+	added->nodes.resize(_page_size);
+	stbrp_init_target(added->context.get(),
+		static_cast<int>(_page_size),
+		static_cast<int>(_page_size),
+		added->nodes.data(),
+		static_cast<int>(added->nodes.size()));
+
+	_pages.emplace_back(std::move(added));
+	return _pages.back().get();
+}
+
+bool image_atlas::pack_into(page& page, const uint8_t* rgba, const uint32_t width, const uint32_t height, sub_image& out)
+{
+	// 1px border with repeated edge pixels on every side so linear filtering doesn't bleed into the neighbours
+	stbrp_rect rect = {};
+	rect.w = static_cast<stbrp_coord>(width + 2);
+	rect.h = static_cast<stbrp_coord>(height + 2);
+	stbrp_pack_rects(page.context.get(), &rect, 1);
+	if (!rect.was_packed)
+		return false;
+
+	const auto row_size = static_cast<size_t>(width) * 4u;
+	const auto pitch = row_size + 8u;
+	auto pixels = std::vector<uint8_t>(pitch * (height + 2));
+	for (auto y = 0u; y < height + 2; ++y)
+	{
+		const auto src_y = std::clamp(static_cast<int>(y) - 1, 0, static_cast<int>(height) - 1);
+		const auto src = rgba + src_y * row_size;
+		const auto dst = pixels.data() + y * pitch;
+		memcpy(dst, src, 4u);
+		memcpy(dst + 4u, src, row_size);
+		memcpy(dst + 4u + row_size, src + row_size - 4u, 4u);
+	}
+
+	if (!_manager->update_texture_region(page.tex_id, rect.x, rect.y, width + 2, height + 2, pixels.data()))
+		return false;
+
+	const auto inv_size = 1.f / static_cast<float>(_page_size);
+	out.tex_id = page.tex_id;
+	out.uv_min = { (rect.x + 1) * inv_size, (rect.y + 1) * inv_size };
+	out.uv_max = { (rect.x + 1 + width) * inv_size, (rect.y + 1 + height) * inv_size };
+	out.size = { static_cast<float>(width), static_cast<float>(height) };
+	return true;
+}
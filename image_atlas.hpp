@@ -0,0 +1,80 @@
+#pragma once
+
+#include "draw_manager.hpp"
+
+struct stbrp_context;
+struct stbrp_node;
+
+namespace util::draw
+{
+	// A packed image inside one of the atlas pages, invalid if tex_id is null
+	struct sub_image
+	{
+		tex_id tex_id = nullptr;
+		position uv_min = {};
+		position uv_max = {};
+		position size = {};
+
+		bool valid() const
+		{
+			return tex_id != nullptr;
+		}
+	};
+
+	// Packs small user images into shared pages so draws using them end up in the same draw_cmd
+	// Images bigger than max_image_size get their own texture
+	struct image_atlas
+	{
+		image_atlas(draw_manager* manager, uint32_t page_size = 1024, uint32_t max_image_size = 128);
+		~image_atlas();
+
+		image_atlas(const image_atlas&) = delete;
+		image_atlas& operator=(const image_atlas&) = delete;
+
+		sub_image add_image(const uint8_t* rgba, uint32_t width, uint32_t height);
+
+		// Deletes all pages and standalone textures, previously returned sub_images become invalid
+		void clear();
+
+		size_t page_count() const
+		{
+			return _pages.size();
+		}
+
+	private:
+		struct page
+		{
+			tex_id tex_id = nullptr;
+			std::unique_ptr<stbrp_context> context = nullptr;
+			std::vector<stbrp_node> nodes = {};
+		};
+
+		page* new_page();
+		bool pack_into(page& page, const uint8_t* rgba, uint32_t width, uint32_t height, sub_image& out);
+
+		draw_manager* _manager = nullptr;
+		uint32_t _page_size = 0;
+		uint32_t _max_image_size = 0;
+		std::vector<std::unique_ptr<page>> _pages = {};
+		std::vector<tex_id> _standalone = {};
+		std::mutex _mutex;
+	};
+
+	inline void image(draw_buffer* buf,
+		const sub_image& img,
+		const position& top_left,
+		const position& bot_right,
+		const pack_color col = color::white())
+	{
+		assert(img.valid());
+		buf->push_tex_id(img.tex_id);
+		buf->prim_reserve(6, 4);
+		buf->prim_rect_uv(top_left, bot_right, img.uv_min, img.uv_max, col);
+		buf->pop_tex_id();
+	}
+
+	inline void image(draw_buffer* buf, const sub_image& img, const position& top_left, const pack_color col = color::white())
+	{
+		image(buf, img, top_left, top_left + img.size, col);
+	}
+}
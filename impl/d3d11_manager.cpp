@@ -6,6 +6,7 @@
 #include <bit>
 
 #include "shaders_dx11.hpp"
+#include "../blur_kernel.hpp"
 
 using namespace util::draw;
 
@@ -27,6 +28,10 @@ struct pix_size_buf {
 struct pix_scissor_buf {
 	float circle_def[4];
 	float key_color[4];
+	float sdf_params[4];
+	float sdf_outline_color[4];
+	float sdf_glow_color[4];
+	float tex_params[4]; // x = texture0 only holds coverage
 };
 
 struct pix_blur_buf {
@@ -39,15 +44,21 @@ d3d11_manager::d3d11_manager(ID3D11Device* dev, ID3D11DeviceContext* ctx) : _dev
 	init();
 }
 
-static float gauss(float sigma, float x) {
-	float tmp = 1.f / (std::sqrt(2 * 3.141592653589793) * sigma);
-	float tmp2 = std::exp(-0.5 * ((x * x) / (sigma * sigma)));
-	return tmp * tmp2;
-}
-
 void d3d11_manager::draw() {
-	_tex_dict.process_update_queue(_ctx);
-	std::scoped_lock g(_list_mutex, fonts->tex_mutex);
+	std::scoped_lock g(_list_mutex);
+	// nothing looked up by earlier draws is in use anymore
+	_tex_dict.release_retired();
+	collect_frame_textures();
+	_tex_dict.process_update_queue(_ctx, _upload_budget, _frame_textures, _upload_stats);
+	_tex_dict.process_streams(_ctx);
+	{
+		// text calls on other threads rasterize glyph cache misses under tex_mutex, it's only held for the atlas
+		std::scoped_lock tex(fonts->tex_mutex);
+		// a font built in the background replaces the atlas here, before anything reads it this frame
+		fonts->publish_async();
+		// glyph cache cells looked up before the previous draw may be evicted from here on
+		fonts->glyph_frame++;
+	}
 	fonts->locked = true;
 	auto idx_count = 0u;
 	auto vtx_count = 0u;
@@ -65,9 +76,18 @@ void d3d11_manager::draw() {
 		return;
 	}
 
-	if (!_dat.font_tex || fonts->has_updated)
+	auto font_tex = tex_id{};
 	{
-		create_font_texture();
+		std::scoped_lock tex(fonts->tex_mutex);
+		if (!_dat.font_tex || fonts->has_updated)
+		{
+			create_font_texture();
+		}
+		else if (!fonts->dirty_rects.empty())
+		{
+			update_font_texture();
+		}
+		font_tex = fonts->tex_id;
 	}
 
 	if (!_dat.vtx_buf || _dat._vtx_buf_size < vtx_count) {
@@ -243,20 +263,41 @@ void d3d11_manager::draw() {
 	_ctx->PSSetSamplers(1, 1, _dat.buffer_copy_sampler.GetAddressOf());
 	_ctx->PSSetShaderResources(1, 1, _dat.buffer_copy.GetAddressOf());
 
-	const auto font_tex = fonts->tex_id;
+	auto uploaded_alpha_only = -1; // tex_params currently in pix_scissor_buf, -1 before the first upload
 	const auto draw_cmds = [&](draw_buffer* buf_ptr) {
 		for (const auto& cmd : buf_ptr->cmds)
 		{
-			if (cmd.callback)
+			const auto& ext = buf_ptr->cmd_ext(cmd);
+			if (ext.callback)
 			{
-				cmd.callback(&cmd);
+				ext.callback(&cmd, ext);
 			}
 			else if (cmd.elem_count > 0)
 			{
 				RECT clip = { cmd.clip_rect.x, cmd.clip_rect.y, cmd.clip_rect.z,
 													 cmd.clip_rect.w };
+
+				auto tex_id = cmd.tex_id;
+				auto alpha_only = false;
+				if (cmd.font_texture())
+				{
+					tex_id = font_tex;
+					alpha_only = true;
+				}
+				else if (tex_id && !cmd.native_texture())
+				{
+					alpha_only = _tex_dict.alpha_only(reinterpret_cast<slot_handle>(tex_id));
+					tex_id = _tex_dict.texture(reinterpret_cast<slot_handle>(tex_id));
+				}
+
+				if (!tex_id) {
+					tex_id = _tex_dict.texture(_white_tex);
+					alpha_only = false;
+				}
+
 				pix_scissor_buf scissor_buf{};
-				if (cmd.circle_scissor)
+				scissor_buf.tex_params[0] = alpha_only ? 1.f : 0.f;
+				if (cmd.circle_scissor())
 				{
 					// x,y = center; z = radius*radius; screenSpace
 					D3D11_MAPPED_SUBRESOURCE res;
@@ -274,66 +315,34 @@ void d3d11_manager::draw() {
 					scissor_buf.circle_def[2] *= scissor_buf.circle_def[2];
 					std::memcpy(buf, &scissor_buf, sizeof(scissor_buf));
 					_ctx->Unmap(_dat.pix_scissor_buf.Get(), 0);
+					uploaded_alpha_only = alpha_only;
 
 					_ctx->PSSetShader(_dat.scissor_pixel_shader.Get(), nullptr, 0);
 
-					clip = { cmd.circle_outer_clip.x, cmd.circle_outer_clip.y, cmd.circle_outer_clip.z,
-													 cmd.circle_outer_clip.w };
+					clip = { ext.circle_outer_clip.x, ext.circle_outer_clip.y, ext.circle_outer_clip.z,
+													 ext.circle_outer_clip.w };
 				}
 
-				auto tex_id = cmd.tex_id;
-				if (cmd.font_texture)
-					tex_id = font_tex;
-				else if (tex_id && !cmd.native_texture)
-					tex_id = _tex_dict.texture(reinterpret_cast<tex_wrapper_dx11*>(tex_id));
+				// the key color and sdf paths below upload the constants anyway, everything else only needs tex_params
+				if (uploaded_alpha_only != static_cast<int>(alpha_only))
+				{
+					D3D11_MAPPED_SUBRESOURCE res;
+					if (_ctx->Map(_dat.pix_scissor_buf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &res) != S_OK) {
+						return;
+					}
 
-				if (!tex_id) {
-					tex_id = _tex_dict.texture(_white_tex);
+					std::memcpy(res.pData, &scissor_buf, sizeof(scissor_buf));
+					_ctx->Unmap(_dat.pix_scissor_buf.Get(), 0);
+					uploaded_alpha_only = alpha_only;
 				}
 
 				_ctx->RSSetScissorRects(1, &clip);
 				_ctx->PSSetShaderResources(0, 1, reinterpret_cast<ID3D11ShaderResourceView**>(&tex_id));
-				
-				// TODO: i dont use it so it's unsupported
-				/*_device_ptr->SetTransform(
-					D3DTS_WORLD,
-					reinterpret_cast<const D3DMATRIX*>(cmd.matrix.matrix.data()));*/
-				if (cmd.blur_strength)
-				{
-					// TODO: maybe precompute common values?
-					const auto sample_count = std::min(cmd.blur_strength, uint8_t(95 * 2));
-					const auto sigma = static_cast<float>(sample_count) / 3.f;
-					std::array<float, 191> weights;
-					std::array<float, 191> offsets;
-					weights[0] = gauss(sigma, 0);
-					float sum = weights[0];
-					for (int i = 1; i <= sample_count / 2; ++i) {
-						// combined computation courtesy of https://www.rastergrid.com/blog/2010/09/efficient-gaussian-blur-with-linear-sampling/
-						const auto weight1 = gauss(sigma, i * 2);
-						const auto weight2 = gauss(sigma, i * 2 + 1);
-						const auto off1 = (float)i * 2;
-						const auto off2 = off1 + 1;
-						const auto combined_weight = weight1 + weight2;
-						weights[i] = combined_weight;
-						offsets[i] = ((off1 * weight1) + (off2 * weight2)) / combined_weight;
-
-						sum += combined_weight * 2.f;
-					}
-					if (sample_count & 1) {
-						weights[sample_count] = gauss(sigma, sample_count);
-						offsets[sample_count] = sample_count;
-						sum += weights[sample_count] * 2;
-					}
-
-					float sum_inv = 1.f / sum;
-					for (int i = 0; i <= sample_count; ++i) {
-						weights[i] *= sum_inv;
-					}
 
-					// we effectively half the original sample count
-					const auto end_sample_count = (sample_count >> 1) + (sample_count & 1);
-					float sample_vec[4] = { end_sample_count, 0, 0, 0 };
-					const auto f_count = (end_sample_count + 3) / 4; // round up
+				if (ext.blur_strength)
+				{
+					const auto& kernel = blur_kernel_for(ext.blur_strength);
+					const float sample_vec[4] = { static_cast<float>(kernel.taps), 0, 0, 0 };
 
 					{
 						D3D11_MAPPED_SUBRESOURCE sub_res;
@@ -343,55 +352,86 @@ void d3d11_manager::draw() {
 
 						auto* data = reinterpret_cast<pix_blur_buf*>(sub_res.pData);
 						std::memcpy(data->sample_vec, sample_vec, sizeof(sample_vec));
-						std::memcpy(data->weights, weights.data(), sizeof(float) * end_sample_count);
-						std::memcpy(data->offsets, offsets.data(), sizeof(float) * end_sample_count);
+						std::memcpy(data->weights, kernel.weights.data(), sizeof(float) * kernel.taps);
+						std::memcpy(data->offsets, kernel.offsets.data(), sizeof(float) * kernel.taps);
 					
 						_ctx->Unmap(_dat.pix_blur_buf.Get(), 0);
 					}
 
-					for (auto i = 0; i < cmd.blur_pass_count; ++i)
+					for (auto i = 0; i < ext.blur_pass_count; ++i)
 					{
 						// TODO: maybe cache min/max coords in the cmd so we can say somewhat accurately where we draw?
 						_ctx->CopyResource(copy_res.Get(), rt_res.Get());
-						_ctx->PSSetShader(cmd.circle_scissor ? _dat.scissor_blur_x_shader.Get() : _dat.blur_x_pixel_shader.Get(), nullptr, 0);
+						_ctx->PSSetShader(cmd.circle_scissor() ? _dat.scissor_blur_x_shader.Get() : _dat.blur_x_pixel_shader.Get(), nullptr, 0);
 						_ctx->DrawIndexed(cmd.elem_count, idx_off, vtx_off);
 						
 						_ctx->CopyResource(copy_res.Get(), rt_res.Get());
-						_ctx->PSSetShader(cmd.circle_scissor ? _dat.scissor_blur_y_shader.Get() : _dat.blur_y_pixel_shader.Get(), nullptr, 0);
+						_ctx->PSSetShader(cmd.circle_scissor() ? _dat.scissor_blur_y_shader.Get() : _dat.blur_y_pixel_shader.Get(), nullptr, 0);
 						_ctx->DrawIndexed(cmd.elem_count, idx_off, vtx_off);
 					}
 
 					_ctx->PSSetShader(_dat.pix_shader.Get(), nullptr, 0);
 				}
+				else if (cmd.sdf_text())
+				{
+					// takes priority over key colors and circle scissors, the distance field needs its own shader
+					D3D11_MAPPED_SUBRESOURCE res;
+					if (_ctx->Map(_dat.pix_scissor_buf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &res) != S_OK) {
+						return;
+					}
+
+					const auto set_color = [](float* dst, const color col)
+					{
+						dst[0] = col.r() / 255.f;
+						dst[1] = col.g() / 255.f;
+						dst[2] = col.b() / 255.f;
+						dst[3] = col.a() / 255.f;
+					};
+					scissor_buf.sdf_params[0] = ext.sdf.outline_edge();
+					scissor_buf.sdf_params[1] = ext.sdf.glow_edge();
+					set_color(scissor_buf.sdf_outline_color, ext.sdf.outline_width > 0.f ? ext.sdf.outline_color : color{ 0, 0, 0, 0 });
+					set_color(scissor_buf.sdf_glow_color, ext.sdf.glow_width > 0.f ? ext.sdf.glow_color : color{ 0, 0, 0, 0 });
+
+					std::memcpy(res.pData, &scissor_buf, sizeof(scissor_buf));
+					_ctx->Unmap(_dat.pix_scissor_buf.Get(), 0);
+					uploaded_alpha_only = alpha_only;
+
+					_ctx->PSSetShader(_dat.sdf_shader.Get(), nullptr, 0);
+					_ctx->PSSetSamplers(0, 1, _dat.sdf_sampler.GetAddressOf());
+					_ctx->DrawIndexed(cmd.elem_count, idx_off, vtx_off);
+					_ctx->PSSetSamplers(0, 1, _dat.font_sampler.GetAddressOf());
+					_ctx->PSSetShader(_dat.pix_shader.Get(), nullptr, 0);
+				}
 				else
 				{
-					if (cmd.key_color.a() != 0)
+					if (ext.key_color.a() != 0)
 					{
 						D3D11_MAPPED_SUBRESOURCE res;
 						if (_ctx->Map(_dat.pix_scissor_buf.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &res) != S_OK) {
 							return;
 						}
 
-						scissor_buf.key_color[0] = cmd.key_color.r() / 255.f;
-						scissor_buf.key_color[1] = cmd.key_color.g() / 255.f;
-						scissor_buf.key_color[2] = cmd.key_color.b() / 255.f;
+						scissor_buf.key_color[0] = ext.key_color.r() / 255.f;
+						scissor_buf.key_color[1] = ext.key_color.g() / 255.f;
+						scissor_buf.key_color[2] = ext.key_color.b() / 255.f;
 						scissor_buf.key_color[3] = 0.f;
 
 						std::memcpy(res.pData, &scissor_buf, sizeof(scissor_buf));
 						_ctx->Unmap(_dat.pix_scissor_buf.Get(), 0);
+						uploaded_alpha_only = alpha_only;
 
-						_ctx->PSSetShader(cmd.circle_scissor ? _dat.scissor_key_shader.Get() : _dat.key_shader.Get(), nullptr, 0);
+						_ctx->PSSetShader(cmd.circle_scissor() ? _dat.scissor_key_shader.Get() : _dat.key_shader.Get(), nullptr, 0);
 					}
 
 					_ctx->DrawIndexed(cmd.elem_count, idx_off, vtx_off);
 
-					if (cmd.key_color.a() != 0)
+					if (ext.key_color.a() != 0)
 					{
 						_ctx->PSSetShader(_dat.pix_shader.Get(), nullptr, 0);
 					}
 				}
 
-				if (cmd.circle_scissor)
+				if (cmd.circle_scissor())
 				{
 					_ctx->PSSetShader(_dat.pix_shader.Get(), nullptr, 0);
 				}
@@ -427,7 +467,7 @@ void d3d11_manager::draw() {
 bool d3d11_manager::create_font_texture() {
 	uint8_t* pixels;
 	uint32_t width, height, bytes_per_pixel;
-	fonts->tex_data_as_rgba_32(&pixels, &width, &height, &bytes_per_pixel);
+	fonts->tex_data_as_alpha_8(&pixels, &width, &height, &bytes_per_pixel);
 
 	if (pixels == nullptr)
 		return true;
@@ -440,7 +480,7 @@ bool d3d11_manager::create_font_texture() {
 		desc.Height = height;
 		desc.MipLevels = 1;
 		desc.ArraySize = 1;
-		desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		desc.Format = DXGI_FORMAT_A8_UNORM; // coverage only, the shaders use white for the color (tex_params)
 		desc.SampleDesc.Count = 1;
 		//desc.SampleDesc.Quality = 0;
 		desc.Usage = D3D11_USAGE_DEFAULT;
@@ -448,14 +488,14 @@ bool d3d11_manager::create_font_texture() {
 
 		auto sub_res = D3D11_SUBRESOURCE_DATA{};
 		sub_res.pSysMem = pixels;
-		sub_res.SysMemPitch = width * 4;
+		sub_res.SysMemPitch = width * bytes_per_pixel;
 		ComPtr<ID3D11Texture2D> tex;
 		if (_device_ptr->CreateTexture2D(&desc, &sub_res, tex.GetAddressOf()) != S_OK) {
 			return false;
 		}
 
 		auto shader_desc = D3D11_SHADER_RESOURCE_VIEW_DESC{};
-		shader_desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+		shader_desc.Format = desc.Format;
 		shader_desc.ViewDimension = D3D11_SRV_DIMENSION_TEXTURE2D;
 		shader_desc.Texture2D.MipLevels = 1;
 		if (_device_ptr->CreateShaderResourceView(tex.Get(), &shader_desc, _dat.font_tex.ReleaseAndGetAddressOf()) != S_OK) {
@@ -474,10 +514,37 @@ bool d3d11_manager::create_font_texture() {
 		if (_device_ptr->CreateSamplerState(&desc, _dat.font_sampler.ReleaseAndGetAddressOf()) != S_OK) {
 			return false;
 		}
+
+		// distance fields have to be interpolated, point sampling would show the texels when scaled up
+		desc.Filter = D3D11_FILTER_MIN_MAG_MIP_LINEAR;
+		if (_device_ptr->CreateSamplerState(&desc, _dat.sdf_sampler.ReleaseAndGetAddressOf()) != S_OK) {
+			return false;
+		}
 	}
 
 	fonts->tex_id = _dat.font_tex.Get();
 	fonts->has_updated = false;
+	fonts->dirty_rects.clear();
+	return true;
+}
+
+bool d3d11_manager::update_font_texture() {
+	uint8_t* pixels;
+	uint32_t width, height, bytes_per_pixel;
+	fonts->tex_data_as_alpha_8(&pixels, &width, &height, &bytes_per_pixel);
+
+	if (pixels == nullptr)
+		return true;
+
+	ComPtr<ID3D11Resource> res;
+	_dat.font_tex->GetResource(res.GetAddressOf());
+	for (const auto& rect : fonts->dirty_rects) {
+		const auto box = D3D11_BOX{ rect.x, rect.y, 0, rect.x + rect.w, rect.y + rect.h, 1 };
+		_ctx->UpdateSubresource(res.Get(), 0, &box,
+			pixels + (rect.y * width + rect.x) * bytes_per_pixel, width * bytes_per_pixel, 0);
+	}
+
+	fonts->dirty_rects.clear();
 	return true;
 }
 
@@ -590,6 +657,10 @@ bool d3d11_manager::setup_render_data() {
 			return false;
 		}
 
+		if (_device_ptr->CreatePixelShader(shaders::pixel::sdf, sizeof(shaders::pixel::sdf), nullptr, _dat.sdf_shader.ReleaseAndGetAddressOf()) != S_OK) {
+			return false;
+		}
+
 		// pix consts bufs
 		auto desc = D3D11_BUFFER_DESC{};
 		desc.ByteWidth = sizeof(pix_size_buf);
@@ -614,7 +685,7 @@ bool d3d11_manager::setup_render_data() {
 	if (!_white_tex) {
 		_white_tex = _tex_dict.create_texture(2, 2);
 		uint8_t data[] = { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 };
-		if (!_white_tex->set_tex_data(&_tex_dict, _device_ptr, data, 2, 2)) {
+		if (!_tex_dict.set_tex_data(_device_ptr, _white_tex, data, 2, 2)) {
 			return false;
 		}
 	}
@@ -742,9 +813,9 @@ void d3d11_manager::update_screen_size(const position& screen_size)
 	_wvp[15] = 1.f;
 }
 
-tex_id d3d11_manager::create_texture(const uint32_t width, const uint32_t height)
+tex_id d3d11_manager::create_texture(const uint32_t width, const uint32_t height, const TEXTURE_FORMAT format)
 {
-	return reinterpret_cast<tex_id>(_tex_dict.create_texture(width, height));
+	return reinterpret_cast<tex_id>(_tex_dict.create_texture(width, height, format == TEXTURE_FORMAT_A8));
 }
 
 // I'm doing something wrong so we ghetto-fix it
@@ -766,7 +837,7 @@ bool d3d11_manager::set_texture_rgba(const tex_id id, const uint8_t* rgba,
 {
 	assert(id != reinterpret_cast<tex_id>(0));
 
-	if (!id)
+	if (!id || _tex_dict.alpha_only(reinterpret_cast<slot_handle>(id)))
 		return false;
 
 	auto tmp_data = std::vector<uint8_t>{};
@@ -777,21 +848,45 @@ bool d3d11_manager::set_texture_rgba(const tex_id id, const uint8_t* rgba,
 		* 4u);*/
 
 	return _tex_dict.set_tex_data(_device_ptr,
-		reinterpret_cast<tex_wrapper_dx11*>(id),
+		reinterpret_cast<slot_handle>(id),
 		rgba, width, height);
 }
 
+bool d3d11_manager::set_texture_alpha(const tex_id id, const uint8_t* alpha,
+	const uint32_t width, const uint32_t height)
+{
+	assert(id != reinterpret_cast<tex_id>(0));
+
+	if (!id || !_tex_dict.alpha_only(reinterpret_cast<slot_handle>(id)))
+		return false;
+
+	return _tex_dict.set_tex_data(_device_ptr,
+		reinterpret_cast<slot_handle>(id),
+		alpha, width, height);
+}
+
+bool d3d11_manager::update_texture_region(const tex_id id, const uint32_t x, const uint32_t y, const uint32_t w,
+	const uint32_t h, const uint8_t* data, const uint32_t pitch)
+{
+	assert(id != reinterpret_cast<tex_id>(0));
+	if (!id)
+		return false;
+
+	// same layout as set_texture_rgba/set_texture_alpha, the rows go in as they are
+	return _tex_dict.update_region(reinterpret_cast<slot_handle>(id), texture_region{ x, y, w, h }, data, pitch);
+}
+
 // this is broken
 bool d3d11_manager::set_texture_rabg(const tex_id id, const uint8_t* rabg,
 	const uint32_t width, const uint32_t height)
 {
 	assert(id != reinterpret_cast<tex_id>(0));
 
-	if (!id)
+	if (!id || _tex_dict.alpha_only(reinterpret_cast<slot_handle>(id)))
 		return false;
 
 	return _tex_dict.set_tex_data(
-		_device_ptr, reinterpret_cast<tex_wrapper_dx11*>(id), rabg, width, height);
+		_device_ptr, reinterpret_cast<slot_handle>(id), rabg, width, height);
 }
 
 bool d3d11_manager::texture_size(const tex_id id, uint32_t& width,
@@ -801,7 +896,7 @@ bool d3d11_manager::texture_size(const tex_id id, uint32_t& width,
 	if (!id)
 		return false;
 
-	return _tex_dict.texture_size(reinterpret_cast<tex_wrapper_dx11*>(id), width,
+	return _tex_dict.texture_size(reinterpret_cast<slot_handle>(id), width,
 		height);
 }
 
@@ -811,6 +906,17 @@ bool d3d11_manager::delete_texture(const tex_id id)
 	if (!id)
 		return false;
 
-	_tex_dict.destroy_texture(reinterpret_cast<tex_wrapper_dx11*>(id));
+	_tex_dict.destroy_texture(reinterpret_cast<slot_handle>(id));
 	return true;
 }
+
+tex_id d3d11_manager::create_stream_texture(const uint32_t width, const uint32_t height, const TEXTURE_FORMAT format)
+{
+	return reinterpret_cast<tex_id>(
+		_tex_dict.create_stream_texture(_device_ptr, width, height, format == TEXTURE_FORMAT_A8));
+}
+
+stream_buffer* d3d11_manager::stream_texture(const tex_id id)
+{
+	return _tex_dict.stream(reinterpret_cast<slot_handle>(id));
+}
@@ -22,18 +22,25 @@ namespace util::draw {
 
 		auto device_ptr() const { return _device_ptr; }
 
-		tex_id create_texture(uint32_t width, uint32_t height) override;
+		tex_id create_texture(uint32_t width, uint32_t height, TEXTURE_FORMAT format = TEXTURE_FORMAT_RGBA8) override;
 		bool set_texture_rgba(tex_id id, const uint8_t* rgba, uint32_t width,
 			uint32_t height) override;
+		bool set_texture_alpha(tex_id id, const uint8_t* alpha, uint32_t width,
+			uint32_t height) override;
+		bool update_texture_region(tex_id id, uint32_t x, uint32_t y, uint32_t w,
+			uint32_t h, const uint8_t* data, uint32_t pitch = 0) override;
 		bool set_texture_rabg(tex_id id, const uint8_t* rabg, uint32_t width,
 			uint32_t height) override;
 		bool texture_size(tex_id id, uint32_t& width, uint32_t& height) override;
 		bool delete_texture(tex_id id) override;
+		tex_id create_stream_texture(uint32_t width, uint32_t height, TEXTURE_FORMAT format = TEXTURE_FORMAT_RGBA8) override;
+		stream_buffer* stream_texture(tex_id id) override;
 
 		void update_screen_size(const position& screen_size) override;
 
 	protected:
 		bool create_font_texture();
+		bool update_font_texture();
 		bool setup_draw_state();
 		void destroy_draw_state();
 		bool setup_render_data();
@@ -43,7 +50,7 @@ namespace util::draw {
 		ID3D11Device* _device_ptr = nullptr;
 		ID3D11DeviceContext* _ctx = nullptr;
 		static tex_dict_dx11 _tex_dict;
-		tex_wrapper_dx11* _white_tex = nullptr;
+		slot_handle _white_tex = 0;
 
 		float _wvp[16];
 
@@ -52,7 +59,7 @@ namespace util::draw {
 			ComPtr<ID3D11Buffer> idx_buf;
 			ComPtr<IDXGIFactory> factory;
 			ComPtr<ID3D11ShaderResourceView> font_tex;
-			ComPtr<ID3D11SamplerState> font_sampler;
+			ComPtr<ID3D11SamplerState> font_sampler, sdf_sampler;
 			ComPtr<ID3D11InputLayout> input_layout;
 			ComPtr<ID3D11VertexShader> vtx_shader;
 			ComPtr<ID3D11Buffer> vtx_const_buf;
@@ -63,6 +70,7 @@ namespace util::draw {
 			ComPtr<ID3D11PixelShader> scissor_blur_x_shader;
 			ComPtr<ID3D11PixelShader> scissor_blur_y_shader;
 			ComPtr<ID3D11PixelShader> scissor_key_shader;
+			ComPtr<ID3D11PixelShader> sdf_shader;
 			ComPtr<ID3D11PixelShader> blur_x_pixel_shader;
 			ComPtr<ID3D11PixelShader> blur_y_pixel_shader;
 			ComPtr<ID3D11ShaderResourceView> buffer_copy;
@@ -2,6 +2,7 @@
 #include <freetype/freetype.h>
 #include <freetype/ftglyph.h>
 
+#include "../blur_kernel.hpp"
 #include "../draw_manager.hpp"
 #include "d3d9_manager.hpp"
 
@@ -26,19 +27,44 @@ struct d3d9_vertex
 d3d9_manager::d3d9_manager(IDirect3DDevice9* device) : _device_ptr(device)
 {
 	D3DXMatrixIdentity(&_identity);
+	d3d9_tex_wrapper::a8_supported = supports_a8_textures();
 	init();
 };
 
-float gauss(float sigma, float x) {
-	float tmp = 1.f / (std::sqrt(2 * 3.141592653589793) * sigma);
-	float tmp2 = std::exp(-0.5 * ((x * x) / (sigma * sigma)));
-	return tmp * tmp2;
+// Not every d3d9 device samples D3DFMT_A8, checked once since the format can't change with resets
+bool d3d9_manager::supports_a8_textures() const
+{
+	IDirect3D9* d3d = nullptr;
+	if (!_device_ptr || _device_ptr->GetDirect3D(&d3d) != D3D_OK)
+		return false;
+
+	D3DDEVICE_CREATION_PARAMETERS params;
+	D3DDISPLAYMODE mode;
+	const auto supported = _device_ptr->GetCreationParameters(&params) == D3D_OK
+		&& d3d->GetAdapterDisplayMode(params.AdapterOrdinal, &mode) == D3D_OK
+		&& d3d->CheckDeviceFormat(params.AdapterOrdinal, params.DeviceType, mode.Format, D3DUSAGE_DYNAMIC,
+			D3DRTYPE_TEXTURE, D3DFMT_A8) == D3D_OK;
+	d3d->Release();
+	return supported;
 }
 
 void d3d9_manager::draw()
 {
 	//std::lock_guard<std::mutex> g(list_mutex);
-	std::scoped_lock g(_list_mutex, fonts->tex_mutex);
+	std::scoped_lock g(_list_mutex);
+	// nothing looked up by earlier draws is in use anymore
+	_tex_dict.release_retired();
+	collect_frame_textures();
+	_tex_dict.process_update_queue(_upload_budget, _frame_textures, _upload_stats);
+	_tex_dict.process_streams();
+	{
+		// text calls on other threads rasterize glyph cache misses under tex_mutex, it's only held for the atlas
+		std::scoped_lock tex(fonts->tex_mutex);
+		// a font built in the background replaces the atlas here, before anything reads it this frame
+		fonts->publish_async();
+		// glyph cache cells looked up before the previous draw may be evicted from here on
+		fonts->glyph_frame++;
+	}
 	fonts->locked = true;
 	auto idx_count = 0u;
 	auto vtx_count = 0u;
@@ -56,9 +82,18 @@ void d3d9_manager::draw()
 		return;
 	}
 
-	if (!_r.font_texture || fonts->has_updated)
+	auto font_tex = tex_id{};
 	{
-		create_font_texture();
+		std::scoped_lock tex(fonts->tex_mutex);
+		if (!_r.font_texture || fonts->has_updated)
+		{
+			create_font_texture();
+		}
+		else if (!fonts->dirty_rects.empty())
+		{
+			update_font_texture();
+		}
+		font_tex = fonts->tex_id;
 	}
 
 	if (!_vtx_buffer || _vtx_buf_size < vtx_count)
@@ -193,19 +228,20 @@ void d3d9_manager::draw()
 	_device_ptr->SetPixelShader(nullptr);
 	_device_ptr->SetVertexShader(nullptr);
 
-	const auto font_tex = fonts->tex_id;
+	auto fixed_alpha_only = BOOL{ FALSE }; // setup_draw_state starts with D3DTOP_MODULATE
 	const auto draw_cmds = [&](draw_buffer* buf_ptr) {
 		for (const auto& cmd : buf_ptr->cmds)
 		{
-			if (cmd.callback)
+			const auto& ext = buf_ptr->cmd_ext(cmd);
+			if (ext.callback)
 			{
-				cmd.callback(&cmd);
+				ext.callback(&cmd, ext);
 			}
 			else if (cmd.elem_count > 0)
 			{
 				RECT clip = { cmd.clip_rect.x, cmd.clip_rect.y, cmd.clip_rect.z,
 													 cmd.clip_rect.w };
-				if (cmd.circle_scissor)
+				if (cmd.circle_scissor())
 				{
 					// x,y = center; z = radius*radius; screenSpace
 					D3DXVECTOR4 circle_def;
@@ -220,83 +256,65 @@ void d3d9_manager::draw()
 					_device_ptr->SetPixelShader(_r.scissor_pixel_shader);
 					_device_ptr->SetPixelShaderConstantF(5, circle_def, 1);
 
-					clip = { cmd.circle_outer_clip.x, cmd.circle_outer_clip.y, cmd.circle_outer_clip.z,
-													 cmd.circle_outer_clip.w };
+					clip = { ext.circle_outer_clip.x, ext.circle_outer_clip.y, ext.circle_outer_clip.z,
+													 ext.circle_outer_clip.w };
 				}
 
 				auto tex_id = cmd.tex_id;
-				if (cmd.font_texture)
+				auto alpha_only = BOOL{ FALSE };
+				if (cmd.font_texture())
+				{
 					tex_id = font_tex;
-				else if (tex_id && !cmd.native_texture)
-					tex_id = _tex_dict.texture(reinterpret_cast<d3d9_tex_wrapper*>(tex_id));
+					alpha_only = TRUE;
+				}
+				else if (tex_id && !cmd.native_texture())
+				{
+					alpha_only = _tex_dict.alpha_only(reinterpret_cast<slot_handle>(tex_id));
+					tex_id = _tex_dict.texture(reinterpret_cast<slot_handle>(tex_id));
+				}
+				alpha_only = alpha_only && tex_id != nullptr;
 
 				auto sampler_available = BOOL{ tex_id != nullptr };
 				_device_ptr->SetPixelShaderConstantB(1, &sampler_available, 1);
+				_device_ptr->SetPixelShaderConstantB(2, &alpha_only, 1);
+
+				// the fixed function path takes the color from the vertices alone for coverage textures
+				if (alpha_only != fixed_alpha_only)
+				{
+					_device_ptr->SetTextureStageState(0, D3DTSS_COLOROP, alpha_only ? D3DTOP_SELECTARG2 : D3DTOP_MODULATE);
+					fixed_alpha_only = alpha_only;
+				}
 
 				_device_ptr->SetScissorRect(&clip);
 				_device_ptr->SetTexture(/*texture_stage*/ 0u,
 					reinterpret_cast<IDirect3DTexture9*>(tex_id));
-				_device_ptr->SetTransform(
-					D3DTS_WORLD,
-					reinterpret_cast<const D3DMATRIX*>(cmd.matrix.matrix.data()));
-				if (cmd.blur_strength)
+				if (ext.blur_strength)
 				{
 					_device_ptr->SetVertexShader(_r.vertex_shader);
 
-					// TODO: maybe precompute common values?
-					const auto sample_count = std::min(cmd.blur_strength, uint8_t(95 * 2));
-					const auto sigma = static_cast<float>(sample_count) / 3.f;
-					std::array<float, 191> weights;
-					std::array<float, 191> offsets;
-					weights[0] = gauss(sigma, 0);
-					float sum = weights[0];
-					for (int i = 1; i <= sample_count / 2; ++i) {
-						// combined computation courtesy of https://www.rastergrid.com/blog/2010/09/efficient-gaussian-blur-with-linear-sampling/
-						const auto weight1 = gauss(sigma, i*2);
-						const auto weight2 = gauss(sigma, i*2 + 1);
-						const auto off1 = (float)i * 2;
-						const auto off2 = off1 + 1;
-						const auto combined_weight = weight1 + weight2;
-						weights[i] = combined_weight;
-						offsets[i] = ((off1 * weight1) + (off2 * weight2)) / combined_weight;
-
-						sum += combined_weight * 2.f;
-					}
-					if (sample_count & 1) {
-						weights[sample_count] = gauss(sigma, sample_count);
-						offsets[sample_count] = sample_count;
-						sum += weights[sample_count] * 2;
-					}
-
-					float sum_inv = 1.f / sum;
-					for (int i = 0; i <= sample_count; ++i) {
-						weights[i] *= sum_inv;
-					}
-
-					// we effectively half the original sample count
-					const auto end_sample_count = (sample_count >> 1) + (sample_count & 1);
-					float sample_vec[4] = { end_sample_count, 0, 0, 0 };
-					const auto f_count = (end_sample_count + 3) / 4; // round up
+					const auto& kernel = blur_kernel_for(ext.blur_strength);
+					const float sample_vec[4] = { static_cast<float>(kernel.taps), 0, 0, 0 };
+					const auto f_count = (kernel.taps + 3) / 4; // round up
 					_device_ptr->SetPixelShaderConstantF(13, sample_vec, 1);
-					_device_ptr->SetPixelShaderConstantF(14, weights.data(), f_count);
-					_device_ptr->SetPixelShaderConstantF(38, offsets.data(), f_count);
+					_device_ptr->SetPixelShaderConstantF(14, kernel.weights.data(), f_count);
+					_device_ptr->SetPixelShaderConstantF(38, kernel.offsets.data(), f_count);
 
 					_device_ptr->SetSamplerState(1, D3DSAMP_MINFILTER, D3DTEXF_LINEAR);
 					_device_ptr->SetSamplerState(1, D3DSAMP_MAGFILTER, D3DTEXF_LINEAR);
 
-					for (auto i = 0; i < cmd.blur_pass_count; ++i) 
+					for (auto i = 0; i < ext.blur_pass_count; ++i) 
 					{					
 						// TODO: maybe cache min/max coords in the cmd so we can say somewhat accurately where we draw?
 						_device_ptr->StretchRect(back_buffer, &clip, target_surface,
 							&clip, D3DTEXF_NONE);
-						_device_ptr->SetPixelShader(cmd.circle_scissor ? _r.scissor_blur_x_shader : _r.blur_x_pixel_shader);
+						_device_ptr->SetPixelShader(cmd.circle_scissor() ? _r.scissor_blur_x_shader : _r.blur_x_pixel_shader);
 						_device_ptr->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, vtx_offset, 0,
 							cmd.vtx_count, idx_offset,
 							cmd.elem_count / 3);
 
 						_device_ptr->StretchRect(back_buffer, &clip, target_surface,
 							&clip, D3DTEXF_NONE);
-						_device_ptr->SetPixelShader(cmd.circle_scissor ? _r.scissor_blur_y_shader : _r.blur_y_pixel_shader);
+						_device_ptr->SetPixelShader(cmd.circle_scissor() ? _r.scissor_blur_y_shader : _r.blur_y_pixel_shader);
 						_device_ptr->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, vtx_offset, 0,
 							cmd.vtx_count, idx_offset,
 							cmd.elem_count / 3);
@@ -307,30 +325,53 @@ void d3d9_manager::draw()
 					_device_ptr->SetPixelShader(nullptr);
 					_device_ptr->SetVertexShader(nullptr);
 				}
+				else if (cmd.sdf_text())
+				{
+					// takes priority over key colors and circle scissors, the distance field needs its own shader
+					const auto to_vec = [](const color col)
+					{
+						return D3DXVECTOR4{ col.r() / 255.f, col.g() / 255.f, col.b() / 255.f, col.a() / 255.f };
+					};
+					const D3DXVECTOR4 sdf_consts[3] = {
+						{ ext.sdf.outline_edge(), ext.sdf.glow_edge(), 0.f, 0.f },
+						to_vec(ext.sdf.outline_width > 0.f ? ext.sdf.outline_color : color{ 0, 0, 0, 0 }),
+						to_vec(ext.sdf.glow_width > 0.f ? ext.sdf.glow_color : color{ 0, 0, 0, 0 })
+					};
+					_device_ptr->SetPixelShaderConstantF(62, sdf_consts[0], 3);
+					_device_ptr->SetVertexShader(_r.vertex_shader);
+					_device_ptr->SetPixelShader(_r.sdf_shader);
+
+					_device_ptr->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, vtx_offset, 0,
+						cmd.vtx_count, idx_offset,
+						cmd.elem_count / 3);
+
+					_device_ptr->SetVertexShader(nullptr);
+					_device_ptr->SetPixelShader(nullptr);
+				}
 				else
 				{
-					if (cmd.key_color.a() != 0)
+					if (ext.key_color.a() != 0)
 					{
 						_device_ptr->SetVertexShader(_r.vertex_shader);
-						D3DXVECTOR4 vec = { cmd.key_color.r() / 255.f, cmd.key_color.g() / 255.f,
-															 cmd.key_color.b() / 255.f, 0.f };
+						D3DXVECTOR4 vec = { ext.key_color.r() / 255.f, ext.key_color.g() / 255.f,
+															 ext.key_color.b() / 255.f, 0.f };
 						_device_ptr->SetPixelShaderConstantF(8, vec, 1);
 						_device_ptr->SetPixelShader(
-							cmd.circle_scissor ? _r.scissor_key_shader : _r.key_shader);
+							cmd.circle_scissor() ? _r.scissor_key_shader : _r.key_shader);
 					}
 
 					_device_ptr->DrawIndexedPrimitive(D3DPT_TRIANGLELIST, vtx_offset, 0,
 						cmd.vtx_count, idx_offset,
 						cmd.elem_count / 3);
 
-					if (cmd.key_color.a() != 0)
+					if (ext.key_color.a() != 0)
 					{
 						_device_ptr->SetVertexShader(nullptr);
 						_device_ptr->SetPixelShader(nullptr);
 					}
 				}
 
-				if (cmd.circle_scissor)
+				if (cmd.circle_scissor())
 				{
 					_device_ptr->SetVertexShader(nullptr);
 					_device_ptr->SetPixelShader(nullptr);
@@ -414,6 +455,13 @@ void d3d9_manager::setup_shader()
 			&_r.scissor_key_shader);
 	}
 
+	if (!_r.sdf_shader)
+	{
+		_device_ptr->CreatePixelShader(
+			reinterpret_cast<const DWORD*>(shaders::pixel::sdf),
+			&_r.sdf_shader);
+	}
+
 	if (!_r.blur_x_pixel_shader)
 	{
 		_device_ptr->CreatePixelShader(
@@ -553,7 +601,7 @@ bool d3d9_manager::create_font_texture()
 {
 	uint8_t* pixels;
 	uint32_t width, height, bytes_per_pixel;
-	fonts->tex_data_as_rgba_32(&pixels, &width, &height, &bytes_per_pixel);
+	fonts->tex_data_as_alpha_8(&pixels, &width, &height, &bytes_per_pixel);
 
 	if (pixels == nullptr)
 		return true;
@@ -563,7 +611,7 @@ bool d3d9_manager::create_font_texture()
 
 	_r.font_texture = nullptr;
 	if (_device_ptr->CreateTexture(width, height, 1, D3DUSAGE_DYNAMIC,
-		D3DFMT_A8R8G8B8, D3DPOOL_DEFAULT,
+		d3d9_tex_wrapper::alpha_format(), D3DPOOL_DEFAULT,
 		&_r.font_texture, nullptr)
 		!= D3D_OK)
 		return false;
@@ -572,16 +620,45 @@ bool d3d9_manager::create_font_texture()
 	if (_r.font_texture->LockRect(0, &locked_rect, nullptr, 0) != D3D_OK)
 		return false;
 	for (auto i = 0u; i < height; i++)
-		std::memcpy(reinterpret_cast<unsigned char*>(locked_rect.pBits)
+		d3d9_tex_wrapper::write_alpha_row(reinterpret_cast<unsigned char*>(locked_rect.pBits)
 			+ locked_rect.Pitch * i,
 			pixels + (width * bytes_per_pixel) * i,
-			(width * bytes_per_pixel));
+			width);
 
 	_r.font_texture->UnlockRect(0);
 
 	fonts->tex_id = _r.font_texture;
 	fonts->has_updated = false;
+	fonts->dirty_rects.clear();
+
+	return true;
+}
+
+bool d3d9_manager::update_font_texture()
+{
+	uint8_t* pixels;
+	uint32_t width, height, bytes_per_pixel;
+	fonts->tex_data_as_alpha_8(&pixels, &width, &height, &bytes_per_pixel);
 
+	if (pixels == nullptr)
+		return true;
+
+	for (const auto& dirty : fonts->dirty_rects)
+	{
+		const auto rect = RECT{ static_cast<LONG>(dirty.x), static_cast<LONG>(dirty.y),
+			static_cast<LONG>(dirty.x + dirty.w), static_cast<LONG>(dirty.y + dirty.h) };
+		D3DLOCKED_RECT locked_rect;
+		if (_r.font_texture->LockRect(0, &locked_rect, &rect, 0) != D3D_OK)
+			return false;
+		for (auto i = 0u; i < dirty.h; i++)
+			d3d9_tex_wrapper::write_alpha_row(reinterpret_cast<unsigned char*>(locked_rect.pBits)
+				+ locked_rect.Pitch * i,
+				pixels + ((dirty.y + i) * width + dirty.x) * bytes_per_pixel,
+				dirty.w);
+		_r.font_texture->UnlockRect(0);
+	}
+
+	fonts->dirty_rects.clear();
 	return true;
 }
 
@@ -626,6 +703,11 @@ void d3d9_manager::invalidate_shader()
 		_r.scissor_key_shader->Release();
 		_r.scissor_key_shader = nullptr;
 	}
+	if (_r.sdf_shader)
+	{
+		_r.sdf_shader->Release();
+		_r.sdf_shader = nullptr;
+	}
 	if (_r.blur_x_pixel_shader) {
 		_r.blur_x_pixel_shader->Release();
 		_r.blur_x_pixel_shader = nullptr;
@@ -673,9 +755,9 @@ bool d3d9_manager::invalidate_device_objects()
 	return true;
 }
 
-tex_id d3d9_manager::create_texture(const uint32_t width, const uint32_t height)
+tex_id d3d9_manager::create_texture(const uint32_t width, const uint32_t height, const TEXTURE_FORMAT format)
 {
-	return reinterpret_cast<tex_id>(_tex_dict.create_texture(width, height));
+	return reinterpret_cast<tex_id>(_tex_dict.create_texture(width, height, format == TEXTURE_FORMAT_A8));
 }
 
 // Idk why directx seems to be using RABG internally, mabye not, IDK!!! this is weird, fuck directx
@@ -695,7 +777,7 @@ bool d3d9_manager::set_texture_rgba(const tex_id id, const uint8_t* rgba,
 {
 	assert(id != reinterpret_cast<tex_id>(0));
 
-	if (!id)
+	if (!id || _tex_dict.alpha_only(reinterpret_cast<slot_handle>(id)))
 		return false;
 
 	auto tmp_data = std::vector<uint8_t>{};
@@ -706,20 +788,53 @@ bool d3d9_manager::set_texture_rgba(const tex_id id, const uint8_t* rgba,
 		* 4u);
 
 	return _tex_dict.set_tex_data(_device_ptr,
-		reinterpret_cast<d3d9_tex_wrapper*>(id),
+		reinterpret_cast<slot_handle>(id),
 		tmp_data.data(), width, height);
 }
 
-bool d3d9_manager::set_texture_rabg(const tex_id id, const uint8_t* rabg,
+bool d3d9_manager::set_texture_alpha(const tex_id id, const uint8_t* alpha,
 	const uint32_t width, const uint32_t height)
 {
 	assert(id != reinterpret_cast<tex_id>(0));
 
+	if (!id || !_tex_dict.alpha_only(reinterpret_cast<slot_handle>(id)))
+		return false;
+
+	return _tex_dict.set_tex_data(
+		_device_ptr, reinterpret_cast<slot_handle>(id), alpha, width, height);
+}
+
+bool d3d9_manager::update_texture_region(const tex_id id, const uint32_t x, const uint32_t y, const uint32_t w,
+	const uint32_t h, const uint8_t* data, const uint32_t pitch)
+{
+	assert(id != reinterpret_cast<tex_id>(0));
 	if (!id)
 		return false;
 
+	const auto handle = reinterpret_cast<slot_handle>(id);
+	if (_tex_dict.alpha_only(handle))
+		return _tex_dict.update_region(handle, texture_region{ x, y, w, h }, data, pitch);
+
+	// A8R8G8B8 like set_texture_rgba, converted into packed rows
+	const auto row_size = w * 4u;
+	auto tmp_data = std::vector<uint8_t>{};
+	tmp_data.resize(row_size * h);
+	for (auto row = 0u; row < h; ++row)
+		copy_convert(data + row * (pitch ? pitch : row_size), tmp_data.data() + row * row_size, row_size);
+
+	return _tex_dict.update_region(handle, texture_region{ x, y, w, h }, tmp_data.data(), row_size);
+}
+
+bool d3d9_manager::set_texture_rabg(const tex_id id, const uint8_t* rabg,
+	const uint32_t width, const uint32_t height)
+{
+	assert(id != reinterpret_cast<tex_id>(0));
+
+	if (!id || _tex_dict.alpha_only(reinterpret_cast<slot_handle>(id)))
+		return false;
+
 	return _tex_dict.set_tex_data(
-		_device_ptr, reinterpret_cast<d3d9_tex_wrapper*>(id), rabg, width, height);
+		_device_ptr, reinterpret_cast<slot_handle>(id), rabg, width, height);
 }
 
 bool d3d9_manager::texture_size(const tex_id id, uint32_t& width,
@@ -729,7 +844,7 @@ bool d3d9_manager::texture_size(const tex_id id, uint32_t& width,
 	if (!id)
 		return false;
 
-	return _tex_dict.texture_size(reinterpret_cast<d3d9_tex_wrapper*>(id), width,
+	return _tex_dict.texture_size(reinterpret_cast<slot_handle>(id), width,
 		height);
 }
 
@@ -739,10 +854,21 @@ bool d3d9_manager::delete_texture(const tex_id id)
 	if (!id)
 		return false;
 
-	_tex_dict.destroy_texture(reinterpret_cast<d3d9_tex_wrapper*>(id));
+	_tex_dict.destroy_texture(reinterpret_cast<slot_handle>(id));
 	return true;
 }
 
+tex_id d3d9_manager::create_stream_texture(const uint32_t width, const uint32_t height, const TEXTURE_FORMAT format)
+{
+	return reinterpret_cast<tex_id>(
+		_tex_dict.create_stream_texture(_device_ptr, width, height, format == TEXTURE_FORMAT_A8));
+}
+
+stream_buffer* d3d9_manager::stream_texture(const tex_id id)
+{
+	return _tex_dict.stream(reinterpret_cast<slot_handle>(id));
+}
+
 void d3d9_manager::update_screen_size(const position& screen_size)
 {
 	_screen_size = screen_size;
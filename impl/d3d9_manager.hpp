@@ -23,6 +23,8 @@ namespace util::draw
 		IDirect3DPixelShader9* scissor_blur_y_shader = nullptr;
 		IDirect3DPixelShader9* scissor_key_shader = nullptr;
 
+		IDirect3DPixelShader9* sdf_shader = nullptr;
+
 		IDirect3DPixelShader9* blur_x_pixel_shader = nullptr;
 		IDirect3DPixelShader9* blur_y_pixel_shader = nullptr;
 
@@ -44,18 +46,26 @@ namespace util::draw
 
 		auto device_ptr() const { return _device_ptr; }
 
-		tex_id create_texture(uint32_t width, uint32_t height) override;
+		tex_id create_texture(uint32_t width, uint32_t height, TEXTURE_FORMAT format = TEXTURE_FORMAT_RGBA8) override;
 		bool set_texture_rgba(tex_id id, const uint8_t* rgba, uint32_t width,
 			uint32_t height) override;
+		bool set_texture_alpha(tex_id id, const uint8_t* alpha, uint32_t width,
+			uint32_t height) override;
+		bool update_texture_region(tex_id id, uint32_t x, uint32_t y, uint32_t w,
+			uint32_t h, const uint8_t* data, uint32_t pitch = 0) override;
 		bool set_texture_rabg(tex_id id, const uint8_t* rabg, uint32_t width,
 			uint32_t height) override;
 		bool texture_size(tex_id id, uint32_t& width, uint32_t& height) override;
 		bool delete_texture(tex_id id) override;
+		tex_id create_stream_texture(uint32_t width, uint32_t height, TEXTURE_FORMAT format = TEXTURE_FORMAT_RGBA8) override;
+		stream_buffer* stream_texture(tex_id id) override;
 
 		void update_screen_size(const position& screen_size) override;
 
 	protected:
+		bool supports_a8_textures() const;
 		bool create_font_texture();
+		bool update_font_texture();
 		bool setup_draw_state();
 		void destroy_draw_state();
 		void setup_shader();
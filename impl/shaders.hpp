@@ -16,6 +16,7 @@ namespace shaders
 #include "shaders/cpp/pixel/scissor_blur_x.h"
 #include "shaders/cpp/pixel/scissor_blur_y.h"
 #include "shaders/cpp/pixel/scissor_key.h"
+#include "shaders/cpp/pixel/sdf.h"
 	}  // namespace pixel
 
 }  // namespace shaders
@@ -15,7 +15,7 @@ cbuffer blurBuf : register(b2)
 static float blur_weights[96] = (float[96]) blur_weights_packed;
 static float blur_offsets[96] = (float[96]) blur_offsets_packed;
 
-// we could make this even faster by using the weighted offsets from https://www.rastergrid.com/blog/2010/09/efficient-gaussian-blur-with-linear-sampling/
+// the offsets sit between texels, the linear sampler blends the texels a tap stands for (see blur_kernel.hpp)
 float3 blur(float2 pos, bool x_dir)
 {
     float2 step = float2(1 / dimension.x, 1 / dimension.y);
@@ -30,8 +30,8 @@ float3 blur(float2 pos, bool x_dir)
 		[loop]
         for (int i = 1; i < it; ++i)
         {
-            col += rtCopyTex.SampleGrad(rtCopySampler, pos + float2(step.x * int(blur_offsets[i]), 0), test.x, test.y).rgb * blur_weights[i];
-            col += rtCopyTex.SampleGrad(rtCopySampler, pos - float2(step.x * int(blur_offsets[i]), 0), test.x, test.y).rgb * blur_weights[i];
+            col += rtCopyTex.SampleGrad(rtCopySampler, pos + float2(step.x * blur_offsets[i], 0), test.x, test.y).rgb * blur_weights[i];
+            col += rtCopyTex.SampleGrad(rtCopySampler, pos - float2(step.x * blur_offsets[i], 0), test.x, test.y).rgb * blur_weights[i];
         }
     }
     else
@@ -39,8 +39,8 @@ float3 blur(float2 pos, bool x_dir)
 		[loop]
         for (int i = 1; i < it; ++i)
         {
-            col += rtCopyTex.SampleGrad(rtCopySampler, pos + float2(0, step.y * int(blur_offsets[i])), test.x, test.y).rgb * blur_weights[i];
-            col += rtCopyTex.SampleGrad(rtCopySampler, pos - float2(0, step.y * int(blur_offsets[i])), test.x, test.y).rgb * blur_weights[i];
+            col += rtCopyTex.SampleGrad(rtCopySampler, pos + float2(0, step.y * blur_offsets[i]), test.x, test.y).rgb * blur_weights[i];
+            col += rtCopyTex.SampleGrad(rtCopySampler, pos - float2(0, step.y * blur_offsets[i]), test.x, test.y).rgb * blur_weights[i];
         }
     }
 
@@ -17,10 +17,22 @@ cbuffer scissorBuf : register(b1)
 {
     float4 scissor;
     float4 key_color;
+    float4 sdf_params; // x = outline edge, y = glow edge
+    float4 sdf_outline_color;
+    float4 sdf_glow_color;
+    float4 tex_params; // x = texture0 only holds coverage (alpha 8 textures like the font atlas)
 }
 
 sampler curtex : register(s0);
 Texture2D texture0 : register(t0);
 
+float4 sample_texture0(float2 uv)
+{
+    float4 col = texture0.Sample(curtex, uv);
+    if (tex_params.x > 0)
+        col.rgb = float3(1, 1, 1);
+    return col;
+}
+
 sampler rtCopySampler : register(s1);
 Texture2D rtCopyTex : register(t1);
\ No newline at end of file
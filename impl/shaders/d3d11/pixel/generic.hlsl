@@ -2,6 +2,6 @@
 
 float4 main(VS_OUTPUT IN) : SV_TARGET
 {
-    float4 col = IN.color0 * texture0.Sample(curtex, IN.texcoord0);
+    float4 col = IN.color0 * sample_texture0(IN.texcoord0);
     return col;
 }
\ No newline at end of file
@@ -18,7 +18,7 @@ float4 main(VS_OUTPUT IN) : SV_TARGET
     float distToEdge = sqrt(scissor.z) - sqrt(distSqr);
     float alpha = saturate(distToEdge);
     
-    color = IN.color0 * texture0.Sample(curtex, IN.texcoord0);
+    color = IN.color0 * sample_texture0(IN.texcoord0);
     color.a *= alpha;
     
     return color;
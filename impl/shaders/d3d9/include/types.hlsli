@@ -29,5 +29,18 @@ float4 key : register(c8);
 
 row_major float4x4 worldViewProj : register(c9); // 9-12
 
+float4 sdf_params : register(c62); // x = outline edge, y = glow edge
+float4 sdf_outline_color : register(c63);
+float4 sdf_glow_color : register(c64);
+
 /*bool overlay : register(b0);*/
-bool samplerAvailable : register(b1);
\ No newline at end of file
+bool samplerAvailable : register(b1);
+bool texAlphaOnly : register(b2); // curtex only holds coverage (alpha 8 textures like the font atlas)
+
+float4 sample_curtex(float2 uv)
+{
+	float4 col = tex2D(curtex, uv);
+	if (texAlphaOnly)
+		col.rgb = float3(1, 1, 1);
+	return col;
+}
\ No newline at end of file
@@ -19,7 +19,7 @@ PS_OUTPUT main(VS_OUTPUT IN)
 	float alpha      = saturate(distToEdge);
 	if (samplerAvailable)
 	{
-		OUT.color   = tex2D(curtex, IN.texcoord0);
+		OUT.color   = sample_curtex(IN.texcoord0);
 	} else
 	{
 		OUT.color = IN.color0;
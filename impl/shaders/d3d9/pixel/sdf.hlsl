@@ -0,0 +1,24 @@
+#include "../include/types.hlsli"
+
+// straight alpha "src over dst"
+float4 over(float4 src, float4 dst)
+{
+	float a = src.a + dst.a * (1 - src.a);
+	if (a <= 0)
+		return float4(0, 0, 0, 0);
+	return float4((src.rgb * src.a + dst.rgb * dst.a * (1 - src.a)) / a, a);
+}
+
+// keep in sync with util::draw::sdf_shade
+PS_OUTPUT main(VS_OUTPUT IN)
+{
+	PS_OUTPUT OUT;
+
+	float dist = tex2D(curtex, IN.texcoord0).a;
+	float w = max(fwidth(dist) * 0.5, 1.0 / 255.0);
+
+	float4 col = float4(sdf_glow_color.rgb, sdf_glow_color.a * smoothstep(sdf_params.y, 0.5, dist));
+	col = over(float4(sdf_outline_color.rgb, sdf_outline_color.a * smoothstep(sdf_params.x - w, sdf_params.x + w, dist)), col);
+	OUT.color = over(float4(IN.color0.rgb, IN.color0.a * smoothstep(0.5 - w, 0.5 + w, dist)), col);
+	return OUT;
+}
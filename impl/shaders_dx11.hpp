@@ -17,6 +17,7 @@ namespace shaders
 #include "shaders/cpp/d3d11/pixel/scissor_blur_y.h"
 #include "shaders/cpp/d3d11/pixel/key.h"
 #include "shaders/cpp/d3d11/pixel/scissor_key.h"
+#include "shaders/cpp/d3d11/pixel/sdf.h"
 	}  // namespace pixel
 
 }  // namespace shaders
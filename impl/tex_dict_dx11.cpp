@@ -7,25 +7,31 @@
 using namespace util::draw;
 using Microsoft::WRL::ComPtr;
 
-void tex_wrapper_dx11::create(ID3D11Device* device)
+void tex_wrapper_dx11::create(ID3D11Device* device, tex_retired_dx11& retired)
 {
-	if (_texture)
-		_texture->Release();
-	if (_res_view)
-		_res_view->Release();
-	_texture = nullptr;
-	_res_view = nullptr;
+	retire(retired);
 
 	auto desc = D3D11_TEXTURE2D_DESC{};
 	desc.Width = _size_x;
 	desc.Height = _size_y;
 	desc.MipLevels = 1;
 	desc.ArraySize = 1;
-	desc.Format = DXGI_FORMAT_R8G8B8A8_UNORM;
+	desc.Format = alpha_only ? DXGI_FORMAT_A8_UNORM : DXGI_FORMAT_R8G8B8A8_UNORM;
 	desc.SampleDesc.Count = 1;
 	desc.Usage = D3D11_USAGE_DEFAULT;
-	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE | D3D11_BIND_RENDER_TARGET;
-	desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
+	desc.BindFlags = D3D11_BIND_SHADER_RESOURCE;
+	if (stream)
+	{
+		// written with Map every frame, dynamic textures can't be shared or rendered to
+		desc.Usage = D3D11_USAGE_DYNAMIC;
+		desc.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
+	}
+	else if (!alpha_only)
+	{
+		// sharing needs a 4 channel format
+		desc.BindFlags |= D3D11_BIND_RENDER_TARGET;
+		desc.MiscFlags = D3D11_RESOURCE_MISC_SHARED;
+	}
 
 	auto res = device->CreateTexture2D(&desc, nullptr, &_texture);
 
@@ -40,12 +46,13 @@ void tex_wrapper_dx11::create(ID3D11Device* device)
 	srv_desc.Texture2D.MipLevels = 1;
 	res = device->CreateShaderResourceView(_texture, &srv_desc, &_res_view);
 	assert(res == S_OK);
+	_published_view.store(_res_view, std::memory_order_release);
 }
 
-bool tex_wrapper_dx11::set_tex_data(tex_dict_dx11* dict, ID3D11Device* device, const uint8_t* data, const uint32_t size_x,
-	const uint32_t size_y)
+bool tex_wrapper_dx11::set_tex_data(ID3D11Device* device, const uint8_t* data, const uint32_t size_x,
+	const uint32_t size_y, tex_retired_dx11& retired)
 {
-	_texture_data.resize(size_x * size_y * 4);
+	_texture_data.resize(size_x * size_y * bytes_per_pixel());
 	std::copy(data, data + _texture_data.size(), _texture_data.begin());
 
 	auto changed = _size_x != size_x || _size_y != size_y;
@@ -54,70 +61,237 @@ bool tex_wrapper_dx11::set_tex_data(tex_dict_dx11* dict, ID3D11Device* device, c
 	_size_y = size_y;
 	if (!_texture || changed)
 	{
-		create(device);
+		create(device, retired);
 	}
 
-	std::scoped_lock g{dict->_update_queue_lock};
-	if (std::find(dict->_update_queue.begin(), dict->_update_queue.end(), this) == dict->_update_queue.end()) {
-		dict->_update_queue.push_back(this);
+	_dirty_regions.assign(1, texture_region{ 0, 0, size_x, size_y });
+	return true;
+}
+
+bool tex_wrapper_dx11::update_region(const texture_region& region, const uint8_t* data, uint32_t pitch)
+{
+	if (!_texture || region.x + region.w > _size_x || region.y + region.h > _size_y)
+		return false;
+
+	const auto row_size = region.w * bytes_per_pixel();
+	if (!pitch)
+		pitch = row_size;
+
+	auto dst = _texture_data.data() + (region.y * _size_x + region.x) * bytes_per_pixel();
+	for (auto row = 0u; row < region.h; ++row)
+	{
+		std::copy(data, data + row_size, dst);
+		data += pitch;
+		dst += _size_x * bytes_per_pixel();
 	}
 
+	add_dirty_region(_dirty_regions, region);
 	return true;
 }
 
-bool tex_wrapper_dx11::apply_tex_changes(ID3D11DeviceContext* ctx) {
-	return copy_texture_data(ctx);
+size_t tex_wrapper_dx11::apply_tex_changes(ID3D11DeviceContext* ctx, const size_t max_bytes, const bool at_least_one)
+{
+	if (!_texture)
+	{
+		_dirty_regions.clear();
+		return 0;
+	}
+
+	// only what changed since the last upload, set_tex_data marks everything
+	const auto pitch = _size_x * bytes_per_pixel();
+	auto uploaded = size_t{ 0 };
+	auto done = 0u;
+	for (; done < _dirty_regions.size(); done++)
+	{
+		const auto& region = _dirty_regions[done];
+		const auto bytes = static_cast<size_t>(region.w) * region.h * bytes_per_pixel();
+		const auto fits = uploaded <= max_bytes && bytes <= max_bytes - uploaded;
+		if (!fits && !(at_least_one && done == 0))
+			break;
+
+		auto box = D3D11_BOX{};
+		box.left = region.x;
+		box.top = region.y;
+		box.front = 0;
+		box.back = 1;
+		box.right = region.x + region.w;
+		box.bottom = region.y + region.h;
+
+		const auto src = _texture_data.data() + region.y * pitch + region.x * bytes_per_pixel();
+		ctx->UpdateSubresource(_texture, 0, &box, src, pitch, pitch * region.h);
+		uploaded += bytes;
+	}
+	_dirty_regions.erase(_dirty_regions.begin(), _dirty_regions.begin() + done);
+
+	return uploaded;
 }
 
-bool tex_wrapper_dx11::copy_texture_data(ID3D11DeviceContext* ctx)
+bool tex_wrapper_dx11::create_stream(ID3D11Device* device, const uint32_t size_x, const uint32_t size_y,
+	tex_retired_dx11& retired)
 {
-	auto box = D3D11_BOX{};
-	box.left = 0;
-	box.top = 0;
-	box.front = 0;
-	box.back = 1;
-	box.right = _size_x;
-	box.bottom = _size_y;
+	_size_x = size_x;
+	_size_y = size_y;
+	stream = std::make_unique<stream_buffer>(size_x, size_y, bytes_per_pixel());
+	create(device, retired);
+	return _texture != nullptr;
+}
 
-	ctx->UpdateSubresource(_texture, 0, &box, _texture_data.data(), _size_x * 4, _size_x * _size_y * 4);
+bool tex_wrapper_dx11::upload_stream(ID3D11DeviceContext* ctx)
+{
+	const auto frame = _texture ? stream->consume() : nullptr;
+	if (!frame)
+		return false;
+
+	D3D11_MAPPED_SUBRESOURCE res;
+	if (ctx->Map(_texture, 0, D3D11_MAP_WRITE_DISCARD, 0, &res) != S_OK)
+		return false;
+
+	// the mapped rows are usually padded, so one copy per row straight from the staging frame
+	auto src = frame;
+	auto dst = reinterpret_cast<uint8_t*>(res.pData);
+	for (auto y = 0u; y < _size_y; ++y)
+	{
+		std::copy(src, src + stream->pitch(), dst);
+		src += stream->pitch();
+		dst += res.RowPitch;
+	}
 
+	ctx->Unmap(_texture, 0);
 	return true;
 }
 
+size_t tex_wrapper_dx11::pending_bytes() const
+{
+	auto bytes = size_t{ 0 };
+	for (const auto& region : _dirty_regions)
+		bytes += static_cast<size_t>(region.w) * region.h * bytes_per_pixel();
+	return bytes;
+}
+
+bool tex_dict_dx11::set_tex_data(ID3D11Device* device, const slot_handle tex, const uint8_t* data, const uint32_t size_x,
+	const uint32_t size_y)
+{
+	std::scoped_lock g(_mutex);
+	const auto wrapper = _textures.get(tex);
+	if (!wrapper || !wrapper->set_tex_data(device, data, size_x, size_y, _retired))
+		return false;
+
+	queue_update(tex, wrapper);
+	return true;
+}
+
+bool tex_dict_dx11::update_region(const slot_handle tex, const texture_region& region, const uint8_t* data,
+	const uint32_t pitch)
+{
+	std::scoped_lock g(_mutex);
+	const auto wrapper = _textures.get(tex);
+	if (!wrapper || !wrapper->update_region(region, data, pitch))
+		return false;
+
+	queue_update(tex, wrapper);
+	return true;
+}
+
+void tex_dict_dx11::queue_update(const slot_handle tex, tex_wrapper_dx11* wrapper)
+{
+	if (wrapper->queued)
+		return;
+
+	std::scoped_lock q{_update_queue_lock};
+	wrapper->queued = true;
+	_update_queue.push_back(tex);
+}
+
 void tex_dict_dx11::clear_textures()
+{
+	{
+		std::scoped_lock g(_mutex);
+		_textures.for_each([this](tex_wrapper_dx11& tex) { tex.clear_data(_retired); });
+		_textures.clear();
+	}
+	release_retired();
+}
+
+void tex_dict_dx11::release_retired()
 {
 	std::scoped_lock g(_mutex);
-	for (auto& tex : _textures)
-		if (!tex.free)
-			tex.clear_data();
-	_textures.clear();
+	for (const auto object : _retired.objects)
+		object->Release();
+	_retired.objects.clear();
+	_retired.streams.clear();
 }
 
-tex_wrapper_dx11* tex_dict_dx11::create_texture(uint32_t size_x, uint32_t size_y)
+slot_handle tex_dict_dx11::create_texture(uint32_t size_x, uint32_t size_y, const bool alpha_only)
 {
 	std::scoped_lock g(_mutex);
 
-	_textures.emplace_front();
-	const auto ptr = &_textures.front();
-	_valid_elements.emplace_back(ptr);
-	return ptr;
+	auto tex = tex_wrapper_dx11{};
+	tex.alpha_only = alpha_only;
+	return _textures.insert(std::move(tex));
 }
 
-void tex_dict_dx11::destroy_texture(tex_wrapper_dx11* tex)
+slot_handle tex_dict_dx11::create_stream_texture(ID3D11Device* device, uint32_t size_x, uint32_t size_y,
+	const bool alpha_only)
 {
 	std::scoped_lock g(_mutex);
-	if (!is_valid_tex(tex))
+
+	auto tex = tex_wrapper_dx11{};
+	tex.alpha_only = alpha_only;
+	const auto handle = _textures.insert(std::move(tex));
+	if (!handle)
+		return 0;
+
+	// created in place, moving wrappers around copies their com pointers
+	const auto wrapper = _textures.get(handle);
+	if (!wrapper->create_stream(device, size_x, size_y, _retired))
+	{
+		wrapper->clear_data(_retired);
+		_textures.erase(handle);
+		return 0;
+	}
+
+	_streams.push_back(handle);
+	return handle;
+}
+
+void tex_dict_dx11::destroy_texture(const slot_handle tex)
+{
+	std::scoped_lock g(_mutex);
+	const auto wrapper = _textures.get(tex);
+	if (!wrapper)
 		return;
 
-	tex->clear_data();
-	_valid_elements.erase(std::find(_valid_elements.begin(), _valid_elements.end(), tex));
-	_textures.remove_if([tex](const auto& elem) { return &elem == tex; });
+	wrapper->clear_data(_retired);
+	_textures.erase(tex);
 }
 
-void tex_dict_dx11::process_update_queue(ID3D11DeviceContext* ctx) {
-	std::scoped_lock g{_update_queue_lock};
-	for (auto entry : _update_queue) {
-		entry->apply_tex_changes(ctx);
-	}
-	_update_queue.clear();
-}
\ No newline at end of file
+void tex_dict_dx11::process_update_queue(ID3D11DeviceContext* ctx, const size_t budget,
+	const std::vector<slot_handle>& frame_textures, texture_upload_stats& stats) {
+	// handles destroyed since they were queued just don't resolve anymore
+	std::scoped_lock g{_mutex, _update_queue_lock};
+	schedule_texture_uploads(_update_queue, frame_textures, budget, stats,
+		[&](const slot_handle tex, const size_t max_bytes, const bool at_least_one) -> std::pair<size_t, size_t> {
+			const auto wrapper = _textures.get(tex);
+			if (!wrapper)
+				return { 0u, 0u };
+
+			const auto uploaded = wrapper->apply_tex_changes(ctx, max_bytes, at_least_one);
+			const auto pending = wrapper->pending_bytes();
+			wrapper->queued = pending != 0;
+			return { uploaded, pending };
+		});
+}
+
+void tex_dict_dx11::process_streams(ID3D11DeviceContext* ctx)
+{
+	std::scoped_lock g(_mutex);
+	_streams.erase(std::remove_if(_streams.begin(), _streams.end(), [&](const slot_handle tex)
+	{
+		const auto wrapper = _textures.get(tex);
+		if (!wrapper || !wrapper->stream)
+			return true;
+
+		wrapper->upload_stream(ctx);
+		return false;
+	}), _streams.end());
+}
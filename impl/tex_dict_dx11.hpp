@@ -5,35 +5,65 @@
 #include <d3d11.h>
 
 #include <atomic>
-#include <forward_list>
 #include <vector>
 #include <mutex>
 
+#include "../slot_map.hpp"
+#include "../stream_buffer.hpp"
+#include "../texture_region.hpp"
+#include "../texture_upload.hpp"
+
 namespace util::draw {
-	struct tex_dict_dx11;
+	// What destroyed and recreated textures leave behind while a lock-free lookup may still be handing it out.
+	// Released by tex_dict_dx11::release_retired at the start of the next draw
+	struct tex_retired_dx11
+	{
+		std::vector<IUnknown*> objects = {};
+		std::vector<std::unique_ptr<stream_buffer>> streams = {};
+	};
 
 	struct tex_wrapper_dx11
 	{
 		tex_wrapper_dx11() noexcept = default;
 		~tex_wrapper_dx11() noexcept
 		{
-			if (_texture)
-				_texture->Release();
-			if (_res_view)
-				_res_view->Release();
-			_texture = nullptr;
-			_res_view = nullptr;
+			invalidate();
 		}
 
 		tex_wrapper_dx11(const tex_wrapper_dx11&) = delete;
 		tex_wrapper_dx11& operator=(const tex_wrapper_dx11&) = delete;
 
-		tex_wrapper_dx11(tex_wrapper_dx11&&) noexcept = default;
-		tex_wrapper_dx11& operator=(tex_wrapper_dx11&&) noexcept = default;
+		// Only empty wrappers get moved, the slot_map fills and resets its slots with them
+		tex_wrapper_dx11(tex_wrapper_dx11&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+		tex_wrapper_dx11& operator=(tex_wrapper_dx11&& other) noexcept
+		{
+			assert(!_texture && !_res_view && !other._texture && !other._res_view);
+			alpha_only = other.alpha_only.load(std::memory_order_relaxed);
+			queued = other.queued;
+			stream = std::move(other.stream);
+			_texture_data = std::move(other._texture_data);
+			_dirty_regions = std::move(other._dirty_regions);
+			_size_x = other._size_x;
+			_size_y = other._size_y;
+			return *this;
+		}
+
+		// bytes_per_pixel() channels, a texture of a different size is recreated and the old one retired
+		bool set_tex_data(ID3D11Device* device, const uint8_t* data, uint32_t size_x, uint32_t size_y,
+			tex_retired_dx11& retired);
+		// Copies the rows into the cpu side data and marks them for the next apply_tex_changes, needs set_tex_data first
+		bool update_region(const texture_region& region, const uint8_t* data, uint32_t pitch);
+		// Uploads the dirty regions in order while they fit into max_bytes, the first one regardless with at_least_one.
+		// Returns the bytes uploaded, the rest stays pending
+		size_t apply_tex_changes(ID3D11DeviceContext*, size_t max_bytes, bool at_least_one);
+		size_t pending_bytes() const;
 
-		// 4 channels
-		bool set_tex_data(tex_dict_dx11* dict, ID3D11Device* device, const uint8_t* data, uint32_t size_x, uint32_t size_y);
-		bool apply_tex_changes(ID3D11DeviceContext*);
+		// Stream textures are dynamic and get the newest committed frame of stream written into them
+		bool create_stream(ID3D11Device* device, uint32_t size_x, uint32_t size_y, tex_retired_dx11& retired);
+		bool upload_stream(ID3D11DeviceContext* ctx);
 
 		bool texture_size(uint32_t& width, uint32_t& height) const
 		{
@@ -42,21 +72,21 @@ namespace util::draw {
 			return true;
 		}
 
-		void clear_data()
+		void clear_data(tex_retired_dx11& retired)
 		{
 			_texture_data.clear();
+			_dirty_regions.clear();
+			if (stream)
+				retired.streams.push_back(std::move(stream));
 			_size_x = 0;
 			_size_y = 0;
-			if (_texture)
-				_texture->Release();
-			if (_res_view)
-				_res_view->Release();
-			_texture = nullptr;
-			_res_view = nullptr;
+			retire(retired);
 		}
 
+		// Releases right away, only for when nothing can be drawing
 		void invalidate()
 		{
+			_published_view.store(nullptr, std::memory_order_release);
 			if (_texture)
 				_texture->Release();
 			if (_res_view)
@@ -65,89 +95,120 @@ namespace util::draw {
 			_res_view = nullptr;
 		}
 
-		void create(ID3D11Device* device); // <- for reset
-		ID3D11ShaderResourceView* texture() const { return _res_view; }
+		void create(ID3D11Device* device, tex_retired_dx11& retired); // <- for reset
+		// Lock-free, the view stays alive until the release_retired after it got replaced
+		ID3D11ShaderResourceView* texture() const { return _published_view.load(std::memory_order_acquire); }
+		uint32_t bytes_per_pixel() const { return alpha_only ? 1u : 4u; }
 
-		bool free = false;
+		std::atomic<bool> alpha_only = false; // DXGI_FORMAT_A8_UNORM, set on creation
+		bool queued = false;                  // in the update queue of the dict
+		std::unique_ptr<stream_buffer> stream = nullptr;
 
 	protected:
-		bool copy_texture_data(ID3D11DeviceContext* ctx);
+		void retire(tex_retired_dx11& retired)
+		{
+			_published_view.store(nullptr, std::memory_order_release);
+			if (_texture)
+				retired.objects.push_back(_texture);
+			if (_res_view)
+				retired.objects.push_back(_res_view);
+			_texture = nullptr;
+			_res_view = nullptr;
+		}
 
 		ID3D11Texture2D* _texture = nullptr;
 		ID3D11ShaderResourceView* _res_view = nullptr;
+		std::atomic<ID3D11ShaderResourceView*> _published_view = nullptr; // _res_view for the lock-free lookups
 		std::vector<uint8_t> _texture_data = {};
+		std::vector<texture_region> _dirty_regions = {}; // uploaded by the next apply_tex_changes
 
 		uint32_t _size_x = 0u, _size_y = 0u;
 	};
 
+	// Textures are addressed by slot_handles, the backend hands them out as tex_id
 	struct tex_dict_dx11 {
-		friend struct tex_wrapper_dx11;
-
 		tex_dict_dx11() = default;
 		~tex_dict_dx11() { clear_textures(); }
 
-		ID3D11ShaderResourceView* texture(const tex_wrapper_dx11* tex)
+		// Lock-free, called for every draw command. Views of textures destroyed or recreated meanwhile stay alive until
+		// the next release_retired
+		ID3D11ShaderResourceView* texture(const slot_handle tex) const
 		{
-			std::scoped_lock g(_mutex);
-			if (!is_valid_tex(tex))
-				return nullptr;
-
-			return tex->texture();
+			const auto wrapper = _textures.get(tex);
+			return wrapper ? wrapper->texture() : nullptr;
 		}
 
-		bool set_tex_data(ID3D11Device* device, tex_wrapper_dx11* tex,
-			const uint8_t* data, const uint32_t size_x,
-			const uint32_t size_y)
-		{
-			std::scoped_lock g(_mutex);
-			if (!is_valid_tex(tex))
-				return false;
+		bool set_tex_data(ID3D11Device* device, slot_handle tex,
+			const uint8_t* data, uint32_t size_x,
+			uint32_t size_y);
+		bool update_region(slot_handle tex, const texture_region& region,
+			const uint8_t* data, uint32_t pitch);
 
-			return tex->set_tex_data(this, device, data, size_x, size_y);
+		// Textures that only hold coverage, the shaders treat their color as white. Lock-free like texture()
+		bool alpha_only(const slot_handle tex) const
+		{
+			const auto wrapper = _textures.get(tex);
+			return wrapper && wrapper->alpha_only;
 		}
 
-		bool texture_size(const tex_wrapper_dx11* tex, uint32_t& width, uint32_t& height)
+		bool texture_size(const slot_handle tex, uint32_t& width, uint32_t& height)
 		{
 			std::scoped_lock g(_mutex);
-			if (!is_valid_tex(tex))
-				return false;
-
-			return tex->texture_size(width, height);
+			const auto wrapper = _textures.get(tex);
+			return wrapper && wrapper->texture_size(width, height);
 		}
 
-		bool is_valid_tex(const tex_wrapper_dx11* tex)
+		bool is_valid_tex(const slot_handle tex) const
 		{
-			return std::find(_valid_elements.begin(), _valid_elements.end(), tex) != _valid_elements.end();
+			return _textures.get(tex) != nullptr;
 		}
 
-		tex_wrapper_dx11* create_texture(uint32_t size_x, uint32_t size_y);
-		void destroy_texture(tex_wrapper_dx11* tex);
+		slot_handle create_texture(uint32_t size_x, uint32_t size_y, bool alpha_only = false);
+		slot_handle create_stream_texture(ID3D11Device* device, uint32_t size_x, uint32_t size_y, bool alpha_only = false);
 
-		// call from directx thread
+		// Null for textures that aren't streams. The buffer of a destroyed texture is kept until the next release_retired
+		stream_buffer* stream(const slot_handle tex)
+		{
+			std::scoped_lock g(_mutex);
+			const auto wrapper = _textures.get(tex);
+			return wrapper ? wrapper->stream.get() : nullptr;
+		}
+		void destroy_texture(slot_handle tex);
+
+		// call from directx thread, releases everything retired with them
 		void clear_textures();
 
+		// call from directx thread at the start of draw(), before it looks up any texture. Lookups of earlier draws are
+		// done by then and the context holds its own references to whatever is still bound
+		void release_retired();
+
 		void pre_reset()
 		{
 			std::scoped_lock g(_mutex);
-			for (auto& tex : _textures)
-				tex.invalidate();
+			_textures.for_each([](tex_wrapper_dx11& tex) { tex.invalidate(); });
 		}
 
 		void post_reset(ID3D11Device* device)
 		{
 			std::scoped_lock g(_mutex);
-			for (auto& tex : _textures)
-				if (!tex.free)
-					tex.create(device);
+			_textures.for_each([this, device](tex_wrapper_dx11& tex) { tex.create(device, _retired); });
 		}
 
-		void process_update_queue(ID3D11DeviceContext*);
+		// frame_textures are the sorted handles drawn this frame, they are uploaded first. budget 0 uploads everything
+		void process_update_queue(ID3D11DeviceContext*, size_t budget, const std::vector<slot_handle>& frame_textures,
+			texture_upload_stats& stats);
+		// Uploads the frames committed since the last call, outside of the upload budget
+		void process_streams(ID3D11DeviceContext*);
 
 	protected:
-		std::mutex _mutex;
-		std::forward_list<tex_wrapper_dx11> _textures = {};
-		std::vector<tex_wrapper_dx11*> _valid_elements = {};
+		// Has to be called with _mutex held
+		void queue_update(slot_handle tex, tex_wrapper_dx11* wrapper);
+
+		std::mutex _mutex; // serializes everything but the lookups
+		slot_map<tex_wrapper_dx11> _textures = {};
 		std::mutex _update_queue_lock;
-		std::vector<tex_wrapper_dx11*> _update_queue{};
+		std::vector<slot_handle> _update_queue{};
+		std::vector<slot_handle> _streams{}; // guarded by _mutex, destroyed ones are dropped by process_streams
+		tex_retired_dx11 _retired = {};       // guarded by _mutex
 	};
 }
@@ -9,44 +9,185 @@
 
 using namespace util::draw;
 
-void d3d9_tex_wrapper::create(IDirect3DDevice9* device)
+void d3d9_tex_wrapper::write_alpha_row(uint8_t* dst, const uint8_t* alpha, const uint32_t width)
 {
-	if (_texture)
-		_texture->Release();
-	_texture = nullptr;
+	if (a8_supported)
+	{
+		std::copy(alpha, alpha + width, dst);
+		return;
+	}
+
+	auto out = reinterpret_cast<uint32_t*>(dst);
+	for (auto x = 0u; x < width; ++x)
+		*out++ = (static_cast<uint32_t>(alpha[x]) << 24) | 0xFFFFFF;
+}
+
+void d3d9_tex_wrapper::create(IDirect3DDevice9* device, d3d9_tex_retired& retired)
+{
+	retire(retired);
 
 	const auto res =
-		device->CreateTexture(_size_x, _size_y, 1, D3DUSAGE_DYNAMIC, D3DFMT_A8R8G8B8,
+		device->CreateTexture(_size_x, _size_y, 1, D3DUSAGE_DYNAMIC, format(),
 			D3DPOOL_DEFAULT, &_texture, nullptr);
 	assert(res == D3D_OK);
+	_published_texture.store(_texture, std::memory_order_release);
 
-	copy_texture_data(device);
+	// streams have no cpu side copy, they show the next committed frame after a reset
+	if (!_texture_data.empty())
+		copy_texture_data(device);
 }
 
 bool d3d9_tex_wrapper::set_tex_data(IDirect3DDevice9* device, const uint8_t* data, const uint32_t size_x,
 	const uint32_t size_y)
 {
-	_texture_data.resize(size_x * size_y * 4);
+	_texture_data.resize(size_x * size_y * bytes_per_pixel());
 	std::copy(data, data + _texture_data.size(), _texture_data.begin());
 
 	_size_x = size_x;
 	_size_y = size_y;
 	if (!_texture)
 	{
+		// dynamic like in create(), update_region locks parts of it
 		const auto res =
-			device->CreateTexture(_size_x, _size_y, 1, 0, D3DFMT_A8R8G8B8,
+			device->CreateTexture(_size_x, _size_y, 1, D3DUSAGE_DYNAMIC, format(),
 				D3DPOOL_DEFAULT, &_texture, nullptr);
 		assert(res == D3D_OK);
+		_published_texture.store(_texture, std::memory_order_release);
 	}
 
+	_dirty_regions.clear();
 	return copy_texture_data(device);
 }
 
+bool d3d9_tex_wrapper::update_region(const texture_region& region, const uint8_t* data, uint32_t pitch)
+{
+	if (!_texture || region.x + region.w > _size_x || region.y + region.h > _size_y)
+		return false;
+
+	const auto row_size = region.w * bytes_per_pixel();
+	if (!pitch)
+		pitch = row_size;
+
+	auto dst = _texture_data.data() + (region.y * _size_x + region.x) * bytes_per_pixel();
+	for (auto row = 0u; row < region.h; ++row)
+	{
+		std::copy(data, data + row_size, dst);
+		data += pitch;
+		dst += _size_x * bytes_per_pixel();
+	}
+
+	add_dirty_region(_dirty_regions, region);
+	return true;
+}
+
+size_t d3d9_tex_wrapper::apply_tex_changes(const size_t max_bytes, const bool at_least_one)
+{
+	if (!_texture)
+	{
+		_dirty_regions.clear();
+		return 0;
+	}
+
+	// dynamic textures can be locked in place, only the changed rects get written
+	const auto pitch = _size_x * bytes_per_pixel();
+	auto uploaded = size_t{ 0 };
+	auto done = 0u;
+	for (; done < _dirty_regions.size(); done++)
+	{
+		const auto& region = _dirty_regions[done];
+		const auto bytes = static_cast<size_t>(region.w) * region.h * bytes_per_pixel();
+		const auto fits = uploaded <= max_bytes && bytes <= max_bytes - uploaded;
+		if (!fits && !(at_least_one && done == 0))
+			break;
+
+		const auto area = RECT{ static_cast<LONG>(region.x), static_cast<LONG>(region.y),
+			static_cast<LONG>(region.x + region.w), static_cast<LONG>(region.y + region.h) };
+		D3DLOCKED_RECT rect;
+		if (_texture->LockRect(0, &rect, &area, 0) != D3D_OK)
+		{
+			assert(0);
+			_dirty_regions.clear();
+			return uploaded;
+		}
+
+		const auto row_size = region.w * bytes_per_pixel();
+		auto src = _texture_data.data() + region.y * pitch + region.x * bytes_per_pixel();
+		auto dst = reinterpret_cast<uint8_t*>(rect.pBits);
+		for (auto y = 0u; y < region.h; ++y)
+		{
+			if (alpha_only)
+				write_alpha_row(dst, src, region.w);
+			else
+				std::copy(src, src + row_size, dst);
+
+			src += pitch;
+			dst += rect.Pitch;
+		}
+
+		_texture->UnlockRect(0);
+		uploaded += bytes;
+	}
+	_dirty_regions.erase(_dirty_regions.begin(), _dirty_regions.begin() + done);
+
+	return uploaded;
+}
+
+bool d3d9_tex_wrapper::create_stream(IDirect3DDevice9* device, const uint32_t size_x, const uint32_t size_y,
+	d3d9_tex_retired& retired)
+{
+	_size_x = size_x;
+	_size_y = size_y;
+	stream = std::make_unique<stream_buffer>(size_x, size_y, bytes_per_pixel());
+	create(device, retired);
+	return _texture != nullptr;
+}
+
+bool d3d9_tex_wrapper::upload_stream()
+{
+	const auto frame = _texture ? stream->consume() : nullptr;
+	if (!frame)
+		return false;
+
+	D3DLOCKED_RECT rect;
+	if (_texture->LockRect(0, &rect, nullptr, D3DLOCK_DISCARD) != D3D_OK)
+		return false;
+
+	// one pass from the staging frame into the locked rows, rgba gets swizzled on the way like in set_texture_rgba
+	auto src = frame;
+	auto dst = reinterpret_cast<uint8_t*>(rect.pBits);
+	for (auto y = 0u; y < _size_y; ++y)
+	{
+		if (alpha_only)
+			write_alpha_row(dst, src, _size_x);
+		else
+		{
+			auto in = reinterpret_cast<const uint32_t*>(src);
+			auto out = reinterpret_cast<uint32_t*>(dst);
+			for (auto x = 0u; x < _size_x; ++x, ++in)
+				*out++ = (*in & 0xFF00FF00) | ((*in & 0xFF0000) >> 16) | ((*in & 0xFF) << 16);
+		}
+
+		src += stream->pitch();
+		dst += rect.Pitch;
+	}
+
+	_texture->UnlockRect(0);
+	return true;
+}
+
+size_t d3d9_tex_wrapper::pending_bytes() const
+{
+	auto bytes = size_t{ 0 };
+	for (const auto& region : _dirty_regions)
+		bytes += static_cast<size_t>(region.w) * region.h * bytes_per_pixel();
+	return bytes;
+}
+
 bool d3d9_tex_wrapper::copy_texture_data(IDirect3DDevice9* device)
 {
 	IDirect3DTexture9* tmp_tex = nullptr;
 	auto res = device->CreateTexture(_size_x, _size_y, 1, D3DUSAGE_DYNAMIC,
-		D3DFMT_A8R8G8B8, D3DPOOL_SYSTEMMEM, &tmp_tex,
+		format(), D3DPOOL_SYSTEMMEM, &tmp_tex,
 		nullptr);
 	if (res != D3D_OK)
 	{
@@ -63,13 +204,17 @@ bool d3d9_tex_wrapper::copy_texture_data(IDirect3DDevice9* device)
 		return false;
 	}
 
+	const auto row_size = _size_x * bytes_per_pixel();
 	auto src = _texture_data.data();
 	auto dst = reinterpret_cast<uint8_t*>(rect.pBits);
 	for (auto y = 0u; y < _size_y; ++y)
 	{
-		std::copy(src, src + (_size_x * 4), dst);
+		if (alpha_only)
+			write_alpha_row(dst, src, _size_x);
+		else
+			std::copy(src, src + row_size, dst);
 
-		src += _size_x * 4;
+		src += row_size;
 		dst += rect.Pitch;
 	}
 
@@ -89,31 +234,113 @@ bool d3d9_tex_wrapper::copy_texture_data(IDirect3DDevice9* device)
 }
 
 void tex_dict_dx9::clear_textures()
+{
+	{
+		std::scoped_lock g(_mutex);
+		_textures.for_each([this](d3d9_tex_wrapper& tex) { tex.clear_data(_retired); });
+		_textures.clear();
+	}
+	release_retired();
+}
+
+void tex_dict_dx9::release_retired()
 {
 	std::scoped_lock g(_mutex);
-	for (auto& tex : _textures)
-		if (!tex.free)
-			tex.clear_data();
-	_textures.clear();
+	for (const auto texture : _retired.textures)
+		texture->Release();
+	_retired.textures.clear();
+	_retired.streams.clear();
 }
 
-d3d9_tex_wrapper* tex_dict_dx9::create_texture(uint32_t size_x, uint32_t size_y)
+slot_handle tex_dict_dx9::create_texture(uint32_t size_x, uint32_t size_y, const bool alpha_only)
 {
 	std::scoped_lock g(_mutex);
 
-	_textures.emplace_front();
-	const auto ptr = &_textures.front();
-	_valid_elements.emplace_back(ptr);
-	return ptr;
+	auto tex = d3d9_tex_wrapper{};
+	tex.alpha_only = alpha_only;
+	return _textures.insert(std::move(tex));
+}
+
+slot_handle tex_dict_dx9::create_stream_texture(IDirect3DDevice9* device, uint32_t size_x, uint32_t size_y,
+	const bool alpha_only)
+{
+	std::scoped_lock g(_mutex);
+
+	auto tex = d3d9_tex_wrapper{};
+	tex.alpha_only = alpha_only;
+	const auto handle = _textures.insert(std::move(tex));
+	if (!handle)
+		return 0;
+
+	// created in place, moving wrappers around copies their com pointers
+	const auto wrapper = _textures.get(handle);
+	if (!wrapper->create_stream(device, size_x, size_y, _retired))
+	{
+		wrapper->clear_data(_retired);
+		_textures.erase(handle);
+		return 0;
+	}
+
+	_streams.push_back(handle);
+	return handle;
+}
+
+bool tex_dict_dx9::update_region(const slot_handle tex, const texture_region& region, const uint8_t* data,
+	const uint32_t pitch)
+{
+	std::scoped_lock g(_mutex);
+	const auto wrapper = _textures.get(tex);
+	if (!wrapper || !wrapper->update_region(region, data, pitch))
+		return false;
+
+	if (!wrapper->queued)
+	{
+		wrapper->queued = true;
+		_update_queue.push_back(tex);
+	}
+	return true;
+}
+
+void tex_dict_dx9::process_update_queue(const size_t budget, const std::vector<slot_handle>& frame_textures,
+	texture_upload_stats& stats)
+{
+	// handles destroyed since they were queued just don't resolve anymore
+	std::scoped_lock g(_mutex);
+	schedule_texture_uploads(_update_queue, frame_textures, budget, stats,
+		[&](const slot_handle tex, const size_t max_bytes, const bool at_least_one) -> std::pair<size_t, size_t>
+		{
+			const auto wrapper = _textures.get(tex);
+			if (!wrapper)
+				return { 0u, 0u };
+
+			const auto uploaded = wrapper->apply_tex_changes(max_bytes, at_least_one);
+			const auto pending = wrapper->pending_bytes();
+			wrapper->queued = pending != 0;
+			return { uploaded, pending };
+		});
+}
+
+void tex_dict_dx9::process_streams()
+{
+	std::scoped_lock g(_mutex);
+	_streams.erase(std::remove_if(_streams.begin(), _streams.end(), [&](const slot_handle tex)
+	{
+		const auto wrapper = _textures.get(tex);
+		if (!wrapper || !wrapper->stream)
+			return true;
+
+		wrapper->upload_stream();
+		return false;
+	}), _streams.end());
 }
 
-void tex_dict_dx9::destroy_texture(d3d9_tex_wrapper* tex)
+void tex_dict_dx9::destroy_texture(const slot_handle tex)
 {
 	std::scoped_lock g(_mutex);
-	if (!is_valid_tex(tex))
+	const auto wrapper = _textures.get(tex);
+	if (!wrapper)
 		return;
 
-	tex->clear_data();
-	_valid_elements.erase(std::find(_valid_elements.begin(), _valid_elements.end(), tex));
-	_textures.remove_if([tex](const auto& elem) { return &elem == tex; });
+	wrapper->clear_data(_retired);
+	_textures.erase(tex);
 }
\ No newline at end of file
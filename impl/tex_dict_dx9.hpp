@@ -1,28 +1,64 @@
 #pragma once
 
 #include <atomic>
-#include <forward_list>
 #include <vector>
 #include <mutex>
 
+#include "../slot_map.hpp"
+#include "../stream_buffer.hpp"
+#include "../texture_region.hpp"
+#include "../texture_upload.hpp"
+
 namespace util::draw {
+	// What destroyed and recreated textures leave behind while a lock-free lookup may still be handing it out.
+	// Released by tex_dict_dx9::release_retired at the start of the next draw
+	struct d3d9_tex_retired
+	{
+		std::vector<IDirect3DTexture9*> textures = {};
+		std::vector<std::unique_ptr<stream_buffer>> streams = {};
+	};
+
 	struct d3d9_tex_wrapper
 	{
 		d3d9_tex_wrapper() noexcept = default;
 		~d3d9_tex_wrapper() noexcept
 		{
-			if (_texture)
-				_texture->Release();
+			invalidate();
 		}
 
 		d3d9_tex_wrapper(const d3d9_tex_wrapper&) = delete;
 		d3d9_tex_wrapper& operator=(const d3d9_tex_wrapper&) = delete;
 
-		d3d9_tex_wrapper(d3d9_tex_wrapper&&) noexcept = default;
-		d3d9_tex_wrapper& operator=(d3d9_tex_wrapper&&) noexcept = default;
+		// Only empty wrappers get moved, the slot_map fills and resets its slots with them
+		d3d9_tex_wrapper(d3d9_tex_wrapper&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+		d3d9_tex_wrapper& operator=(d3d9_tex_wrapper&& other) noexcept
+		{
+			assert(!_texture && !other._texture);
+			alpha_only = other.alpha_only.load(std::memory_order_relaxed);
+			queued = other.queued;
+			stream = std::move(other.stream);
+			_texture_data = std::move(other._texture_data);
+			_dirty_regions = std::move(other._dirty_regions);
+			_size_x = other._size_x;
+			_size_y = other._size_y;
+			return *this;
+		}
 
-		// 4 channels
+		// bytes_per_pixel() channels
 		bool set_tex_data(IDirect3DDevice9* device, const uint8_t* data, uint32_t size_x, uint32_t size_y);
+		// Copies the rows into the cpu side data and marks them for the next apply_tex_changes, needs set_tex_data first
+		bool update_region(const texture_region& region, const uint8_t* data, uint32_t pitch);
+		// Uploads the dirty regions in order while they fit into max_bytes, the first one regardless with at_least_one.
+		// Returns the bytes uploaded, the rest stays pending
+		size_t apply_tex_changes(size_t max_bytes, bool at_least_one);
+		size_t pending_bytes() const;
+
+		// Stream textures get the newest committed frame of stream written into them, swizzled to D3DFMT_A8R8G8B8
+		bool create_stream(IDirect3DDevice9* device, uint32_t size_x, uint32_t size_y, d3d9_tex_retired& retired);
+		bool upload_stream();
 
 		bool texture_size(uint32_t& width, uint32_t& height) const
 		{
@@ -31,100 +67,151 @@ namespace util::draw {
 			return true;
 		}
 
-		void clear_data()
+		void clear_data(d3d9_tex_retired& retired)
 		{
 			_texture_data.clear();
+			_dirty_regions.clear();
+			if (stream)
+				retired.streams.push_back(std::move(stream));
 			_size_x = 0;
 			_size_y = 0;
-			if (_texture)
-				_texture->Release();
-			_texture = nullptr;
+			retire(retired);
 		}
 
+		// Releases right away, for device resets where nothing can be drawing
 		void invalidate()
 		{
+			_published_texture.store(nullptr, std::memory_order_release);
 			if (_texture)
 				_texture->Release();
 			_texture = nullptr;
 		}
 
-		void create(IDirect3DDevice9* device); // <- for reset
-		IDirect3DTexture9* texture() const { return _texture; }
+		void create(IDirect3DDevice9* device, d3d9_tex_retired& retired); // <- for reset
+		// Lock-free, the texture stays alive until the release_retired after it got replaced
+		IDirect3DTexture9* texture() const { return _published_texture.load(std::memory_order_acquire); }
+		// of the cpu side data, alpha_only textures keep one byte even when the texture is expanded
+		uint32_t bytes_per_pixel() const { return alpha_only ? 1u : 4u; }
+		D3DFORMAT format() const { return alpha_only ? alpha_format() : D3DFMT_A8R8G8B8; }
 
-		bool free = false;
+		// D3DFMT_A8 where the device can sample it, otherwise coverage goes into the alpha of white D3DFMT_A8R8G8B8.
+		// The alpha only draw state gives the same result for both
+		static D3DFORMAT alpha_format() { return a8_supported ? D3DFMT_A8 : D3DFMT_A8R8G8B8; }
+		// Writes width bytes of coverage as a row of alpha_format()
+		static void write_alpha_row(uint8_t* dst, const uint8_t* alpha, uint32_t width);
+
+		static inline bool a8_supported = true; // set by d3d9_manager before it creates any texture
+		std::atomic<bool> alpha_only = false;   // alpha_format(), set on creation
+		bool queued = false;                  // in the update queue of the dict
+		std::unique_ptr<stream_buffer> stream = nullptr;
 
 	protected:
 		bool copy_texture_data(IDirect3DDevice9* device);
 
+		void retire(d3d9_tex_retired& retired)
+		{
+			_published_texture.store(nullptr, std::memory_order_release);
+			if (_texture)
+				retired.textures.push_back(_texture);
+			_texture = nullptr;
+		}
+
 		IDirect3DTexture9* _texture = nullptr;
+		std::atomic<IDirect3DTexture9*> _published_texture = nullptr; // _texture for the lock-free lookups
 		std::vector<uint8_t> _texture_data = {};
+		std::vector<texture_region> _dirty_regions = {}; // uploaded by the next apply_tex_changes
 
 		uint32_t _size_x = 0u, _size_y = 0u;
 	};
 
+	// Textures are addressed by slot_handles, the backend hands them out as tex_id
 	struct tex_dict_dx9 {
 
 		tex_dict_dx9() = default;
 		~tex_dict_dx9() { clear_textures(); }
 
-		IDirect3DTexture9* texture(const d3d9_tex_wrapper* tex)
+		// Lock-free, called for every draw command. Textures destroyed or recreated meanwhile stay alive until the next
+		// release_retired
+		IDirect3DTexture9* texture(const slot_handle tex) const
 		{
-			std::scoped_lock g(_mutex);
-			if (!is_valid_tex(tex))
-				return nullptr;
-
-			return tex->texture();
+			const auto wrapper = _textures.get(tex);
+			return wrapper ? wrapper->texture() : nullptr;
 		}
 
-		bool set_tex_data(IDirect3DDevice9* device, d3d9_tex_wrapper* tex,
+		bool set_tex_data(IDirect3DDevice9* device, const slot_handle tex,
 			const uint8_t* data, const uint32_t size_x,
 			const uint32_t size_y)
 		{
 			std::scoped_lock g(_mutex);
-			if (!is_valid_tex(tex))
-				return false;
+			const auto wrapper = _textures.get(tex);
+			return wrapper && wrapper->set_tex_data(device, data, size_x, size_y);
+		}
+
+		// Uploaded by the next process_update_queue, regions of the same texture are merged until then
+		bool update_region(slot_handle tex, const texture_region& region,
+			const uint8_t* data, uint32_t pitch);
 
-			return tex->set_tex_data(device, data, size_x, size_y);
+		// Textures that only hold coverage, the shaders treat their color as white. Lock-free like texture()
+		bool alpha_only(const slot_handle tex) const
+		{
+			const auto wrapper = _textures.get(tex);
+			return wrapper && wrapper->alpha_only;
 		}
 
-		bool texture_size(const d3d9_tex_wrapper* tex, uint32_t& width, uint32_t& height)
+		bool texture_size(const slot_handle tex, uint32_t& width, uint32_t& height)
 		{
 			std::scoped_lock g(_mutex);
-			if (!is_valid_tex(tex))
-				return false;
-
-			return tex->texture_size(width, height);
+			const auto wrapper = _textures.get(tex);
+			return wrapper && wrapper->texture_size(width, height);
 		}
 
-		bool is_valid_tex(const d3d9_tex_wrapper* tex)
+		bool is_valid_tex(const slot_handle tex) const
 		{
-			return std::find(_valid_elements.begin(), _valid_elements.end(), tex) != _valid_elements.end();
+			return _textures.get(tex) != nullptr;
 		}
 
-		d3d9_tex_wrapper* create_texture(uint32_t size_x, uint32_t size_y);
-		void destroy_texture(d3d9_tex_wrapper* tex);
+		slot_handle create_texture(uint32_t size_x, uint32_t size_y, bool alpha_only = false);
+		slot_handle create_stream_texture(IDirect3DDevice9* device, uint32_t size_x, uint32_t size_y, bool alpha_only = false);
+
+		// Null for textures that aren't streams. The buffer of a destroyed texture is kept until the next release_retired
+		stream_buffer* stream(const slot_handle tex)
+		{
+			std::scoped_lock g(_mutex);
+			const auto wrapper = _textures.get(tex);
+			return wrapper ? wrapper->stream.get() : nullptr;
+		}
+		void destroy_texture(slot_handle tex);
 
-		// call from directx thread
+		// call from directx thread, releases everything retired with them
 		void clear_textures();
 
+		// call from directx thread at the start of draw(), before it looks up any texture. Lookups of earlier draws are
+		// done by then and the device holds its own references to whatever is still bound
+		void release_retired();
+
 		void pre_reset()
 		{
 			std::scoped_lock g(_mutex);
-			for (auto& tex : _textures)
-				tex.invalidate();
+			_textures.for_each([](d3d9_tex_wrapper& tex) { tex.invalidate(); });
 		}
 
 		void post_reset(IDirect3DDevice9* device)
 		{
 			std::scoped_lock g(_mutex);
-			for (auto& tex : _textures)
-				if (!tex.free)
-					tex.create(device);
+			_textures.for_each([this, device](d3d9_tex_wrapper& tex) { tex.create(device, _retired); });
 		}
 
+		// call from directx thread. frame_textures are the sorted handles drawn this frame, they are uploaded first.
+		// budget 0 uploads everything
+		void process_update_queue(size_t budget, const std::vector<slot_handle>& frame_textures, texture_upload_stats& stats);
+		// Uploads the frames committed since the last call, outside of the upload budget
+		void process_streams();
+
 	protected:
-		std::mutex _mutex;
-		std::forward_list<d3d9_tex_wrapper> _textures = {};
-		std::vector<d3d9_tex_wrapper*> _valid_elements = {};
+		std::mutex _mutex; // serializes everything but the lookups
+		slot_map<d3d9_tex_wrapper> _textures = {};
+		std::vector<slot_handle> _update_queue{}; // guarded by _mutex
+		std::vector<slot_handle> _streams{};      // guarded by _mutex, destroyed ones are dropped by process_streams
+		d3d9_tex_retired _retired = {};           // guarded by _mutex
 	};
 }
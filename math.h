@@ -26,11 +26,11 @@ namespace math
 	{
 		float x, y;
 
-		vec2f()
+		constexpr vec2f()
 			: x(0.f),
 			  y(0.f) {}
 
-		vec2f(const float x, const float y)
+		constexpr vec2f(const float x, const float y)
 			: x(x),
 			  y(y) {}
 
@@ -0,0 +1,158 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <assert.h>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace util::draw
+{
+	// Handle into a slot_map, 0 is never valid. The low half of the bits is the slot index + 1, the high half the
+	// generation of the slot when the handle was handed out. Fits a tex_id, the backends pass them around as one
+	using slot_handle = uintptr_t;
+
+	// Generational slot map with lock-free lookups, the tex_dicts keep their texture wrappers in one
+	// Slots live in fixed size chunks that are never moved or freed before destruction, so get() is two loads and a
+	// compare and may run concurrently with everything else. insert, erase and clear have to be serialized by the owner
+	// Only the lookup itself is safe that way: the owner writes the value on insert, on clear and on the reuse of an
+	// erased slot while a reader may still hold the pointer get() returned. Whatever readers load from a value without
+	// the owner's lock has to be atomic, and what it points to has to outlive them (the tex_dicts retire their com
+	// objects until the next draw)
+	// Erasing bumps the slot generation, handles to the old value stay invalid when the slot is reused. On 32 bit
+	// targets the generation has 16 bits and a stale handle could match again after 32768 reuses of its slot
+	template<typename T, uint32_t chunk_size = 256>
+	struct slot_map
+	{
+		static constexpr uint32_t index_bits = sizeof(slot_handle) * 4;
+		static constexpr slot_handle index_mask = (slot_handle(1) << index_bits) - 1;
+		static constexpr uint32_t generation_mask = static_cast<uint32_t>(~slot_handle(0) >> index_bits);
+		static constexpr uint32_t max_chunks = static_cast<uint32_t>(index_mask / chunk_size < 1024 ? index_mask / chunk_size : 1024);
+		static constexpr uint32_t max_slots = max_chunks * chunk_size;
+
+		slot_map() = default;
+		~slot_map()
+		{
+			for (auto& chunk : _chunks)
+				delete chunk.load(std::memory_order_relaxed);
+		}
+
+		slot_map(const slot_map&) = delete;
+		slot_map& operator=(const slot_map&) = delete;
+
+		// Returns 0 if all max_slots slots are taken
+		slot_handle insert(T value = T{})
+		{
+			uint32_t index;
+			if (!_free.empty())
+			{
+				index = _free.back();
+				_free.pop_back();
+			}
+			else
+			{
+				if (_next_index >= max_slots)
+				{
+					assert(0);
+					return 0;
+				}
+
+				index = _next_index++;
+				auto& chunk = _chunks[index / chunk_size];
+				if (!chunk.load(std::memory_order_relaxed))
+					chunk.store(new chunk_type(), std::memory_order_release);
+			}
+
+			auto& s = at(index);
+			s.value = std::move(value);
+			// odd while alive, the value has to be written before readers can see the new generation
+			const auto generation = s.generation.load(std::memory_order_relaxed) + 1;
+			s.generation.store(generation, std::memory_order_release);
+			_size++;
+			return (static_cast<slot_handle>(generation & generation_mask) << index_bits) | (index + 1);
+		}
+
+		// Leaves the value alone, the owner has to clean it up before or after. Readers that looked it up before may
+		// still be using it until the slot gets reused
+		bool erase(const slot_handle handle)
+		{
+			if (!get(handle))
+				return false;
+
+			const auto index = static_cast<uint32_t>((handle & index_mask) - 1);
+			auto& s = at(index);
+			s.generation.store(s.generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+			_free.push_back(index);
+			_size--;
+			return true;
+		}
+
+		// Null for 0, erased and foreign handles
+		T* get(const slot_handle handle) const
+		{
+			const auto index = static_cast<uint32_t>((handle & index_mask) - 1); // 0 wraps around and fails below
+			if (index >= max_slots)
+				return nullptr;
+
+			const auto chunk = _chunks[index / chunk_size].load(std::memory_order_acquire);
+			if (!chunk)
+				return nullptr;
+
+			auto& s = (*chunk)[index % chunk_size];
+			if ((s.generation.load(std::memory_order_acquire) & generation_mask) != static_cast<uint32_t>(handle >> index_bits))
+				return nullptr;
+			return &s.value;
+		}
+
+		// Calls fn(T&) for every live value
+		template<typename Fn>
+		void for_each(Fn&& fn)
+		{
+			for (auto i = 0u; i < _next_index; i++)
+			{
+				auto& s = at(i);
+				if (s.generation.load(std::memory_order_relaxed) & 1)
+					fn(s.value);
+			}
+		}
+
+		// Erases everything and resets the values, the chunks stay allocated
+		void clear()
+		{
+			_free.clear();
+			for (auto i = _next_index; i > 0; i--)
+			{
+				auto& s = at(i - 1);
+				if (s.generation.load(std::memory_order_relaxed) & 1)
+					s.generation.store(s.generation.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+				s.value = T{};
+				_free.push_back(i - 1);
+			}
+			_size = 0;
+		}
+
+		size_t size() const
+		{
+			return _size;
+		}
+
+	private:
+		struct slot
+		{
+			std::atomic<uint32_t> generation{0};
+			T value{};
+		};
+		using chunk_type = std::array<slot, chunk_size>;
+
+		slot& at(const uint32_t index)
+		{
+			return (*_chunks[index / chunk_size].load(std::memory_order_relaxed))[index % chunk_size];
+		}
+
+		std::array<std::atomic<chunk_type*>, max_chunks> _chunks{};
+		std::vector<uint32_t> _free = {}; // erased slots, reused before new ones
+		uint32_t _next_index = 0;          // slots below were handed out at least once
+		size_t _size = 0;
+	};
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+namespace util::draw
+{
+	// Triple buffer between one producer thread and the render thread for textures that change every frame.
+	// The producer writes a frame into map() and publishes it with commit(), the renderer takes the newest committed
+	// frame with consume(). Neither side waits or copies, frames committed faster than they are drawn are dropped
+	struct stream_buffer
+	{
+		stream_buffer(const uint32_t width, const uint32_t height, const uint32_t bytes_per_pixel)
+			: _width(width), _height(height), _pitch(width * bytes_per_pixel)
+		{
+			for (auto& frame : _frames)
+				frame = std::make_unique<uint8_t[]>(static_cast<size_t>(_pitch) * height);
+		}
+
+		stream_buffer(const stream_buffer&) = delete;
+		stream_buffer& operator=(const stream_buffer&) = delete;
+
+		// Producer side, the frame stays the same until the next commit()
+		uint8_t* map()
+		{
+			return _frames[_write].get();
+		}
+
+		void commit()
+		{
+			// the written frame becomes the middle one, the previous middle one is written next
+			_write = _middle.exchange(static_cast<uint8_t>(_write | fresh), std::memory_order_acq_rel) & index_mask;
+		}
+
+		// Render thread side, null if nothing was committed since the last call
+		const uint8_t* consume()
+		{
+			if (!(_middle.load(std::memory_order_relaxed) & fresh))
+				return nullptr;
+
+			_read = _middle.exchange(_read, std::memory_order_acq_rel) & index_mask;
+			return _frames[_read].get();
+		}
+
+		uint32_t width() const
+		{
+			return _width;
+		}
+
+		uint32_t height() const
+		{
+			return _height;
+		}
+
+		// Bytes per row, rows are packed
+		uint32_t pitch() const
+		{
+			return _pitch;
+		}
+
+	private:
+		static constexpr uint8_t index_mask = 3;
+		static constexpr uint8_t fresh = 4; // set in _middle while it holds a frame consume() didn't take yet
+
+		std::array<std::unique_ptr<uint8_t[]>, 3> _frames = {};
+		std::atomic<uint8_t> _middle{1};
+		uint8_t _write = 0; // only touched by the producer
+		uint8_t _read = 2;  // only touched by the render thread
+
+		uint32_t _width = 0, _height = 0, _pitch = 0;
+	};
+}
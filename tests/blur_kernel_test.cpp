@@ -0,0 +1,107 @@
+// Checks the blur kernels against a plain Gaussian convolution, standalone:
+// g++ -std=c++17 -I.. blur_kernel_test.cpp -o blur_kernel_test && ./blur_kernel_test
+#include "blur_kernel.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <random>
+
+using namespace util::draw;
+
+namespace
+{
+	// Every texel within strength, weighted like make_blur_kernel and mirrored at the edges like apply_blur_kernel
+	void gaussian_blur(const uint8_t strength, const std::vector<float>& src, std::vector<float>& dst, const uint32_t length)
+	{
+		const auto radius = static_cast<int>(strength);
+		const auto sigma = static_cast<float>(strength) / 3.f;
+		const auto period = static_cast<int>(length) * 2;
+		dst.assign(src.size(), 0.f);
+		for (auto x = 0; x < static_cast<int>(length); ++x)
+		{
+			auto col = 0.f, sum = 0.f;
+			for (auto k = -radius; k <= radius; ++k)
+			{
+				auto i = (x + k) % period;
+				if (i < 0)
+					i += period;
+				if (i >= static_cast<int>(length))
+					i = period - 1 - i;
+
+				const auto weight = std::exp(-0.5f * static_cast<float>(k * k) / (sigma * sigma));
+				col += src[i] * weight;
+				sum += weight;
+			}
+			dst[x] = col / sum;
+		}
+	}
+
+	float max_error(const blur_kernel& kernel, const uint8_t strength, const std::vector<float>& src)
+	{
+		const auto length = static_cast<uint32_t>(src.size());
+		std::vector<float> expected, actual;
+		gaussian_blur(strength, src, expected, length);
+		apply_blur_kernel(kernel, src, actual, length, 1, 1, true);
+
+		auto error = 0.f;
+		for (auto i = 0u; i < length; ++i)
+			error = std::max(error, std::abs(expected[i] - actual[i]));
+		return error;
+	}
+
+	float weight_sum(const blur_kernel& kernel)
+	{
+		auto sum = kernel.weights[0];
+		for (auto i = 1u; i < kernel.taps; ++i)
+			sum += kernel.weights[i] * 2.f;
+		return sum;
+	}
+}
+
+int main()
+{
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> dist(0.f, 1.f);
+	std::vector<float> noise(600);
+	for (auto& v : noise)
+		v = dist(rng);
+
+	// Up to max_taps pairs of texels every tap merges two neighbours, which the bilinear sample reproduces exactly
+	for (const auto strength : {1, 2, 3, 8, 17, 40, 64})
+	{
+		const auto& kernel = blur_kernel_for(static_cast<uint8_t>(strength));
+		assert(kernel.taps <= blur_kernel::max_taps + 1);
+		assert(std::abs(weight_sum(kernel) - 1.f) < 1e-5f);
+
+		const auto error = max_error(kernel, static_cast<uint8_t>(strength), noise);
+		printf("strength %3d: %2u taps, max error %g\n", strength, kernel.taps, error);
+		assert(error < 1e-4f);
+	}
+
+	// Past that the taps get sparser, so only smooth input comes out the same and the tap count stays bounded
+	{
+		const auto& kernel = blur_kernel_for(255);
+		assert(kernel.taps <= blur_kernel::max_taps + 1);
+		assert(std::abs(weight_sum(kernel) - 1.f) < 1e-5f);
+
+		std::vector<float> smooth(noise.size());
+		for (auto i = 0u; i < smooth.size(); ++i)
+			smooth[i] = 0.5f + 0.5f * std::sin(static_cast<float>(i) * 0.01f);
+
+		const auto smooth_error = max_error(kernel, 255, smooth);
+		const auto noise_error = max_error(kernel, 255, noise);
+		printf("strength 255: %2u taps, max error %g smooth, %g noise\n", kernel.taps, smooth_error, noise_error);
+		assert(smooth_error < 1e-3f);
+		assert(noise_error < 0.15f);
+	}
+
+	// Strength 0 leaves the image alone
+	{
+		std::vector<float> actual;
+		apply_blur_kernel(blur_kernel_for(0), noise, actual, static_cast<uint32_t>(noise.size()), 1, 1, true);
+		assert(blur_kernel_for(0).taps == 1 && actual == noise);
+	}
+
+	printf("ok\n");
+	return 0;
+}
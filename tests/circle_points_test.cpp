@@ -0,0 +1,72 @@
+// Checks that the constexpr circle tables are bit-identical to filling them at runtime with std::cos/std::sin, the way
+// draw_manager::init used to. Standalone: g++ -std=c++17 -I.. circle_points_test.cpp -o circle_points_test && ./circle_points_test
+#include "circle_points.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+
+using namespace util::draw;
+
+namespace
+{
+	struct point
+	{
+		float x, y;
+	};
+
+	// The old init_circle_points, with the table size as a parameter
+	template<size_t POINT_COUNT>
+	std::array<point, POINT_COUNT * 8 + 8> runtime_circle_points()
+	{
+		std::array<point, POINT_COUNT + 1> octant_buf{};
+		const auto step = (circle_points_pi * 0.25f) / POINT_COUNT;
+		for (auto i = 0u; i <= POINT_COUNT; ++i)
+			octant_buf[i] = point{ static_cast<float>(std::cos(step * i)), static_cast<float>(std::sin(step * i)) };
+
+		std::array<point, POINT_COUNT * 8 + 8> points{};
+		for (auto i = 0u; i < 8; ++i)
+		{
+			const auto swap_xy = i == 1 || i == 2 || i == 5 || i == 6;
+			const auto x_mult = i >= 2 && i <= 5 ? -1.f : 1.f;
+			const auto y_mult = i >= 4 ? -1.f : 1.f;
+			const auto reverse = i % 2 == 1;
+
+			for (auto j = 0u; j <= POINT_COUNT; ++j)
+			{
+				auto& fill_pos = points[j + i * (POINT_COUNT + 1)];
+				const auto& src_pos = octant_buf[reverse ? POINT_COUNT - j : j];
+				fill_pos.x = (swap_xy ? src_pos.y : src_pos.x) * x_mult;
+				fill_pos.y = (swap_xy ? src_pos.x : src_pos.y) * y_mult;
+			}
+		}
+		std::rotate(points.begin(), points.begin() + (points.size() - POINT_COUNT * 2 - 2), points.end());
+		return points;
+	}
+
+	template<size_t POINT_COUNT>
+	void check()
+	{
+		constexpr auto generated = make_circle_points<point, POINT_COUNT>();
+		const auto runtime = runtime_circle_points<POINT_COUNT>();
+		for (auto i = 0u; i < generated.size(); ++i)
+		{
+			if (std::memcmp(&generated[i], &runtime[i], sizeof(point)) != 0)
+				printf("%zu points per octant, point %u: %.9g, %.9g vs %.9g, %.9g\n", POINT_COUNT, i,
+					generated[i].x, generated[i].y, runtime[i].x, runtime[i].y);
+		}
+		assert(std::memcmp(generated.data(), runtime.data(), sizeof(generated)) == 0);
+	}
+}
+
+int main()
+{
+	check<8>();
+	check<16>();
+	check<32>();
+	check<64>();
+	printf("circle tables match\n");
+	return 0;
+}
@@ -0,0 +1,209 @@
+// Checks the slot_map handles and the retire pattern the tex_dicts build on it, with a mock standing in for the com
+// objects. Standalone: g++ -std=c++17 -pthread -I.. slot_map_test.cpp -o slot_map_test && ./slot_map_test
+#include "slot_map.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+using namespace util::draw;
+
+namespace
+{
+	// Never freed before the end of the test, so a lookup that hands out a released one is caught instead of crashing
+	struct mock_texture
+	{
+		std::atomic<bool> released = false;
+
+		void Release()
+		{
+			assert(!released);
+			released = true;
+		}
+	};
+
+	std::vector<std::unique_ptr<mock_texture>> all_textures;
+
+	mock_texture* new_texture()
+	{
+		return all_textures.emplace_back(std::make_unique<mock_texture>()).get();
+	}
+
+	// Same shape as the tex_dict wrappers: a plain pointer for the owner, a published copy for the lock-free lookups
+	struct mock_wrapper
+	{
+		mock_wrapper() = default;
+		mock_wrapper(mock_wrapper&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+		mock_wrapper& operator=(mock_wrapper&& other) noexcept
+		{
+			assert(!_texture && !other._texture);
+			size = other.size;
+			return *this;
+		}
+
+		void create(std::vector<mock_texture*>& retired)
+		{
+			retire(retired);
+			_texture = new_texture();
+			_published.store(_texture, std::memory_order_release);
+		}
+
+		void retire(std::vector<mock_texture*>& retired)
+		{
+			_published.store(nullptr, std::memory_order_release);
+			if (_texture)
+				retired.push_back(_texture);
+			_texture = nullptr;
+		}
+
+		mock_texture* texture() const
+		{
+			return _published.load(std::memory_order_acquire);
+		}
+
+		uint32_t size = 0;
+
+	private:
+		mock_texture* _texture = nullptr;
+		std::atomic<mock_texture*> _published = nullptr;
+	};
+
+	void test_handles()
+	{
+		slot_map<uint32_t, 4> map;
+		assert(map.get(0) == nullptr);
+
+		const auto a = map.insert(1);
+		const auto b = map.insert(2);
+		assert(a && b && a != b && map.size() == 2);
+		assert(*map.get(a) == 1 && *map.get(b) == 2);
+
+		// the slot of a is reused, its old handle must not see the new value
+		assert(map.erase(a) && !map.erase(a) && map.get(a) == nullptr);
+		const auto c = map.insert(3);
+		assert((c & map.index_mask) == (a & map.index_mask) && c != a);
+		assert(map.get(a) == nullptr && *map.get(c) == 3);
+
+		// an index nobody handed out and one past every chunk
+		assert(map.get((b & ~map.index_mask) | 4) == nullptr);
+		assert(map.get(map.index_mask) == nullptr);
+	}
+
+	void test_chunks()
+	{
+		slot_map<uint32_t, 4> map;
+		std::vector<slot_handle> handles;
+		std::vector<uint32_t*> values;
+		for (auto i = 0u; i < 64; i++)
+		{
+			handles.push_back(map.insert(i));
+			values.push_back(map.get(handles.back()));
+		}
+
+		// growing never moves a value
+		for (auto i = 0u; i < handles.size(); i++)
+			assert(map.get(handles[i]) == values[i] && *values[i] == i);
+
+		auto live = 0u;
+		map.for_each([&live](uint32_t&) { live++; });
+		assert(live == 64);
+
+		map.clear();
+		assert(map.size() == 0);
+		for (const auto handle : handles)
+			assert(map.get(handle) == nullptr);
+
+		live = 0;
+		map.for_each([&live](uint32_t&) { live++; });
+		assert(live == 0);
+
+		// the chunks stay, new handles land in the same values
+		const auto reused = map.insert(7);
+		assert(reused && *map.get(reused) == 7 && map.size() == 1);
+	}
+
+	// One thread recreates and destroys textures under the lock like set_tex_data and destroy_texture, the other looks
+	// them up without it like draw() and drains the retired ones before every round like release_retired
+	void test_retire()
+	{
+		constexpr auto count = 16u;
+		constexpr auto rounds = 20000u;
+
+		std::mutex mutex;
+		slot_map<mock_wrapper, 4> map;
+		std::vector<mock_texture*> retired;
+		std::array<std::atomic<slot_handle>, count> handles{};
+		for (auto& handle : handles)
+		{
+			const auto h = map.insert();
+			map.get(h)->create(retired);
+			handle = h;
+		}
+
+		std::atomic<bool> done = false;
+		std::thread writer([&]
+		{
+			for (auto i = 0u; i < rounds; i++)
+			{
+				std::scoped_lock g(mutex);
+				auto& handle = handles[i % count];
+				const auto wrapper = map.get(handle);
+				if (i % 3)
+				{
+					// resized in place
+					wrapper->size++;
+					wrapper->create(retired);
+					continue;
+				}
+
+				wrapper->retire(retired);
+				map.erase(handle);
+				const auto h = map.insert();
+				map.get(h)->create(retired);
+				handle = h;
+			}
+			done = true;
+		});
+
+		auto lookups = 0u;
+		while (!done)
+		{
+			{
+				std::scoped_lock g(mutex);
+				for (const auto texture : retired)
+					texture->Release();
+				retired.clear();
+			}
+
+			for (const auto& handle : handles)
+			{
+				const auto wrapper = map.get(handle);
+				const auto texture = wrapper ? wrapper->texture() : nullptr;
+				assert(!texture || !texture->released);
+				lookups += texture != nullptr;
+			}
+		}
+		writer.join();
+
+		map.for_each([&retired](mock_wrapper& wrapper) { wrapper.retire(retired); });
+		for (const auto texture : retired)
+			texture->Release();
+		for (const auto& texture : all_textures)
+			assert(texture->released);
+		printf("%u lookups of %zu textures\n", lookups, all_textures.size());
+	}
+}
+
+int main()
+{
+	test_handles();
+	test_chunks();
+	test_retire();
+	printf("ok\n");
+	return 0;
+}
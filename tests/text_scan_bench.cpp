@@ -0,0 +1,185 @@
+// Times the ascii run scanners of text_scan.hpp against decoding every character, on generated log and chat text.
+// Standalone: g++ -std=c++17 -O2 -I.. text_scan_bench.cpp -o text_scan_bench && ./text_scan_bench
+#include "text_scan.hpp"
+
+#include <cassert>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <string>
+
+using namespace util::draw;
+
+namespace
+{
+	constexpr auto corpus_size = 16u << 20;
+	constexpr auto rounds = 8u;
+
+	// Stands in for the first lookup page, everything else gets one advance like a cjk font
+	float ascii_advance[128];
+	constexpr auto wide_advance = 13.f;
+
+	float advance(const uint32_t c)
+	{
+		return c < 0x80 ? ascii_advance[c] : wide_advance;
+	}
+
+	std::string make_log(std::mt19937& rng)
+	{
+		static const char* const levels[] = { "info", "warn", "debug", "error" };
+		static const char* const messages[] = {
+			"processed request in", "cache miss for key", "reconnecting to upstream after",
+			"flushed batch of entries, took", "texture upload finished in"
+		};
+
+		const auto r = [&rng](const uint32_t n)
+		{
+			return static_cast<unsigned>(rng() % n);
+		};
+
+		std::string text;
+		char line[256];
+		while (text.size() < corpus_size)
+		{
+			const auto n = snprintf(line, sizeof(line), "2026-10-18 12:%02u:%02u.%03u [%s] worker %u: %s %u.%ums\n",
+				r(60), r(60), r(1000), levels[r(4)], r(16), messages[r(5)], r(100), r(10));
+			text.append(line, n);
+		}
+		return text;
+	}
+
+	std::string make_chat(std::mt19937& rng)
+	{
+		static const char* const messages[] = {
+			"hey, are you coming tonight?", "sure! see you at 8", "\xE3\x81\x93\xE3\x82\x93\xE3\x81\xAB\xE3\x81\xA1\xE3\x81\xAF",
+			"gr\xC3\xBC\xC3\x9F""e aus M\xC3\xBCnchen", "lol \xF0\x9F\x98\x82\xF0\x9F\x98\x82", "ok",
+			"\xE4\xBB\x8A\xE6\x97\xA5\xE3\x81\xAF\xE3\x81\x84\xE3\x81\x84\xE5\xA4\xA9\xE6\xB0\x97\xE3\x81\xA7\xE3\x81\x99\xE3\x81\xAD",
+			"did anyone read the patch notes? the new map is huge"
+		};
+		static const char* const names[] = { "alice", "bob", "\xE3\x81\x95\xE3\x81\x8F\xE3\x82\x89", "m\xC3\xBCller" };
+
+		std::string text;
+		while (text.size() < corpus_size)
+		{
+			text += "<";
+			text += names[rng() % 4];
+			text += "> ";
+			text += messages[rng() % 8];
+			text += "\n";
+		}
+		return text;
+	}
+
+	// Character by character like the text walks before the scanners
+	float sum_decoded(const char* s, const char* text_end)
+	{
+		auto width = 0.f;
+		while (s < text_end)
+		{
+			auto c = static_cast<uint32_t>(static_cast<uint8_t>(*s));
+			if (c < 0x80)
+				s += 1;
+			else
+				s += text_char_from_utf8(&c, s, text_end);
+			if (c < 32)
+				continue;
+			width += advance(c);
+		}
+		return width;
+	}
+
+	// Same result, printable ascii runs are found 16 bytes at a time and only get their advances summed
+	float sum_runs(const char* s, const char* text_end)
+	{
+		auto width = 0.f;
+		while (s < text_end)
+		{
+			if (static_cast<uint8_t>(*s) >= 0x20 && static_cast<uint8_t>(*s) < 0x80)
+			{
+				for (const auto run_end = text_plain_ascii_end(s, text_end); s < run_end; s++)
+					width += ascii_advance[static_cast<uint8_t>(*s)];
+				continue;
+			}
+
+			auto c = static_cast<uint32_t>(static_cast<uint8_t>(*s));
+			if (c < 0x80)
+				s += 1;
+			else
+				s += text_char_from_utf8(&c, s, text_end);
+			if (c < 32)
+				continue;
+			width += advance(c);
+		}
+		return width;
+	}
+
+	size_t count_words_bytewise(const char* s, const char* text_end)
+	{
+		auto words = size_t{ 0 };
+		while (s < text_end)
+		{
+			const auto begin = s;
+			while (s < text_end)
+			{
+				const auto c = static_cast<uint8_t>(*s);
+				if (c <= 0x20 || c >= 0x80 || text_is_wrap_punct(c))
+					break;
+				s++;
+			}
+			words += s != begin;
+			s++;
+		}
+		return words;
+	}
+
+	size_t count_words_scanned(const char* s, const char* text_end)
+	{
+		auto words = size_t{ 0 };
+		while (s < text_end)
+		{
+			const auto begin = s;
+			s = text_word_end(s, text_end);
+			words += s != begin;
+			s++;
+		}
+		return words;
+	}
+
+	template <typename F>
+	double bench(const std::string& text, F&& walk, decltype(walk(nullptr, nullptr))& result)
+	{
+		const auto begin = std::chrono::steady_clock::now();
+		for (auto i = 0u; i < rounds; i++)
+			result = walk(text.data(), text.data() + text.size());
+		const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+		return static_cast<double>(text.size()) * rounds / seconds / (1 << 20);
+	}
+
+	void run(const char* name, const std::string& text)
+	{
+		float decoded = 0.f, runs = 0.f;
+		const auto decoded_speed = bench(text, sum_decoded, decoded);
+		const auto runs_speed = bench(text, sum_runs, runs);
+		// same additions in the same order
+		assert(decoded == runs);
+
+		size_t bytewise = 0, scanned = 0;
+		const auto bytewise_speed = bench(text, count_words_bytewise, bytewise);
+		const auto scanned_speed = bench(text, count_words_scanned, scanned);
+		assert(bytewise == scanned);
+
+		printf("%s: advances %.0f MB/s decoded, %.0f MB/s runs | words %.0f MB/s bytewise, %.0f MB/s scanned\n",
+			name, decoded_speed, runs_speed, bytewise_speed, scanned_speed);
+	}
+}
+
+int main()
+{
+	for (auto c = 0u; c < 128; c++)
+		ascii_advance[c] = static_cast<float>(5 + c % 5);
+
+	std::mt19937 rng(42);
+	run("log", make_log(rng));
+	run("chat", make_chat(rng));
+	return 0;
+}
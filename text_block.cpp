@@ -0,0 +1,244 @@
+#include "text_block.hpp"
+
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+using namespace util::draw;
+
+text_block::text_block(font* font, const float size, const float wrap_width)
+	: _font(font),
+	  _size(size > 0.f ? size : font->font_size),
+	  _font_size(size <= 0.f),
+	  _wrap_width(wrap_width)
+{
+	assert(font != nullptr && font->container_atlas != nullptr);
+	_generation = font->advance_generation.load();
+	index_open_lines();
+}
+
+void text_block::append(const char* text, const char* text_end)
+{
+	assert(text != nullptr);
+	if (!text_end)
+		text_end = text + strlen(text);
+
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+	_text.append(text, text_end);
+	_lines.resize(_open_line);
+	index_open_lines();
+}
+
+void text_block::clear()
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	_text.clear();
+	reindex();
+}
+
+void text_block::set_wrap_width(const float wrap_width)
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	if (_wrap_width == wrap_width)
+		return;
+
+	_wrap_width = wrap_width;
+	reindex();
+}
+
+void text_block::set_size(const float size)
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	const auto new_size = size > 0.f ? size : _font->font_size;
+	_font_size = size <= 0.f;
+	if (_size == new_size)
+		return;
+
+	_size = new_size;
+	reindex();
+}
+
+void text_block::render(draw_buffer* buf, const position& pos, const float scroll_y, const float view_height, const pack_color col)
+{
+	assert(buf != nullptr);
+	if (col.a() == 0)
+		return;
+
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+
+	const auto first = scroll_y > 0.f ? static_cast<size_t>(scroll_y / _size) : 0u;
+	const auto last = std::min(_lines.size(), static_cast<size_t>(std::max(scroll_y + view_height, 0.f) / _size) + 1u);
+	if (first >= last)
+		return;
+
+	buf->push_font(_font);
+	const auto clip_rect = buf->cur_clip_rect();
+	for (auto i = first; i < last; i++)
+	{
+		const auto& line = _lines[i];
+		if (line.begin == line.end)
+			continue;
+
+		const auto y = pos.y + static_cast<float>(i) * _size - scroll_y;
+		_font->render_text(buf, _size, position{ pos.x, y }, col, clip_rect, _text.data() + line.begin, _text.data() + line.end);
+	}
+	buf->pop_font();
+}
+
+size_t text_block::hit_test(const position& pt)
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+
+	const auto idx = pt.y > 0.f ? std::min(static_cast<size_t>(pt.y / _size), _lines.size() - 1) : 0u;
+	const auto& line = _lines[idx];
+
+	// calc_text_size stops in front of the first character reaching past max_width
+	const char* remaining = nullptr;
+	_font->calc_text_size(_size, pt.x, 0.f, _text.data() + line.begin, _text.data() + line.end, &remaining);
+	return static_cast<size_t>(remaining - _text.data());
+}
+
+size_t text_block::line_from_offset(const size_t offset)
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+	return find_line(offset);
+}
+
+position text_block::offset_position(const size_t offset)
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+
+	const auto idx = find_line(offset);
+	const auto& line = _lines[idx];
+	const auto end = std::min(offset, static_cast<size_t>(line.end));
+	const auto x = _font->calc_text_size(_size, FLT_MAX, 0.f, _text.data() + line.begin, _text.data() + end).x;
+	return position{ x, static_cast<float>(idx) * _size };
+}
+
+position text_block::content_size()
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+	return position{ std::max(_max_width, open_lines_width()), static_cast<float>(_lines.size()) * _size };
+}
+
+size_t text_block::line_count()
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+	return _lines.size();
+}
+
+text_block::line text_block::get_line(const size_t idx)
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	validate();
+	assert(idx < _lines.size());
+	return _lines[idx];
+}
+
+void text_block::index_open_lines()
+{
+	const char* const text_begin = _text.c_str();
+	const auto text_end = text_begin + _text.size();
+	const char* s = text_begin + _open_offset;
+	while (true)
+	{
+		auto line_end = reinterpret_cast<const char*>(memchr(s, '\n', text_end - s));
+		if (!line_end)
+			line_end = text_end;
+
+		_open_line = _lines.size();
+		_open_offset = static_cast<size_t>(s - text_begin);
+		index_logical_line(s, line_end);
+		if (line_end == text_end)
+			break;
+
+		// Closed by the newline, its width can't change anymore
+		_max_width = std::max(_max_width, open_lines_width());
+		s = line_end + 1;
+	}
+}
+
+void text_block::validate()
+{
+	const auto generation = _font->advance_generation.load();
+	if (_generation == generation)
+		return;
+
+	_generation = generation;
+	if (_font_size)
+		_size = _font->font_size;
+	reindex();
+}
+
+void text_block::reindex()
+{
+	_lines.clear();
+	_open_line = 0;
+	_open_offset = 0;
+	_max_width = 0.f;
+	index_open_lines();
+}
+
+size_t text_block::find_line(const size_t offset) const
+{
+	const auto it = std::upper_bound(_lines.begin(), _lines.end(), offset, [](const size_t o, const line& l)
+	{
+		return o < l.begin;
+	});
+	return it == _lines.begin() ? 0u : static_cast<size_t>(it - _lines.begin()) - 1u;
+}
+
+void text_block::index_logical_line(const char* begin, const char* end)
+{
+	const auto text_begin = _text.data();
+	const auto add_line = [&](const char* line_begin, const char* line_end)
+	{
+		_lines.push_back(line{
+			static_cast<uint32_t>(line_begin - text_begin),
+			static_cast<uint32_t>(line_end - text_begin),
+			line_begin == line_end ? 0.f : _font->calc_text_size(_size, FLT_MAX, 0.f, line_begin, line_end).x
+		});
+	};
+
+	if (_wrap_width <= 0.f || begin == end)
+	{
+		add_line(begin, end);
+		return;
+	}
+
+	// Same wrapping as font::render_text
+	const auto scale = _size / _font->font_size;
+	auto s = begin;
+	while (s < end)
+	{
+		auto eol = _font->calc_word_wrap_pos(scale, s, end, _wrap_width);
+		if (eol == s)
+		{
+			// Wrap_width is too small to fit anything, force one whole character on the line
+			eol++;
+			while (eol < end && (*eol & 0xC0) == 0x80)
+				eol++;
+		}
+		add_line(s, eol);
+
+		// Wrapping skips upcoming blanks
+		s = eol;
+		while (s < end && (*s == ' ' || *s == '\t'))
+			s++;
+	}
+}
+
+float text_block::open_lines_width() const
+{
+	auto width = 0.f;
+	for (auto i = _open_line; i < _lines.size(); i++)
+		width = std::max(width, _lines[i].width);
+	return width;
+}
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "draw_manager.hpp"
+
+#include <string>
+
+namespace util::draw
+{
+	// Append-only block of text for large, scrollable views like log consoles. Line starts and widths are indexed
+	// once when text is appended, drawing only touches the visible lines and hit-testing is a lookup plus a binary search
+	// With a wrap width every wrapped part is its own line, so scrolling and hit-testing work on what's on screen
+	// The index only holds byte ranges and widths, it's rebuilt when the font's advances change (font::advance_generation)
+	// or the size does, builds that just move glyphs and glyph cache evictions leave it alone
+	struct text_block
+	{
+		struct line
+		{
+			uint32_t begin, end; // byte range into text(), without the newline and the blanks skipped by wrapping
+			float width;
+		};
+
+		text_block(font* font, float size = 0.f, float wrap_width = 0.f);
+
+		text_block(const text_block&) = delete;
+		text_block& operator=(const text_block&) = delete;
+
+		// Only the last unterminated line is indexed again, appending costs O(appended text)
+		void append(const char* text, const char* text_end = nullptr);
+		void clear();
+
+		// Both re-index the whole block if the value changed, a size of 0 follows the font size
+		void set_wrap_width(float wrap_width);
+		void set_size(float size);
+
+		// Draws the lines overlapping [scroll_y, scroll_y + view_height) with pos as the top left corner of the view
+		void render(draw_buffer* buf, const position& pos, float scroll_y, float view_height, pack_color col);
+
+		// Byte offset of the character under pt, pt is relative to the top left corner of the block and clamped to it
+		size_t hit_test(const position& pt);
+		// Index of the line containing the byte offset
+		size_t line_from_offset(size_t offset);
+		// Top left corner of the character at the byte offset, relative to the top left corner of the block
+		position offset_position(size_t offset);
+
+		// Size of the whole block, for scrollbars
+		position content_size();
+		float line_height() const
+		{
+			return _size;
+		}
+
+		size_t line_count();
+		line get_line(size_t idx);
+
+		// Not synchronized with append(), only for the thread appending
+		const std::string& text() const
+		{
+			return _text;
+		}
+
+	private:
+		// Everything below has to be called with _mutex held
+		// Indexes _text from _open_offset on
+		void index_open_lines();
+		// Re-indexes everything if the advances changed
+		void validate();
+		void reindex();
+		size_t find_line(size_t offset) const;
+		void index_logical_line(const char* begin, const char* end);
+		float open_lines_width() const;
+
+		font* _font = nullptr;
+		float _size = 0.f;
+		bool _font_size = false; // _size follows the font size, which a build can change
+		float _wrap_width = 0.f;
+		uint32_t _generation = 0;
+
+		std::string _text = {};
+		std::vector<line> _lines = {};
+		size_t _open_line = 0;   // first line of the last logical line, the one append() continues
+		size_t _open_offset = 0; // and its first byte
+		float _max_width = 0.f;  // of the lines before _open_line
+		std::mutex _mutex;
+	};
+}
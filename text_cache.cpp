@@ -0,0 +1,142 @@
+#include "text_cache.hpp"
+#include "hash_bytes.hpp"
+
+#include <cstring>
+
+using namespace util::draw;
+
+text_cache::text_cache(const size_t max_entries)
+	: _max_entries(max_entries)
+{
+	assert(max_entries > 0);
+}
+
+position text_cache::text_size(draw_buffer* buf, font* font, const float size, const char* text, const float wrap_width)
+{
+	assert(buf != nullptr && text != nullptr);
+	if (!font)
+		font = buf->cur_font;
+	assert(font);
+
+	std::lock_guard<std::mutex> g(_mutex);
+	return find_layout(font, size, text, wrap_width).size;
+}
+
+void text_cache::text(draw_buffer* buf,
+	font* font,
+	const float size,
+	const char* text,
+	const position& pos,
+	const pack_color col,
+	const uint8_t align,
+	const float wrap_width)
+{
+	assert(buf != nullptr && text != nullptr);
+	if (col.a() == 0)
+		return;
+
+	if (font != nullptr)
+		buf->push_font(font);
+
+	assert(buf->cur_font);
+	const auto cur_font = buf->cur_font;
+
+	{
+		std::lock_guard<std::mutex> g(_mutex);
+		const auto& layout = find_layout(cur_font, size, text, wrap_width);
+
+		auto origin = pos + cur_font->display_offset;
+		if (align & TEXT_ALIGN_CENTER_X)
+			origin.x -= layout.size.x * 0.5f;
+		else if (align & TEXT_ALIGN_RIGHT)
+			origin.x -= layout.size.x;
+		if (align & TEXT_ALIGN_CENTER_Y)
+			origin.y -= layout.size.y * 0.5f;
+		else if (align & TEXT_ALIGN_BOTTOM)
+			origin.y -= layout.size.y;
+
+		const auto quad_count = static_cast<uint32_t>(layout.quads.size());
+		if (quad_count)
+			buf->prim_reserve(quad_count * 6, quad_count * 4);
+
+		for (const auto& line : layout.lines)
+		{
+			auto line_x = origin.x;
+			if (align & TEXT_ALIGN_CENTER_X)
+				line_x += (layout.size.x - line.width) * 0.5f;
+			else if (align & TEXT_ALIGN_RIGHT)
+				line_x += layout.size.x - line.width;
+
+			// Pixel aligned like font::render_text
+			const auto offset = position{
+				static_cast<float>(static_cast<int>(line_x)),
+				static_cast<float>(static_cast<int>(origin.y))
+			};
+			for (auto i = line.quad_begin; i < line.quad_end; i++)
+			{
+				const auto& quad = layout.quads[i];
+				buf->prim_rect_uv(quad.p0 + offset, quad.p1 + offset, quad.uv0, quad.uv1, col);
+			}
+		}
+	}
+
+	if (font != nullptr)
+		buf->pop_font();
+}
+
+void text_cache::clear()
+{
+	std::lock_guard<std::mutex> g(_mutex);
+	_entries.clear();
+	_lookup.clear();
+}
+
+const text_layout& text_cache::find_layout(font* font, const float size, const char* text, const float wrap_width)
+{
+	assert(font->container_atlas != nullptr);
+	const auto length = strlen(text);
+	auto hash = hash_bytes(text, length);
+	hash = hash_bytes(&font, sizeof(font), hash);
+	hash = hash_bytes(&size, sizeof(size), hash);
+	hash = hash_bytes(&wrap_width, sizeof(wrap_width), hash);
+	const auto generation = font->layout_generation.load();
+
+	const auto it = _lookup.find(hash);
+	if (it != _lookup.end())
+	{
+		auto& found = *it->second;
+		if (found.font == font && found.size == size && found.wrap_width == wrap_width
+			&& found.text.size() == length && !memcmp(found.text.data(), text, length))
+		{
+			_entries.splice(_entries.begin(), _entries, it->second);
+			// an evicted glyph cache cell only redoes the layouts that used it
+			if (found.generation != generation || !font->touch_layout(found.layout))
+			{
+				font->layout_text(size, wrap_width, text, text + length, found.layout);
+				found.generation = generation;
+			}
+			return found.layout;
+		}
+
+		// Hash collision, the new string takes over the slot
+		_entries.erase(it->second);
+		_lookup.erase(it);
+	}
+
+	if (_entries.size() >= _max_entries)
+	{
+		_lookup.erase(_entries.back().hash);
+		_entries.pop_back();
+	}
+
+	auto& added = _entries.emplace_front();
+	added.hash = hash;
+	added.font = font;
+	added.size = size;
+	added.wrap_width = wrap_width;
+	added.generation = generation;
+	added.text.assign(text, length);
+	font->layout_text(size, wrap_width, text, text + length, added.layout);
+	_lookup[hash] = _entries.begin();
+	return added.layout;
+}
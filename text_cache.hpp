@@ -0,0 +1,73 @@
+#pragma once
+
+#include "draw_manager.hpp"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+
+enum TEXT_ALIGN_FLAG : uint8_t
+{
+	TEXT_ALIGN_LEFT = 0,
+	TEXT_ALIGN_CENTER_X = (1 << 0), // pos is the horizontal center, every line is centered on its own
+	TEXT_ALIGN_RIGHT = (1 << 1),    // pos is the right edge, every line is right aligned
+	TEXT_ALIGN_CENTER_Y = (1 << 2),
+	TEXT_ALIGN_BOTTOM = (1 << 3),
+
+	TEXT_ALIGN_CENTER = TEXT_ALIGN_CENTER_X | TEXT_ALIGN_CENTER_Y
+};
+
+namespace util::draw
+{
+	// Remembers the layout of strings per font, size and wrap width. Drawing text that was seen before skips the
+	// utf-8 decoding, glyph lookups and measuring and just copies the quads to the new position
+	// Layouts are rebuilt after a build moved the font's glyphs (font::layout_generation) or one of the glyph cache
+	// cells they use was evicted (font::touch_layout)
+	struct text_cache
+	{
+		text_cache(size_t max_entries = 1024);
+
+		text_cache(const text_cache&) = delete;
+		text_cache& operator=(const text_cache&) = delete;
+
+		// Same result as draw_buffer::text_size, font may be null to use the current font of buf
+		position text_size(draw_buffer* buf, font* font, float size, const char* text, float wrap_width = 0.f);
+
+		// Draws like draw_buffer::text, align is a combination of TEXT_ALIGN_FLAG and is resolved from the cached size
+		void text(draw_buffer* buf,
+			font* font,
+			float size,
+			const char* text,
+			const position& pos,
+			pack_color col,
+			uint8_t align = TEXT_ALIGN_LEFT,
+			float wrap_width = 0.f);
+
+		void clear();
+
+		size_t entry_count() const
+		{
+			return _entries.size();
+		}
+
+	private:
+		struct entry
+		{
+			uint64_t hash = 0;
+			const font* font = nullptr;
+			float size = 0.f;
+			float wrap_width = 0.f;
+			uint32_t generation = 0;
+			std::string text = {};
+			text_layout layout = {};
+		};
+
+		// Returns the layout of text, building it on a miss. Has to be called with _mutex held
+		const text_layout& find_layout(font* font, float size, const char* text, float wrap_width);
+
+		size_t _max_entries = 0;
+		std::list<entry> _entries = {}; //Most recently used first
+		std::unordered_map<uint64_t, std::list<entry>::iterator> _lookup = {};
+		std::mutex _mutex;
+	};
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+
+#if defined(_M_X64) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define FONT_TEXT_SSE2
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Utf-8 decoding and the ascii run scanners the text walks of font use, header only so tests/text_scan_bench.cpp can
+// run them on their own
+namespace util::draw
+{
+	// Decodes one character, returns the bytes it took. Invalid sequences give 0xFFFD, 0 for bytes no sequence starts with
+	inline int text_char_from_utf8(unsigned int *out_char, const char *in_text, const char *in_text_end)
+	{
+		auto c          = -1;
+		const auto *str = reinterpret_cast<const unsigned char*>(in_text);
+		if (!(*str & 0x80))
+		{
+			c         = static_cast<uint32_t>(*str++);
+			*out_char = c;
+			return 1;
+		}
+		if ((*str & 0xe0) == 0xc0)
+		{
+			*out_char = 0xFFFD; // will be invalid but not end of string
+			if (in_text_end && in_text_end - reinterpret_cast<const char*>(str) < 2)
+				return 1;
+			if (*str < 0xc2)
+				return 2;
+			c = static_cast<uint32_t>((*str++ & 0x1f) << 6);
+			if ((*str & 0xc0) != 0x80)
+				return 2;
+			c += (*str++ & 0x3f);
+			*out_char = c;
+			return 2;
+		}
+		if ((*str & 0xf0) == 0xe0)
+		{
+			*out_char = 0xFFFD; // will be invalid but not end of string
+			if (in_text_end && in_text_end - reinterpret_cast<const char*>(str) < 3)
+				return 1;
+			if (*str == 0xe0 && (str[1] < 0xa0 || str[1] > 0xbf))
+				return 3;
+			if (*str == 0xed && str[1] > 0x9f)
+				return 3; // str[1] < 0x80 is checked below
+			c = static_cast<uint32_t>((*str++ & 0x0f) << 12);
+			if ((*str & 0xc0) != 0x80)
+				return 3;
+			c += static_cast<uint32_t>((*str++ & 0x3f) << 6);
+			if ((*str & 0xc0) != 0x80)
+				return 3;
+			c += (*str++ & 0x3f);
+			*out_char = c;
+			return 3;
+		}
+		if ((*str & 0xf8) == 0xf0)
+		{
+			*out_char = 0xFFFD; // will be invalid but not end of string
+			if (in_text_end && in_text_end - reinterpret_cast<const char*>(str) < 4)
+				return 1;
+			if (*str > 0xf4)
+				return 4;
+			if (*str == 0xf0 && (str[1] < 0x90 || str[1] > 0xbf))
+				return 4;
+			if (*str == 0xf4 && str[1] > 0x8f)
+				return 4; // str[1] < 0x80 is checked below
+			c = static_cast<uint32_t>((*str++ & 0x07) << 18);
+			if ((*str & 0xc0) != 0x80)
+				return 4;
+			c += static_cast<uint32_t>((*str++ & 0x3f) << 12);
+			if ((*str & 0xc0) != 0x80)
+				return 4;
+			c += static_cast<uint32_t>((*str++ & 0x3f) << 6);
+			if ((*str & 0xc0) != 0x80)
+				return 4;
+			c += (*str++ & 0x3f);
+			// utf-8 encodings of values used in surrogate pairs are invalid
+			if ((c & 0xFFFFF800) == 0xD800)
+				return 4;
+			*out_char = c;
+			return 4;
+		}
+		*out_char = 0;
+		return 0;
+	}
+
+	inline uint32_t lowest_set_bit(const uint32_t mask)
+	{
+#ifdef _MSC_VER
+		unsigned long idx;
+		_BitScanForward(&idx, mask);
+		return idx;
+#else
+		return static_cast<uint32_t>(__builtin_ctz(mask));
+#endif
+	}
+
+	// Characters calc_word_wrap_pos may break after (besides blanks)
+	inline bool text_is_wrap_punct(const uint8_t c)
+	{
+		return c == '.' || c == ',' || c == ';' || c == '!' || c == '?' || c == '\"';
+	}
+
+	// End of the run of printable ascii (0x20..0x7F) at text. Those need neither utf-8 decoding nor control character handling
+	inline const char* text_plain_ascii_end(const char *text, const char *text_end)
+	{
+		auto s = text;
+#ifdef FONT_TEXT_SSE2
+		// Bytes >= 0x80 are negative as signed chars, so a single compare catches them together with the control characters
+		const auto min_plain = _mm_set1_epi8(0x20);
+		while (text_end - s >= 16)
+		{
+			const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+			const auto mask  = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmplt_epi8(chunk, min_plain)));
+			if (mask)
+				return s + lowest_set_bit(mask);
+			s += 16;
+		}
+#endif
+		while (s < text_end && static_cast<uint8_t>(*s) >= 0x20 && static_cast<uint8_t>(*s) < 0x80)
+			s++;
+		return s;
+	}
+
+	// End of the run of ascii word characters at text, stops at blanks, wrap punctuation, control characters and non-ascii
+	inline const char* text_word_end(const char *text, const char *text_end)
+	{
+		auto s = text;
+#ifdef FONT_TEXT_SSE2
+		const auto min_word = _mm_set1_epi8(0x21);
+		while (text_end - s >= 16)
+		{
+			const auto chunk = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s));
+			auto stop        = _mm_cmplt_epi8(chunk, min_word);
+			stop             = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('.')));
+			stop             = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')));
+			stop             = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8(';')));
+			stop             = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('!')));
+			stop             = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('?')));
+			stop             = _mm_or_si128(stop, _mm_cmpeq_epi8(chunk, _mm_set1_epi8('\"')));
+			const auto mask  = static_cast<uint32_t>(_mm_movemask_epi8(stop));
+			if (mask)
+				return s + lowest_set_bit(mask);
+			s += 16;
+		}
+#endif
+		while (s < text_end)
+		{
+			const auto c = static_cast<uint8_t>(*s);
+			if (c <= 0x20 || c >= 0x80 || text_is_wrap_punct(c))
+				break;
+			s++;
+		}
+		return s;
+	}
+}
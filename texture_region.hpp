@@ -0,0 +1,59 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace util::draw
+{
+	// Pixel rect of a texture, x/y is the top left corner
+	struct texture_region
+	{
+		uint32_t x, y, w, h;
+	};
+
+	// Adds region to the regions waiting for upload. Regions it overlaps or touches are merged into it, and once there
+	// are more than max_regions everything collapses into their bounding box, so uploads stay few and never overlap
+	inline void add_dirty_region(std::vector<texture_region>& regions, texture_region region, const size_t max_regions = 8)
+	{
+		if (!region.w || !region.h)
+			return;
+
+		// A merged region can reach ones the original didn't, so start over after every merge
+		for (auto i = 0u; i < regions.size();)
+		{
+			const auto other = regions[i];
+			if (region.x > other.x + other.w || other.x > region.x + region.w
+				|| region.y > other.y + other.h || other.y > region.y + region.h)
+			{
+				i++;
+				continue;
+			}
+
+			const auto x1 = std::max(region.x + region.w, other.x + other.w);
+			const auto y1 = std::max(region.y + region.h, other.y + other.h);
+			region.x = std::min(region.x, other.x);
+			region.y = std::min(region.y, other.y);
+			region.w = x1 - region.x;
+			region.h = y1 - region.y;
+			regions[i] = regions.back();
+			regions.pop_back();
+			i = 0;
+		}
+		regions.push_back(region);
+
+		if (regions.size() <= max_regions)
+			return;
+
+		auto x0 = region.x, y0 = region.y, x1 = region.x + region.w, y1 = region.y + region.h;
+		for (const auto& other : regions)
+		{
+			x0 = std::min(x0, other.x);
+			y0 = std::min(y0, other.y);
+			x1 = std::max(x1, other.x + other.w);
+			y1 = std::max(y1, other.y + other.h);
+		}
+		regions.assign(1, texture_region{ x0, y0, x1 - x0, y1 - y0 });
+	}
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "slot_map.hpp"
+
+namespace util::draw
+{
+	// What the upload queue of the last draw() did
+	struct texture_upload_stats
+	{
+		size_t uploaded_bytes = 0;
+		uint32_t uploaded_textures = 0; // with at least one region uploaded
+		uint32_t queued_textures = 0;   // still waiting afterwards
+		size_t queued_bytes = 0;
+	};
+
+	// Works through the texture upload queue of a frame. Textures in frame_textures (sorted) were drawn this frame and
+	// go first, the others keep their queue order. budget caps the bytes per frame, 0 uploads everything
+	// upload(handle, max_bytes, at_least_one) uploads the pending regions of one texture that fit into max_bytes and
+	// returns {bytes uploaded, bytes still pending}, {0, 0} for handles that don't resolve anymore. The first upload of a
+	// frame gets at_least_one so a region bigger than the whole budget still goes through eventually
+	template<typename Fn>
+	void schedule_texture_uploads(std::vector<slot_handle>& queue,
+		const std::vector<slot_handle>& frame_textures,
+		const size_t budget,
+		texture_upload_stats& stats,
+		Fn&& upload)
+	{
+		stats = {};
+		if (queue.empty())
+			return;
+
+		if (!frame_textures.empty())
+		{
+			std::stable_partition(queue.begin(), queue.end(), [&](const slot_handle tex)
+			{
+				return std::binary_search(frame_textures.begin(), frame_textures.end(), tex);
+			});
+		}
+
+		const auto limit = budget ? budget : std::numeric_limits<size_t>::max();
+		auto kept = queue.begin();
+		for (const auto tex : queue)
+		{
+			const auto left = stats.uploaded_bytes < limit ? limit - stats.uploaded_bytes : 0u;
+			const auto result = upload(tex, left, stats.uploaded_bytes == 0);
+			if (result.first)
+			{
+				stats.uploaded_textures++;
+				stats.uploaded_bytes += result.first;
+			}
+
+			if (result.second)
+			{
+				*kept++ = tex;
+				stats.queued_textures++;
+				stats.queued_bytes += result.second;
+			}
+		}
+		queue.erase(kept, queue.end());
+	}
+}